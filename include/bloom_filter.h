@@ -1,6 +1,8 @@
 #ifndef LSM_BLOOM_FILTER_H
 #define LSM_BLOOM_FILTER_H
 
+#include <array>
+
 #include "common.h"
 #include "murmur_hash_3.h"
 
@@ -13,8 +15,11 @@ public:
 
     bool IsProbablyPresent(const Key &) const;
 
+    /// Probe `n` keys at once, setting `ret[i]` for `keys[i]`.
+    void IsProbablyPresent(const Key *keys, size_t n, bool *ret) const;
+
     // write the array into a file
-    void ToFile(std::ofstream &) const;
+    void ToFile(std::ostream &) const;
 
     /// Restore the filter from a file.
     /// The file must contain exclusively the bloom filter.
@@ -50,8 +55,30 @@ bool BloomFilter<Key>::IsProbablyPresent(const Key &key) const {
          filter_[hash[3] % kBloomFilterSize];
 }
 
+/**
+ * All keys are hashed, and their bits prefetched, before any bit is tested,
+ * so the loads of the filter overlap instead of stalling one after another.
+ */
+template <typename Key>
+void BloomFilter<Key>::IsProbablyPresent(const Key *keys, size_t n,
+                                         bool *ret) const {
+  std::vector<std::array<unsigned int, 4>> hashes(n);
+  for (size_t i = 0; i < n; ++i) {
+    MurmurHash3_x64_128(&keys[i], sizeof(keys[i]), 1, hashes[i].data());
+    for (unsigned int hash : hashes[i]) {
+      __builtin_prefetch(&filter_[hash % kBloomFilterSize]);
+    }
+  }
+  for (size_t i = 0; i < n; ++i) {
+    ret[i] = filter_[hashes[i][0] % kBloomFilterSize] &&
+             filter_[hashes[i][1] % kBloomFilterSize] &&
+             filter_[hashes[i][2] % kBloomFilterSize] &&
+             filter_[hashes[i][3] % kBloomFilterSize];
+  }
+}
+
 template <typename Key>
-inline void BloomFilter<Key>::ToFile(std::ofstream &sst_file) const {
+inline void BloomFilter<Key>::ToFile(std::ostream &sst_file) const {
   sst_file.write((char *)filter_, kBloomFilterSize);
 }
 
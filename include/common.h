@@ -16,12 +16,19 @@
 #include "kvstore_api.h"
 
 typedef uint64_t Timestamp;
+typedef uint64_t SequenceNumber;
 typedef std::shared_ptr<std::string> StringSPtr;
 
+const SequenceNumber kMaxSequenceNumber =
+    std::numeric_limits<SequenceNumber>::max();
+
 const size_t kMaxSSTableSize = 1 << 21;
-const size_t kIndexSizePerValue = 12;
-const size_t kSSTHeaderSize = 32;
+// Key, sequence number and offset of an entry.
+const size_t kIndexSizePerValue = 20;
+const size_t kSSTHeaderSize = 40;
 const size_t kBloomFilterSize = 10240;
 const std::string kDeletionMark = "~DELETED~";  /* NOLINT */
+// Prefix of the operands of merges not yet combined with the value of a key.
+const std::string kMergeMark = "~MERGE~";  /* NOLINT */
 
 #endif
\ No newline at end of file
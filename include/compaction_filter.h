@@ -0,0 +1,32 @@
+#ifndef LSM_COMPACTION_FILTER_H
+#define LSM_COMPACTION_FILTER_H
+
+#include <cstdint>
+#include <string>
+
+/**
+ * User hook run on every value a merge rewrites, deletion marks excluded.
+ *
+ * A removed key is written as a deletion mark, so that older values of it in
+ * the levels below stay hidden, unless the merge goes into the bottom level.
+ * SSTs moved to the next level without a merge are not filtered, so a value
+ * may survive a filter for a while.
+ *
+ * Filters are called from the background compaction thread, and must not
+ * touch the store.
+ */
+class CompactionFilter {
+ public:
+  enum class Decision { kKeep, kRemove, kChangeValue };
+
+  virtual ~CompactionFilter() = default;
+
+  virtual std::string Name() const = 0;
+
+  /// Decide the fate of `value`, stored under `key` and about to be written
+  /// into `level`. Set `new_value` along with `kChangeValue`.
+  virtual Decision Filter(size_t level, uint64_t key, const std::string &value,
+                          std::string *new_value) const = 0;
+};
+
+#endif  // LSM_COMPACTION_FILTER_H
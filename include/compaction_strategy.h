@@ -0,0 +1,104 @@
+#ifndef LSM_COMPACTION_STRATEGY_H
+#define LSM_COMPACTION_STRATEGY_H
+
+#include <cstddef>
+#include <string>
+
+/**
+ * Decides the shape of every level and when it overflows.
+ *
+ * A level is either leveled, holding one sorted run of SSTs with disjoint key
+ * ranges, or tiered, holding several overlapping sorted runs that are searched
+ * newest first like level-0. A tiered level is always compacted as a whole,
+ * a leveled level only loses the SSTs that overflow. A leveled level must not
+ * sit above a tiered one.
+ *
+ * The strategy has to stay the same for a data directory, since it decides how
+ * the SSTs of each level are laid out.
+ */
+class CompactionStrategy {
+ public:
+  virtual ~CompactionStrategy() = default;
+
+  virtual std::string Name() const = 0;
+
+  virtual bool IsTiered(size_t level, size_t num_levels) const = 0;
+
+  /// Number of SSTs (leveled) or sorted runs (tiered) a level holds before it
+  /// is compacted into the next one.
+  virtual size_t Capacity(size_t level, size_t num_levels) const = 0;
+
+  /// Expected number of times a byte is written to disk, flush included.
+  virtual double WriteAmplification(size_t num_levels) const = 0;
+
+  /// Expected ratio of on-disk bytes to live bytes.
+  virtual double SpaceAmplification(size_t num_levels) const = 0;
+};
+
+/**
+ * Level-0 is tiered, every other level is leveled, and level i holds up to
+ * `size_ratio^(i+1)` SSTs. The default ratio reproduces the `2 << i` policy.
+ */
+class LeveledCompaction : public CompactionStrategy {
+ public:
+  explicit LeveledCompaction(size_t size_ratio = 2);
+
+  std::string Name() const override;
+
+  bool IsTiered(size_t level, size_t num_levels) const override;
+
+  size_t Capacity(size_t level, size_t num_levels) const override;
+
+  double WriteAmplification(size_t num_levels) const override;
+
+  double SpaceAmplification(size_t num_levels) const override;
+
+ private:
+  const size_t kSizeRatio;
+};
+
+/**
+ * Size-tiered (universal) compaction: every level is tiered and holds up to
+ * `size_ratio` runs, which are merged into a single run of the next level.
+ */
+class TieredCompaction : public CompactionStrategy {
+ public:
+  explicit TieredCompaction(size_t size_ratio = 4);
+
+  std::string Name() const override;
+
+  bool IsTiered(size_t level, size_t num_levels) const override;
+
+  size_t Capacity(size_t level, size_t num_levels) const override;
+
+  double WriteAmplification(size_t num_levels) const override;
+
+  double SpaceAmplification(size_t num_levels) const override;
+
+ private:
+  const size_t kSizeRatio;
+};
+
+/**
+ * Lazy leveling: tiered like `TieredCompaction` everywhere but the bottom
+ * level, which is leveled and holds up to `size_ratio^(i+1)` SSTs.
+ */
+class LazyLevelingCompaction : public CompactionStrategy {
+ public:
+  explicit LazyLevelingCompaction(size_t size_ratio = 4);
+
+  std::string Name() const override;
+
+  bool IsTiered(size_t level, size_t num_levels) const override;
+
+  size_t Capacity(size_t level, size_t num_levels) const override;
+
+  double WriteAmplification(size_t num_levels) const override;
+
+  double SpaceAmplification(size_t num_levels) const override;
+
+ private:
+  const size_t kSizeRatio;
+};
+
+#endif  // LSM_COMPACTION_STRATEGY_H
@@ -0,0 +1,135 @@
+#ifndef LSM_EVENT_LOG_H
+#define LSM_EVENT_LOG_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Timeline of the work stores do besides serving calls: flushes, compaction
+ * jobs and their subcompactions, deletions of SST files and write stalls, as
+ * complete events of the threads doing them, each logged once done with its
+ * start and duration. It exports to the Chrome trace event format, which
+ * chrome://tracing and Perfetto show as a timeline.
+ *
+ * It may be shared by several stores, and is safe for concurrent use. Only the
+ * latest `capacity` events are kept.
+ */
+class EventLog {
+ public:
+  /**
+   * Named arguments of an event, shown along with it.
+   */
+  class Args {
+   public:
+    Args &Add(const std::string &name, uint64_t value);
+
+    Args &Add(const std::string &name, const std::string &value);
+
+    Args &Add(const std::string &name, const std::vector<std::string> &values);
+
+    /// The members of a JSON object, without the braces.
+    const std::string &Json() const { return json_; }
+
+   private:
+    void AddName(const std::string &name);
+
+    std::string json_;
+  };
+
+  explicit EventLog(size_t capacity = 1 << 16);
+
+  EventLog(const EventLog &) = delete;
+
+  EventLog &operator=(const EventLog &) = delete;
+
+  /// Record an event of the calling thread, from `start` until now.
+  void Complete(const std::string &name,
+                std::chrono::steady_clock::time_point start,
+                const Args &args = Args());
+
+  size_t Size() const;
+
+  void Clear();
+
+  /// `{"traceEvents": [...]}`, one event per line, timestamps in
+  /// microseconds since the log was created.
+  std::string ToChromeTrace() const;
+
+  /// Write `ToChromeTrace()` to a file, throwing `std::system_error` if it
+  /// cannot be written.
+  void ExportChromeTrace(const std::string &path) const;
+
+ private:
+  struct Event {
+    std::string name;
+
+    uint64_t micros;
+
+    uint64_t duration_micros;
+
+    // Small numbers handed to threads in the order they log first.
+    uint32_t tid;
+
+    std::string args;
+  };
+
+  uint64_t MicrosSinceStart(std::chrono::steady_clock::time_point time) const;
+
+  const size_t kCapacity;
+
+  const std::chrono::steady_clock::time_point kStart;
+
+  mutable std::mutex mutex_;
+
+  std::deque<Event> events_;
+
+  std::map<std::thread::id, uint32_t> tids_;
+};
+
+/**
+ * Logs an event from when it is constructed until it is destroyed. Does
+ * nothing if the log is `nullptr`.
+ */
+class EventSpan {
+ public:
+  EventSpan(EventLog *event_log, const char *name,
+            const EventLog::Args &args = EventLog::Args())
+      : event_log_(event_log),
+        name_(name),
+        start_(std::chrono::steady_clock::now()),
+        args_(args) {}
+
+  EventSpan(const EventSpan &) = delete;
+
+  EventSpan &operator=(const EventSpan &) = delete;
+
+  ~EventSpan() {
+    if (event_log_) {
+      event_log_->Complete(name_, start_, args_);
+    }
+  }
+
+  bool Enabled() const { return event_log_ != nullptr; }
+
+  /// Arguments to add to those of the event, for what is only known once
+  /// done.
+  EventLog::Args &EndArgs() { return args_; }
+
+ private:
+  EventLog *const event_log_;
+
+  const char *const name_;
+
+  const std::chrono::steady_clock::time_point start_;
+
+  EventLog::Args args_;
+};
+
+#endif  // LSM_EVENT_LOG_H
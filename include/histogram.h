@@ -0,0 +1,74 @@
+#ifndef LSM_HISTOGRAM_H
+#define LSM_HISTOGRAM_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * Distribution of values such as latencies, in buckets growing as powers of
+ * two, each power split into `kSubBuckets` even buckets, as in HdrHistogram.
+ * Percentiles are within 1 / `kSubBuckets` of the true ones, whatever the
+ * range of values.
+ *
+ * Values may be added by several threads at once, and read while they are,
+ * though a read may miss the values racing with it.
+ */
+class Histogram {
+ public:
+  Histogram();
+
+  Histogram(const Histogram &) = delete;
+
+  Histogram &operator=(const Histogram &) = delete;
+
+  void Add(uint64_t value);
+
+  /// Add the values of another histogram to this one.
+  void Merge(const Histogram &other);
+
+  void Clear();
+
+  uint64_t Count() const;
+
+  uint64_t Sum() const;
+
+  /// 0 if there are no values.
+  uint64_t Min() const;
+
+  uint64_t Max() const;
+
+  double Average() const;
+
+  /// The value `p` percent of the values are at most, 0 if there are none.
+  double Percentile(double p) const;
+
+  /// `count: N avg: X p50: X p99: X p99.9: X max: N`
+  std::string ToString() const;
+
+ private:
+  static const size_t kSubBucketBits = 4;
+
+  static const size_t kSubBuckets = 1 << kSubBucketBits;
+
+  // Values below `kSubBuckets` have a bucket each, then every power of two up
+  // to 2^63 has `kSubBuckets`.
+  static const size_t kNumBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+  static size_t BucketFor(uint64_t value);
+
+  static uint64_t BucketLow(size_t bucket);
+
+  std::atomic<uint64_t> buckets_[kNumBuckets];
+
+  std::atomic<uint64_t> count_;
+
+  std::atomic<uint64_t> sum_;
+
+  std::atomic<uint64_t> min_;
+
+  std::atomic<uint64_t> max_;
+};
+
+#endif  // LSM_HISTOGRAM_H
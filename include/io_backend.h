@@ -0,0 +1,231 @@
+#ifndef LSM_IO_BACKEND_H
+#define LSM_IO_BACKEND_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef LSM_HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+/**
+ * A read of `length` bytes at `offset` of an open file into `buf`, or a write
+ * of them from `buf`.
+ */
+struct IORequest {
+  int fd;
+
+  uint64_t offset;
+
+  size_t length;
+
+  char *buf;
+
+  // Set by the backend. Less than `length` only at the end of the file, or on
+  // an error.
+  size_t bytes_done;
+
+  // Set by the backend to the `errno` of a failed request, 0 if none failed.
+  int error;
+};
+
+/**
+ * Serves the reads of SST values, and the writes of the SSTs compactions
+ * output. Requests are handed over in batches, so that a backend may keep many
+ * of them in flight at once.
+ */
+class IOBackend {
+ public:
+  virtual ~IOBackend() = default;
+
+  virtual const char *Name() const = 0;
+
+  /// Serve all the read requests, in any order, and return once they are done.
+  virtual void Read(std::vector<IORequest> &requests) = 0;
+
+  /// Serve all the write requests, in any order, and return once they are
+  /// done.
+  virtual void Write(std::vector<IORequest> &requests) = 0;
+
+  /// Add the requests for `length` bytes at `offset`, split into requests of
+  /// at most `kMaxRequestSize` bytes, so that a large read or write keeps
+  /// several of them in flight.
+  static void AddRequests(int fd, uint64_t offset, size_t length, char *buf,
+                          std::vector<IORequest> &requests);
+
+  /// The io_uring backend where the system supports it, else the `pread` one.
+  static std::shared_ptr<IOBackend> NewDefault();
+
+  /// Open a file to read, throwing `std::system_error` if it cannot be.
+  static int Open(const std::string &path);
+
+  /// Create or truncate a file to write, throwing `std::system_error` if it
+  /// cannot be.
+  static int Create(const std::string &path);
+
+  /// Throw `std::system_error` if a request was not read in full, since a
+  /// short read would leave zeros in the values.
+  static void CheckRead(const std::vector<IORequest> &requests,
+                        const std::string &path);
+
+  /// Throw `std::system_error` if a request was not written in full.
+  static void CheckWrite(const std::vector<IORequest> &requests,
+                         const std::string &path);
+
+ protected:
+  static void PosixRead(IORequest &request);
+
+  static void PosixWrite(IORequest &request);
+
+ private:
+  static const size_t kMaxRequestSize = 32 << 10;
+
+  static const unsigned kDefaultQueueDepth = 64;
+};
+
+/**
+ * Serves the requests one after another with `pread` and `pwrite`.
+ */
+class PosixIOBackend : public IOBackend {
+ public:
+  const char *Name() const override { return "pread"; }
+
+  void Read(std::vector<IORequest> &requests) override;
+
+  void Write(std::vector<IORequest> &requests) override;
+};
+
+#ifdef LSM_HAVE_IO_URING
+/**
+ * Keeps up to a queue depth of requests in flight through an io_uring, set up
+ * with raw system calls. Requests the kernel fails are served with `pread` or
+ * `pwrite`, and so is the rest of a batch if the ring itself fails.
+ *
+ * Concurrent readers share the ring: the lock is only held to queue requests
+ * and to reap completions, which are routed to the batch they belong to. One
+ * reader at a time waits in the kernel for completions, and wakes the others
+ * once it has reaped them.
+ */
+class IoUringIOBackend : public IOBackend {
+ public:
+  /// `nullptr` if the kernel does not let a ring be set up.
+  static std::unique_ptr<IoUringIOBackend> Create(unsigned queue_depth);
+
+  ~IoUringIOBackend() override;
+
+  const char *Name() const override { return "io_uring"; }
+
+  void Read(std::vector<IORequest> &requests) override;
+
+  void Write(std::vector<IORequest> &requests) override;
+
+ private:
+  /**
+   * The requests of a call to `Read` or `Write`, and how far they are.
+   */
+  struct Batch;
+
+  /**
+   * A request in flight, which comes back with its completion.
+   */
+  struct Op {
+    Batch *batch;
+
+    size_t idx;
+  };
+
+  struct Batch {
+    std::vector<IORequest> *requests;
+
+    // `IORING_OP_READ` or `IORING_OP_WRITE`.
+    uint8_t opcode;
+
+    std::vector<Op> ops;
+
+    // Next request not yet queued.
+    size_t next;
+
+    size_t num_done;
+
+    // Requests to queue again, for the rest after a short read.
+    std::vector<size_t> again;
+
+    // Requests the kernel failed, to serve with `pread` or `pwrite` without
+    // the lock.
+    std::vector<size_t> failed;
+
+    // Set once the ring failed the batch. Its requests in flight are still
+    // reaped, since their completions point into the batch, but the others
+    // are all served as failed.
+    bool ring_failed;
+  };
+
+  explicit IoUringIOBackend(int ring_fd);
+
+  bool MapRings(const io_uring_params &params);
+
+  void Serve(std::vector<IORequest> &requests, uint8_t opcode);
+
+  void Prepare(const Batch &batch, const Op *op);
+
+  void Submit(Batch &batch);
+
+  void Unqueue(Batch &batch);
+
+  void Reap();
+
+  const int kRingFd;
+
+  unsigned sq_entries_;
+
+  void *sq_ring_;
+
+  size_t sq_ring_size_;
+
+  void *cq_ring_;
+
+  size_t cq_ring_size_;
+
+  io_uring_sqe *sqes_;
+
+  size_t sqes_size_;
+
+  unsigned *sq_tail_;
+
+  unsigned *sq_mask_;
+
+  unsigned *sq_array_;
+
+  unsigned *cq_head_;
+
+  unsigned *cq_tail_;
+
+  unsigned *cq_mask_;
+
+  io_uring_cqe *cqes_;
+
+  // Guards the rings and everything below.
+  std::mutex mutex_;
+
+  // Signals completions reaped, or the waiter in the kernel gone.
+  std::condition_variable reaped_cv_;
+
+  // Requests queued, but not yet taken by the kernel.
+  unsigned num_unsubmitted_;
+
+  // Requests queued and not yet reaped, of all readers. Kept within the
+  // submission ring, so that the completion ring, twice as large, never
+  // overflows.
+  unsigned num_in_flight_;
+
+  // Set while a reader waits in the kernel for completions.
+  bool waiting_;
+};
+#endif
+
+#endif  // LSM_IO_BACKEND_H
@@ -0,0 +1,273 @@
+#ifndef LSM_ITERATOR_H
+#define LSM_ITERATOR_H
+
+#include <functional>
+
+#include "common.h"
+#include "range_tombstone.h"
+#include "skip_list.h"
+#include "sstable.h"
+
+/**
+ * Cursor over key-value pairs in ascending order of key, which moves both
+ * ways. It is not valid until positioned by one of the seeks.
+ */
+class Iterator {
+ public:
+  virtual ~Iterator() = default;
+
+  virtual bool Valid() const = 0;
+
+  virtual void SeekToFirst() = 0;
+
+  virtual void SeekToLast() = 0;
+
+  /// Position at the first key at least `target`.
+  virtual void Seek(uint64_t target) = 0;
+
+  /// Position at the last key at most `target`.
+  virtual void SeekForPrev(uint64_t target) = 0;
+
+  virtual void Next() = 0;
+
+  virtual void Prev() = 0;
+
+  virtual uint64_t Key() const = 0;
+
+  virtual std::string Value() const = 0;
+};
+
+/**
+ * Iterator over one sorted source of a store: the mem table, an SST, or a
+ * level of disjoint SSTs. It yields the newest version of every key as of a
+ * snapshot, with the value as it is stored, deletion marks included.
+ */
+class InternalIterator : public Iterator {
+ public:
+  /// Sequence number of the current entry.
+  virtual SequenceNumber Sequence() const = 0;
+};
+
+/**
+ * Iterator over a copy of the mem table.
+ */
+class VectorIterator : public InternalIterator {
+ public:
+  explicit VectorIterator(std::vector<MemTableEntry> entries);
+
+  bool Valid() const override { return idx_ < entries_.size(); }
+
+  void SeekToFirst() override { idx_ = 0; }
+
+  void SeekToLast() override;
+
+  void Seek(uint64_t target) override;
+
+  void SeekForPrev(uint64_t target) override;
+
+  void Next() override { ++idx_; }
+
+  void Prev() override;
+
+  uint64_t Key() const override { return entries_[idx_].key; }
+
+  std::string Value() const override { return entries_[idx_].value; }
+
+  SequenceNumber Sequence() const override { return entries_[idx_].seq; }
+
+ private:
+  const std::vector<MemTableEntry> entries_;
+
+  // `entries_.size()` when not valid.
+  size_t idx_;
+};
+
+/**
+ * Iterator over the entries of an SST. Keys come from the index in memory;
+ * values are read on demand, a block of neighbouring values at a time, handed
+ * to the I/O backend as one batch. The block grows from `kInitialReadahead` up
+ * to `kMaxReadahead` bytes while the reads go on sequentially, in either
+ * direction. The cursor rests on the newest version of a key as of the
+ * snapshot; the other versions are skipped.
+ */
+class SSTableIterator : public InternalIterator {
+ public:
+  SSTableIterator(SSTableSPtr sst_ptr, SequenceNumber snapshot,
+                  IOBackend *io_backend);
+
+  ~SSTableIterator() override;
+
+  bool Valid() const override { return idx_ < sst_ptr_->num_keys_; }
+
+  void SeekToFirst() override;
+
+  void SeekToLast() override;
+
+  void Seek(uint64_t target) override;
+
+  void SeekForPrev(uint64_t target) override;
+
+  void Next() override;
+
+  void Prev() override;
+
+  uint64_t Key() const override { return sst_ptr_->keys_[idx_]; }
+
+  std::string Value() const override;
+
+  SequenceNumber Sequence() const override { return sst_ptr_->seqs_[idx_]; }
+
+ private:
+  static const size_t kInitialReadahead = 8 << 10;
+
+  static const size_t kMaxReadahead = 256 << 10;
+
+  void FindVisibleForward();
+
+  void FindVisibleBackward();
+
+  size_t ValueEnd(size_t idx) const;
+
+  void ReadAhead() const;
+
+  const SSTableSPtr sst_ptr_;
+
+  const SequenceNumber kSnapshot;
+
+  IOBackend *const io_backend_;
+
+  // `num_keys_` of the SST when not valid.
+  size_t idx_;
+
+  // Direction of the last move.
+  bool forward_;
+
+  // The SST file, -1 until the first read.
+  mutable int fd_;
+
+  // Values of the entries in [block_begin_, block_end_), back to back.
+  mutable std::string block_;
+
+  mutable size_t block_begin_;
+
+  mutable size_t block_end_;
+
+  mutable size_t readahead_;
+};
+
+/**
+ * Iterator over a level of SSTs with disjoint key ranges, sorted by key. Only
+ * the SST under the cursor is open.
+ */
+class LevelIterator : public InternalIterator {
+ public:
+  LevelIterator(Level level, SequenceNumber snapshot, IOBackend *io_backend);
+
+  bool Valid() const override { return sst_it_ && sst_it_->Valid(); }
+
+  void SeekToFirst() override;
+
+  void SeekToLast() override;
+
+  void Seek(uint64_t target) override;
+
+  void SeekForPrev(uint64_t target) override;
+
+  void Next() override;
+
+  void Prev() override;
+
+  uint64_t Key() const override { return sst_it_->Key(); }
+
+  std::string Value() const override { return sst_it_->Value(); }
+
+  SequenceNumber Sequence() const override { return sst_it_->Sequence(); }
+
+ private:
+  void OpenSST(size_t idx);
+
+  void SkipEmptySSTsForward();
+
+  void SkipEmptySSTsBackward();
+
+  const Level level_;
+
+  const SequenceNumber kSnapshot;
+
+  IOBackend *const io_backend_;
+
+  size_t sst_idx_;
+
+  std::unique_ptr<SSTableIterator> sst_it_;
+};
+
+/**
+ * Iterator merging the sources of a store into its live key-value pairs within
+ * [first, last] as of a snapshot. Where sources share a key, the version of
+ * the greatest sequence number wins. Entries deleted by a range tombstone or
+ * not live are skipped, and values go through `user_value`, along with their
+ * keys and sequence numbers, on their way out.
+ */
+class MergingIterator : public Iterator {
+ public:
+  MergingIterator(
+      std::vector<std::unique_ptr<InternalIterator>> children,
+      RangeTombstoneListSPtr range_tombstones, SequenceNumber snapshot,
+      uint64_t first, uint64_t last,
+      std::function<bool(const std::string &)> is_live,
+      std::function<std::string(uint64_t, SequenceNumber, const std::string &)>
+          user_value);
+
+  bool Valid() const override { return current_ != nullptr; }
+
+  void SeekToFirst() override { Seek(kFirst); }
+
+  void SeekToLast() override { SeekForPrev(kLast); }
+
+  void Seek(uint64_t target) override;
+
+  void SeekForPrev(uint64_t target) override;
+
+  void Next() override;
+
+  void Prev() override;
+
+  uint64_t Key() const override { return current_->Key(); }
+
+  std::string Value() const override {
+    return kUserValue(current_->Key(), current_->Sequence(),
+                      current_->Value());
+  }
+
+ private:
+  bool IsVisible(const InternalIterator &child) const;
+
+  void FindForward();
+
+  void FindBackward();
+
+  const std::vector<std::unique_ptr<InternalIterator>> children_;
+
+  const RangeTombstoneListSPtr range_tombstones_;
+
+  const SequenceNumber kSnapshot;
+
+  const uint64_t kFirst;
+
+  const uint64_t kLast;
+
+  const std::function<bool(const std::string &)> kIsLive;
+
+  const std::function<std::string(uint64_t, SequenceNumber,
+                                  const std::string &)>
+      kUserValue;
+
+  // The child holding the current entry, `nullptr` when not valid.
+  InternalIterator *current_;
+
+  // Direction of the last move. Children are all past the current key that
+  // way, or on it.
+  bool forward_;
+};
+
+#endif  // LSM_ITERATOR_H
@@ -2,13 +2,65 @@
 
 #include <MacTypes.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 #include "exception.h"
+#include "iterator.h"
+#include "options.h"
+#include "range_tombstone.h"
+#include "row_cache.h"
 #include "skip_list.h"
+#include "snapshot.h"
 #include "sstable.h"
+#include "version.h"
+#include "write_controller.h"
+
+/**
+ * Bytes moved by flushes and compactions since the store was opened, and time
+ * writers spent stalled.
+ */
+struct CompactionStats {
+  CompactionPickPolicy pick_policy;
+
+  std::atomic<size_t> num_compactions{0};
+
+  // SSTs compacted for their deletion marks rather than for room.
+  std::atomic<size_t> num_tombstone_compactions{0};
+
+  std::atomic<size_t> bytes_flushed{0};
+
+  // Bytes of external SSTs moved into the store.
+  std::atomic<size_t> bytes_ingested{0};
+
+  std::atomic<size_t> bytes_compaction_read{0};
+
+  std::atomic<size_t> bytes_compaction_written{0};
+
+  std::atomic<size_t> num_write_stalls{0};
+
+  std::atomic<size_t> write_stall_micros{0};
+
+  /// Bytes written to disk per byte flushed from the mem table or ingested.
+  double WriteAmplification() const {
+    size_t bytes_in = bytes_flushed + bytes_ingested;
+    return bytes_in ? (double)(bytes_in + bytes_compaction_written) /
+                          (double)bytes_in
+                    : 0;
+  }
+};
 
 class KVStore : public KVStoreAPI {
+  friend class ShardedKVStore;
+
+  friend class SstFileWriter;
+
+  friend class MicroBench;
+
  public:
-  explicit KVStore(const std::string &dir);
+  explicit KVStore(const std::string &dir, const Options &options = Options());
 
   ~KVStore();
 
@@ -16,13 +68,104 @@ class KVStore : public KVStoreAPI {
 
   std::string Get(uint64_t key) override;
 
+  /// Read as of a snapshot, or as of now if it is `nullptr`.
+  std::string Get(uint64_t key, const Snapshot *snapshot);
+
+  std::vector<std::string> MultiGet(const std::vector<uint64_t> &keys,
+                                    const Snapshot *snapshot = nullptr);
+
   bool Del(uint64_t key) override;
 
+  void DeleteRange(uint64_t begin, uint64_t end);
+
+  /// Apply an operand to the value of a key with the merge operator of the
+  /// options, without reading the value.
+  void Merge(uint64_t key, const std::string &operand);
+
+  /// Move SSTs built by `SstFileWriter` into the store, as the newest writes.
+  /// The files must not overlap each other.
+  void IngestExternalFile(const std::vector<std::string> &file_paths);
+
+  /// Iterator over the live key-value pairs of the store as of a snapshot, or
+  /// as of now. It must not outlive the store, nor be used across `Reset`.
+  std::unique_ptr<Iterator> NewIterator(const Snapshot *snapshot = nullptr);
+
+  std::vector<std::pair<uint64_t, std::string>> Scan(
+      uint64_t begin, uint64_t end, const Snapshot *snapshot = nullptr);
+
+  /// Pin the current state of the store for reads. Compaction keeps the
+  /// versions it needs until it is passed to `ReleaseSnapshot`.
+  const Snapshot *GetSnapshot();
+
+  void ReleaseSnapshot(const Snapshot *snapshot);
+
   void Reset() override;
 
+  const CompactionStats &Stats() const { return stats_; }
+
+  size_t EstimatedPendingCompactionBytes() const {
+    return pending_compaction_bytes_;
+  }
+
+  const std::shared_ptr<Statistics> &GetStatistics() const {
+    return statistics_;
+  }
+
+  /// `nullptr` unless the options give one.
+  const std::shared_ptr<EventLog> &GetEventLog() const { return event_log_; }
+
+  /// Describe the state of the store. Known properties are `lsm.stats`,
+  /// `lsm.num-files-at-level<N>`, `lsm.total-sst-files-size`,
+  /// `lsm.estimate-table-readers-mem`, `lsm.cur-size-active-mem-table`,
+  /// `lsm.write-amplification`, `lsm.estimate-pending-compaction-bytes` and
+  /// `lsm.num-snapshots`.
+  bool GetProperty(const std::string &property, std::string *value);
+
   __attribute__((unused)) void PrintSSTables() const;
 
  private:
+  /**
+   * What a merge needs to know to decide which versions to keep.
+   */
+  struct MergeContext {
+    // The level merged to.
+    size_t level;
+
+    bool remove_deletion_mark;
+
+    RangeTombstoneListSPtr range_tombstones;
+
+    // Live snapshots in ascending order, as of the start of the compaction.
+    std::vector<SequenceNumber> snapshots;
+
+    // Key and snapshot stripe of the last version seen, if any.
+    bool has_key;
+
+    uint64_t key;
+
+    size_t stripe;
+
+    // The merge entry kept for the last key and stripe, into which the older
+    // versions of the stripe fold, if any. A copy of the stored value.
+    StringSPtr merge_value;
+  };
+
+  /**
+   * A read of a merge entry, resolved through the older versions of its key.
+   */
+  struct PendingMerge {
+    uint64_t key;
+
+    // The merge entries found, newest first.
+    std::vector<std::string> entries;
+
+    // Sequence number of the oldest of them.
+    SequenceNumber seq;
+
+    // The stored value the entries resolve to, `nullptr` until resolved.
+    StringSPtr value;
+  };
+
   static Timestamp MaxTimestampInCompaction(
       const std::set<SSTableSPtr> &cur_level_discard_sst,
       const std::set<SSTableSPtr> &next_level_discard_sst);
@@ -31,28 +174,150 @@ class KVStore : public KVStoreAPI {
 
   static long LowerBound(const LevelSPtr &level_ptr, uint64_t target);
 
-  void Compaction();
+  static bool Overlaps(const Level &level,
+                       const std::vector<SSTableSPtr> &ssts);
+
+  static std::string AppendWriteTime(const std::string &s);
+
+  static std::vector<std::string> FilePaths(const Level &ssts);
+
+  static size_t NumKeys(const Level &ssts);
+
+  static bool IsMergeEntry(const std::string &stored);
+
+  static std::string EncodeMergeEntry(const std::vector<std::string> &operands);
+
+  std::vector<std::pair<uint64_t, std::string>> ExportRange(uint64_t first,
+                                                            uint64_t last);
+
+  void ImportRange(
+      const std::vector<std::pair<uint64_t, std::string>> &entries);
+
+  std::unique_ptr<Iterator> NewIterator(uint64_t first, uint64_t last,
+                                        SequenceNumber snapshot,
+                                        bool stored_values = false);
+
+  bool LookupMemTable(uint64_t key, SequenceNumber snapshot, StringSPtr *value,
+                      SequenceNumber *seq = nullptr) const;
+
+  StringSPtr LookupSST(const SSTable &sst, size_t level, uint64_t key,
+                       SequenceNumber snapshot, SequenceNumber *seq) const;
+
+  std::shared_ptr<std::string> Lookup(const Version &version, uint64_t key,
+                                      SequenceNumber snapshot,
+                                      SequenceNumber *seq = nullptr) const;
+
+  void MultiGetFromSST(const Version &version, const SSTableSPtr &sst_ptr,
+                       const std::vector<uint64_t> &keys,
+                       SequenceNumber snapshot, std::vector<size_t> &pending,
+                       std::vector<std::string> &values) const;
+
+  bool IsLive(const std::string &stored) const;
+
+  std::string UserValue(const std::string &stored) const;
+
+  std::string KeepWriteTime(const std::string &s,
+                            const std::string &stored) const;
+
+  std::vector<std::string> MergeOperands(const std::string &stored) const;
+
+  std::string FullMerge(uint64_t key, const std::string *base,
+                        const std::vector<std::string> &operands) const;
+
+  std::string FoldMergeOperand(uint64_t key, const std::string &operand,
+                               bool *folded) const;
+
+  void AddToMerge(PendingMerge &merge, const StringSPtr &value,
+                  SequenceNumber seq) const;
+
+  void ResolveMergeInMemTable(PendingMerge &merge) const;
+
+  void ResolveMerge(const Version &version, PendingMerge &merge) const;
 
-  void Compaction(size_t level, bool remove_deletion_mark);
+  StringSPtr ResolveMerge(const Version &version, uint64_t key,
+                          SequenceNumber seq, const StringSPtr &value) const;
 
-  void CompactionLevel0();
+  bool FilterValue(size_t level, uint64_t key, StringSPtr &value) const;
+
+  MergeContext NewMergeContext(size_t level, bool remove_deletion_mark) const;
+
+  bool KeepVersion(MergeContext &ctx, uint64_t key, SequenceNumber seq,
+                   StringSPtr &value) const;
+
+  void FoldIntoMergeValue(MergeContext &ctx, uint64_t key,
+                          const std::string &older, bool covered) const;
+
+  void Write(uint64_t key, const std::string &s);
+
+  void Flush();
+
+  VersionSPtr CurrentVersion() const;
+
+  void InstallVersion();
+
+  void DelayWrite(std::unique_lock<std::mutex> &lock, size_t bytes);
+
+  void DumpStats();
+
+  void UpdateWriteStall();
+
+  size_t ComputePendingCompactionBytes() const;
+
+  bool IsTiered(size_t level) const;
+
+  bool IsOverflowing(size_t level) const;
+
+  bool IsTombstoneDense(const SSTableSPtr &sst_ptr) const;
+
+  bool HasTombstoneDenseSST(size_t level) const;
+
+  bool NeedsCompaction() const;
+
+  void DropObsoleteRangeTombstones();
+
+  void AddLevel();
+
+  size_t LevelForIngestion(const std::vector<SSTableSPtr> &ssts);
+
+  void MaybeScheduleCompaction();
+
+  void BackgroundCompaction();
+
+  void Compaction(std::unique_lock<std::mutex> &lock);
+
+  void Compaction(size_t level, bool remove_deletion_mark,
+                  std::unique_lock<std::mutex> &lock);
+
+  void CompactionTiered(size_t level, bool remove_deletion_mark,
+                        std::unique_lock<std::mutex> &lock);
+
+  void MoveToNextLevel(size_t level, std::unique_lock<std::mutex> &lock);
+
+  void EndCompactionSpan(EventSpan &span, const Level &inputs,
+                         const Level &outputs, size_t bytes_read,
+                         size_t bytes_written) const;
+
+  void MarkObsolete(const SSTableSPtr &sst_ptr) const;
+
+  SSTableSPtr CopyToLevel(const SSTableSPtr &sst_ptr, size_t level);
 
   std::vector<SSTableSPtr> MergeSSTLevel0(
-      size_t level, size_t max_timestamp,
+      size_t max_timestamp,
       std::priority_queue<std::pair<SSTableSPtr, size_t>> &pq,
       std::unordered_map<SSTableSPtr, std::shared_ptr<std::vector<StringSPtr>>>
-          &all_values);
+          &all_values,
+      MergeContext &ctx);
 
   std::vector<SSTableSPtr> MergeSST(
-      size_t choose_sst, size_t max_timestamp, const SSTableSPtr &sst,
+      size_t max_timestamp, const SSTableSPtr &sst,
       std::vector<SSTableSPtr> &overlap,
       std::unordered_map<SSTableSPtr, std::shared_ptr<std::vector<StringSPtr>>>
           &all_values,
-      bool remove_deletion_mark);
+      MergeContext &ctx);
 
-  static void Save(SSTableSPtr &sst_ptr, size_t file_size, size_t num_key,
-                   uint64_t min_key, uint64_t max_key,
-                   std::vector<std::shared_ptr<std::string>> &values);
+  void Save(SSTableSPtr &sst_ptr, size_t num_key, uint64_t min_key,
+            uint64_t max_key,
+            std::vector<std::shared_ptr<std::string>> &values);
 
   void ReconstructLevel(
       size_t level,
@@ -65,13 +330,101 @@ class KVStore : public KVStoreAPI {
   std::shared_ptr<std::set<SSTableSPtr>> SSTForCompaction(
       size_t level, size_t num_overlapping_sst);
 
+  double PickScore(size_t level, const SSTableSPtr &sst_ptr) const;
+
+  std::shared_ptr<std::set<SSTableSPtr>> SSTForCompactionRoundRobin(
+      size_t level, size_t num_overlapping_sst);
+
   const std::string kDir;
 
+  const std::shared_ptr<CompactionStrategy> strategy_;
+
+  const CompactionPickPolicy pick_policy_;
+
+  const double kTombstoneCompactionRatio;
+
+  const std::shared_ptr<RateLimiter> rate_limiter_;
+
+  const std::shared_ptr<IOBackend> io_backend_;
+
+  const std::shared_ptr<CompactionFilter> compaction_filter_;
+
+  const std::shared_ptr<MergeOperator> merge_operator_;
+
+  // Time to live of values in seconds, 0 if they never expire.
+  const uint64_t kTtl;
+
+  // `nullptr` if disabled.
+  const std::shared_ptr<RowCache> row_cache_;
+
+  const std::shared_ptr<Statistics> statistics_;
+
+  // Seconds between dumps of the statistics, 0 if they are not dumped.
+  const uint64_t kStatsDumpPeriodSec;
+
+  // `nullptr` if nothing is logged.
+  const std::shared_ptr<EventLog> event_log_;
+
+  // Max key of the last SST picked in each level, for round-robin picking.
+  std::vector<uint64_t> compact_cursor_;
+
+  CompactionStats stats_;
+
+  // What readers search past the mem table. Only accessed through
+  // `CurrentVersion` and `InstallVersion`.
+  VersionSPtr current_;
+
+  // Guards everything below. Levels are only rebuilt by the background
+  // compaction, which releases the lock around the file I/O of a compaction and
+  // takes it again to install the result; writers only add SSTs to level-0.
+  // Levels are never changed in place, but replaced as a whole, since installed
+  // versions share them.
+  mutable std::mutex mutex_;
+
   SkipList mem_table_;
 
   Timestamp timestamp_;
 
-  uint64_t sst_no_;
+  // Sequence number of the last write.
+  SequenceNumber last_sequence_;
+
+  // Sequence number of the last write flushed from the mem table.
+  SequenceNumber flushed_sequence_;
+
+  // Sequence numbers of the live snapshots.
+  std::multiset<SequenceNumber> snapshots_;
+
+  std::atomic<uint64_t> sst_no_;
 
   std::vector<LevelSPtr> ssts_;
+
+  // Replaced as a whole on change, so compactions can merge against a
+  // snapshot of it without the lock.
+  RangeTombstoneListSPtr range_tombstones_;
+
+  WriteController write_controller_;
+
+  std::atomic<size_t> pending_compaction_bytes_;
+
+  std::shared_ptr<ThreadPool> thread_pool_;
+
+  // Signals a finished install, or the background compaction going idle.
+  std::condition_variable bg_done_cv_;
+
+  // Set from the time a background compaction is scheduled until it is done.
+  // At most one runs at a time.
+  bool bg_scheduled_;
+
+  // Ingestions waiting for the background compaction to be done, which holds
+  // off scheduling another.
+  size_t num_ingestions_waiting_;
+
+  // Set once the store is closing, which stops the dumps of the statistics.
+  bool shutting_down_;
+
+  // Signals `shutting_down_`.
+  std::condition_variable stats_dump_cv_;
+
+  // Dumps the statistics, if they are dumped.
+  std::thread stats_dump_thread_;
 };
@@ -0,0 +1,33 @@
+#ifndef LSM_MERGE_OPERATOR_H
+#define LSM_MERGE_OPERATOR_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * User hook combining the operands of `KVStore::Merge` with the value of a
+ * key, such as adding increments to a counter.
+ *
+ * Operands are stored as they come, and only combined when a read or a merge
+ * of SSTs meets the version they apply to, so a merge needs no read. The
+ * operator must be deterministic, since the same operands may be combined
+ * more than once.
+ *
+ * Operators are called from readers and from the background compaction
+ * thread, and must not touch the store.
+ */
+class MergeOperator {
+ public:
+  virtual ~MergeOperator() = default;
+
+  virtual std::string Name() const = 0;
+
+  /// Apply `operands`, oldest first, to `existing_value`, the value of `key`
+  /// before them, or `nullptr` if the key was absent or deleted.
+  virtual std::string FullMerge(
+      uint64_t key, const std::string *existing_value,
+      const std::vector<std::string> &operands) const = 0;
+};
+
+#endif  // LSM_MERGE_OPERATOR_H
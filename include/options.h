@@ -0,0 +1,108 @@
+#ifndef LSM_OPTIONS_H
+#define LSM_OPTIONS_H
+
+#include <memory>
+
+#include "compaction_filter.h"
+#include "compaction_strategy.h"
+#include "event_log.h"
+#include "io_backend.h"
+#include "merge_operator.h"
+#include "rate_limiter.h"
+#include "row_cache.h"
+#include "statistics.h"
+#include "thread_pool.h"
+
+/**
+ * How a leveled level picks the SSTs to push into the next level when it
+ * overflows.
+ */
+enum class CompactionPickPolicy {
+  // Least timestamp first, ties broken by min key.
+  kOldestFirst,
+  // Least bytes overlapping in the next level per byte of the SST.
+  kMinOverlappingRatio,
+  // Most deletion marks first.
+  kMostTombstones,
+  // Cycle through the key space, starting after the last SST picked.
+  kRoundRobin,
+};
+
+/**
+ * Per-store tuning knobs, passed to the constructor of `KVStore`.
+ */
+struct Options {
+  // Compaction policy, see `CompactionStrategy`.
+  std::shared_ptr<CompactionStrategy> compaction_strategy =
+      std::make_shared<LeveledCompaction>();
+
+  // SST picking heuristic of leveled levels.
+  CompactionPickPolicy compaction_pick_policy =
+      CompactionPickPolicy::kOldestFirst;
+
+  // Run on the values rewritten by compaction. None if `nullptr`.
+  std::shared_ptr<CompactionFilter> compaction_filter;
+
+  // Combines the operands of `KVStore::Merge`, which is disabled if `nullptr`.
+  // Like `ttl`, it must stay set for a data directory once merges were
+  // written.
+  std::shared_ptr<MergeOperator> merge_operator;
+
+  // Time to live of values in seconds, 0 if they never expire. Expired values
+  // read as deleted, and compaction drops them. Values carry their write time
+  // when it is set, so it must stay on or off for a data directory.
+  uint64_t ttl = 0;
+
+  // An SST of a leveled level above the bottom one is compacted once this
+  // ratio of its entries are deletion marks, even if the level has room, so
+  // that the marks reach the bottom level and get dropped sooner. 0 disables
+  // it.
+  double tombstone_compaction_ratio = 0.5;
+
+  // Budget of flush and compaction I/O, which may be shared by several stores.
+  // No limit if `nullptr`.
+  std::shared_ptr<RateLimiter> rate_limiter;
+
+  // Serves the reads of SST values and the writes of compaction output, and
+  // may be shared by several stores. `IOBackend::NewDefault()` if `nullptr`.
+  std::shared_ptr<IOBackend> io_backend;
+
+  // Runs the background compactions, and may be shared by several stores. A
+  // store runs them on a thread of its own if `nullptr`.
+  std::shared_ptr<ThreadPool> thread_pool;
+
+  // Counters of reads, writes and compactions, which may be shared by several
+  // stores. A store counts into one of its own if `nullptr`.
+  std::shared_ptr<Statistics> statistics;
+
+  // Every this many seconds, the store appends its `lsm.stats` property to the
+  // `LOG` file of its directory. 0 disables it.
+  uint64_t stats_dump_period_sec = 0;
+
+  // Timeline of flushes, compactions, deletions of SST files and write stalls,
+  // which may be shared by several stores. Nothing is logged if `nullptr`.
+  std::shared_ptr<EventLog> event_log;
+
+  // Bytes of keys and values found in SSTs that `Get` keeps in a row cache,
+  // for hot keys to skip the walk down the levels. 0 disables the cache.
+  size_t row_cache_capacity = 0;
+
+  // Row cache to use rather than one of `row_cache_capacity` bytes. It may be
+  // shared by several stores as long as no key is in two of them, like the
+  // shards of a `ShardedKVStore`.
+  std::shared_ptr<RowCache> row_cache;
+
+  // Write stall thresholds, see `WriteController`.
+  size_t level0_slowdown_writes_trigger = 8;
+
+  size_t level0_stop_writes_trigger = 12;
+
+  size_t soft_pending_compaction_bytes_limit = 64 << 20;
+
+  size_t hard_pending_compaction_bytes_limit = 256 << 20;
+
+  // Write rate in bytes/sec once writes start to slow down.
+  size_t delayed_write_rate = 16 << 20;
+};
+
+#endif  // LSM_OPTIONS_H
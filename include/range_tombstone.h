@@ -0,0 +1,65 @@
+#ifndef LSM_RANGE_TOMBSTONE_H
+#define LSM_RANGE_TOMBSTONE_H
+
+#include "common.h"
+
+/**
+ * Deletion of all keys in [begin, end) written before the tombstone, i.e. with
+ * a sequence number less than its own.
+ */
+struct RangeTombstone {
+  uint64_t begin;
+
+  uint64_t end;
+
+  SequenceNumber seq;
+
+  /// Tell whether the tombstone deletes an entry of sequence number `entry_seq`
+  /// for readers as of `snapshot`.
+  bool Covers(uint64_t key, SequenceNumber entry_seq,
+              SequenceNumber snapshot) const {
+    return begin <= key && key < end && entry_seq < seq && seq <= snapshot;
+  }
+};
+
+/**
+ * The range tombstones of a store, persisted in a file of their own. A
+ * tombstone is kept until no entry older than it may lie in its range.
+ */
+class RangeTombstoneList {
+ public:
+  static RangeTombstoneList *FromFile(const std::string &file_path);
+
+  void ToFile(const std::string &file_path) const;
+
+  void Add(uint64_t begin, uint64_t end, SequenceNumber seq);
+
+  /// Tell whether an entry is deleted for readers as of `snapshot`.
+  bool Covers(uint64_t key, SequenceNumber entry_seq,
+              SequenceNumber snapshot = kMaxSequenceNumber) const;
+
+  bool IsEmpty() const { return tombstones_.empty(); }
+
+  SequenceNumber MaxSequence() const;
+
+  const std::vector<RangeTombstone> &Tombstones() const { return tombstones_; }
+
+  /// Keep only the tombstones for which `keep` holds.
+  template <typename Predicate>
+  bool Filter(Predicate keep) {
+    size_t size = tombstones_.size();
+    tombstones_.erase(std::remove_if(tombstones_.begin(), tombstones_.end(),
+                                     [&keep](const RangeTombstone &t) {
+                                       return !keep(t);
+                                     }),
+                      tombstones_.end());
+    return tombstones_.size() != size;
+  }
+
+ private:
+  std::vector<RangeTombstone> tombstones_;
+};
+
+typedef std::shared_ptr<const RangeTombstoneList> RangeTombstoneListSPtr;
+
+#endif  // LSM_RANGE_TOMBSTONE_H
@@ -0,0 +1,95 @@
+#ifndef LSM_RATE_LIMITER_H
+#define LSM_RATE_LIMITER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * Priority of background file I/O. A pending request of higher priority is
+ * always granted before one of lower priority.
+ */
+enum class IOPriority { kFlush = 0, kCompaction = 1 };
+
+/**
+ * Token bucket shared by all background file I/O of one or more stores.
+ *
+ * Every refill period, `bytes_per_sec * refill_period` tokens are put in the
+ * bucket, and unused tokens do not pile up beyond one period. Requests larger
+ * than one refill are served in several rounds.
+ *
+ * When auto-tuned, the budget follows the pending compaction debt reported by
+ * the stores: it is an eighth of `bytes_per_sec` with no debt, and grows to the
+ * full `bytes_per_sec` as the debt approaches `debt_for_full_speed`.
+ */
+class RateLimiter {
+ public:
+  explicit RateLimiter(size_t bytes_per_sec, bool auto_tuned = false,
+                       size_t debt_for_full_speed = 64 << 20,
+                       std::chrono::microseconds refill_period =
+                           std::chrono::microseconds(100 * 1000));
+
+  RateLimiter(const RateLimiter &) = delete;
+
+  RateLimiter &operator=(const RateLimiter &) = delete;
+
+  /// Block until `bytes` tokens are granted to the caller.
+  void Request(size_t bytes, IOPriority priority);
+
+  void SetBytesPerSecond(size_t bytes_per_sec);
+
+  /// Budget in effect, after auto-tuning.
+  size_t BytesPerSecond() const;
+
+  /// Record the pending compaction bytes of `source`, usually a store.
+  void ReportPendingCompactionBytes(const void *source, size_t bytes);
+
+  size_t TotalBytesThrough(IOPriority priority) const;
+
+ private:
+  struct PendingRequest {
+    size_t bytes;
+    bool granted;
+  };
+
+  typedef std::chrono::steady_clock Clock;
+
+  static const size_t kNumPriorities = 2;
+
+  size_t RefillBytes() const;
+
+  void Refill(Clock::time_point now);
+
+  void GrantRequests();
+
+  void Tune();
+
+  mutable std::mutex mutex_;
+
+  std::condition_variable cv_;
+
+  size_t max_bytes_per_sec_;
+
+  size_t bytes_per_sec_;
+
+  const bool kAutoTuned;
+
+  const size_t kDebtForFullSpeed;
+
+  const std::chrono::microseconds kRefillPeriod;
+
+  size_t available_bytes_;
+
+  Clock::time_point next_refill_;
+
+  std::deque<PendingRequest *> queues_[kNumPriorities];
+
+  size_t total_bytes_through_[kNumPriorities];
+
+  std::unordered_map<const void *, size_t> pending_compaction_bytes_;
+};
+
+#endif  // LSM_RATE_LIMITER_H
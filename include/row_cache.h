@@ -0,0 +1,62 @@
+#ifndef LSM_ROW_CACHE_H
+#define LSM_ROW_CACHE_H
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#include "common.h"
+
+/**
+ * Cache of the newest values of keys found in SSTs, in front of the walk down
+ * the levels. Values are kept as they are stored, deletion marks included.
+ * Entries are evicted least recently used first once their keys and values
+ * take more than `capacity` bytes. It is safe for concurrent use.
+ */
+class RowCache {
+ public:
+  explicit RowCache(size_t capacity);
+
+  /// The cached value of `key`, or `nullptr` on a miss.
+  StringSPtr Lookup(uint64_t key);
+
+  void Insert(uint64_t key, StringSPtr value);
+
+  void Erase(uint64_t key);
+
+  /// Erase the keys in [begin, end).
+  void EraseRange(uint64_t begin, uint64_t end);
+
+  void Clear();
+
+  size_t NumHits() const { return num_hits_; }
+
+  size_t NumMisses() const { return num_misses_; }
+
+ private:
+  typedef std::list<std::pair<uint64_t, StringSPtr>> LruList;
+
+  static size_t Charge(const StringSPtr &value) {
+    return sizeof(uint64_t) + value->size();
+  }
+
+  void EraseEntry(LruList::iterator entry);
+
+  const size_t kCapacity;
+
+  std::mutex mutex_;
+
+  // Most recently used first.
+  LruList lru_;
+
+  std::unordered_map<uint64_t, LruList::iterator> index_;
+
+  size_t usage_;
+
+  std::atomic<size_t> num_hits_;
+
+  std::atomic<size_t> num_misses_;
+};
+
+#endif  // LSM_ROW_CACHE_H
@@ -0,0 +1,116 @@
+#ifndef LSM_SHARDED_KVSTORE_H
+#define LSM_SHARDED_KVSTORE_H
+
+#include <array>
+#include <atomic>
+#include <map>
+#include <shared_mutex>
+
+#include "kvstore.h"
+
+/**
+ * Tuning knobs of a `ShardedKVStore`, on top of the `Options` of its shards.
+ */
+struct ShardingOptions {
+  // Number of shards a new store starts with, splitting the key space evenly.
+  size_t num_shards = 4;
+
+  // Hot shards are not split past this number of shards.
+  size_t max_shards = 64;
+
+  // A shard is hot when it takes more than this many times its fair share of
+  // the writes between two checks.
+  double hot_shard_ratio = 2;
+
+  // Number of writes between two checks for hot shards.
+  size_t split_check_interval = 1 << 16;
+};
+
+/**
+ * Store partitioning the key space into ranges, each served by a `KVStore` of
+ * its own under `dir/shard-<id>`. Shards share the thread pool and the rate
+ * limiter of the options, so their compactions run side by side, and one row
+ * cache of `row_cache_capacity` bytes.
+ *
+ * A hot shard is split at the median of its recently written keys: the upper
+ * half of its keys moves to a new shard, and is then deleted from it with a
+ * range tombstone. Operations wait while a split moves the keys.
+ */
+class ShardedKVStore : public KVStoreAPI {
+ public:
+  explicit ShardedKVStore(
+      const std::string &dir,
+      const ShardingOptions &sharding_options = ShardingOptions(),
+      const Options &options = Options());
+
+  void Put(uint64_t key, const std::string &s) override;
+
+  std::string Get(uint64_t key) override;
+
+  std::vector<std::string> MultiGet(const std::vector<uint64_t> &keys);
+
+  bool Del(uint64_t key) override;
+
+  void DeleteRange(uint64_t begin, uint64_t end);
+
+  void Merge(uint64_t key, const std::string &operand);
+
+  std::vector<std::pair<uint64_t, std::string>> Scan(uint64_t begin,
+                                                     uint64_t end);
+
+  void Reset() override;
+
+  size_t NumShards() const;
+
+ private:
+  static const size_t kNumKeySamples = 64;
+
+  struct Shard {
+    uint64_t id;
+
+    std::unique_ptr<KVStore> store;
+
+    // Writes since the last check for hot shards.
+    std::atomic<size_t> num_writes{0};
+
+    // Recently written keys, to find where to split.
+    std::array<std::atomic<uint64_t>, kNumKeySamples> key_samples;
+
+    std::atomic<size_t> num_key_samples{0};
+  };
+
+  typedef std::shared_ptr<Shard> ShardSPtr;
+
+  typedef std::map<uint64_t, ShardSPtr>::iterator ShardIterator;
+
+  Shard &ShardFor(uint64_t key);
+
+  bool RecordWrite(Shard &shard, uint64_t key);
+
+  void MaybeSplit();
+
+  void Split(ShardIterator shard_it, uint64_t split_key);
+
+  ShardSPtr OpenShard(uint64_t id) const;
+
+  void WriteManifest() const;
+
+  const std::string kDir;
+
+  const ShardingOptions kShardingOptions;
+
+  Options options_;
+
+  // Shared by operations, exclusive to splits.
+  mutable std::shared_timed_mutex mutex_;
+
+  // Shards by the first key of their range, which ends where the next one
+  // starts.
+  std::map<uint64_t, ShardSPtr> shards_;
+
+  uint64_t next_shard_id_;
+
+  std::atomic<size_t> num_writes_;
+};
+
+#endif  // LSM_SHARDED_KVSTORE_H
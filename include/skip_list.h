@@ -11,6 +11,17 @@
 #include "sstable.h"
 #include "utils.h"
 
+/**
+ * A version of a key in the mem table.
+ */
+struct MemTableEntry {
+  uint64_t key;
+
+  SequenceNumber seq;
+
+  std::string value;
+};
+
 class SkipList {
   typedef uint64_t Key;
   typedef std::string Value;
@@ -22,44 +33,76 @@ class SkipList {
 
   __attribute__((unused)) size_t Size() const;
 
-  __attribute__((unused)) size_t FileSize() const;
+  size_t FileSize() const;
 
   Value *Get(const Key &key) const;
 
-  void Put(Key key, const Value &value);
+  const Value *Get(const Key &key, SequenceNumber snapshot,
+                   SequenceNumber *seq) const;
+
+  /// Find `n` keys at once, setting `values[i]` and `seqs[i]` for `keys[i]`.
+  void Get(const Key *keys, size_t n, SequenceNumber snapshot,
+           const Value **values, SequenceNumber *seqs) const;
+
+  void Put(Key key, const Value &value, SequenceNumber seq,
+           SequenceNumber newest_snapshot = 0);
 
   bool Del(Key key);
 
+  std::vector<MemTableEntry> Entries(Key first, Key last,
+                                     SequenceNumber snapshot) const;
+
+  bool HasKeyInRange(Key first, Key last) const;
+
   void Reset();
 
   SSTableSPtr ToFile(Timestamp timestamp, uint64_t sst_no,
-                     const std::string &dir) const;
+                     const std::string &dir,
+                     RateLimiter *rate_limiter = nullptr) const;
 
   bool IsEmpty() const { return size_ == 0; }
 
  private:
+  // Older versions of a key kept for snapshots, newest first. Shared by the
+  // nodes of a "tower".
+  typedef std::vector<std::pair<SequenceNumber, Value>> Versions;
+
+  typedef std::shared_ptr<const Versions> VersionsSPtr;
+
   class Node {
    public:
     Key key_;
     Value value_;
+    SequenceNumber seq_;
+    VersionsSPtr older_;
     std::shared_ptr<Node> left_, right_, down_;
 
    public:
-    Node(const Key key, Value value, std::shared_ptr<Node> left,
-         std::shared_ptr<Node> right, std::shared_ptr<Node> down)
+    Node(const Key key, Value value, SequenceNumber seq,
+         std::shared_ptr<Node> left, std::shared_ptr<Node> right,
+         std::shared_ptr<Node> down)
         : key_(key),
           value_(std::move(value)),
+          seq_(seq),
           left_(std::move(left)),
           right_(std::move(right)),
           down_(std::move(down)) {}
     Node()
-        : key_(0), value_(), left_(nullptr), right_(nullptr), down_(nullptr) {}
+        : key_(0),
+          value_(),
+          seq_(0),
+          left_(nullptr),
+          right_(nullptr),
+          down_(nullptr) {}
   };
 
   typedef std::shared_ptr<Node> NodeSPtr;
 
   static bool ShouldInsertUp();
 
+  static const Value *VersionAt(const Node &node, SequenceNumber snapshot,
+                                SequenceNumber *seq);
+
   static int ComputeFileSizeChange(const Value &new_value,
                                    const Value &old_value);
 
@@ -67,6 +110,12 @@ class SkipList {
 
   NodeSPtr NodeByKey(const Key &key) const;
 
+  NodeSPtr LastNodeBefore(const Key &key) const;
+
+  void Seek(Key key);
+
+  void Erase(NodeSPtr top_node);
+
   NodeSPtr BottomHead() const;
 
   Key MinKey() const;
@@ -77,6 +126,16 @@ class SkipList {
 
   NodeSPtr head_;
 
+  // The last node of every level, bottom level first, the head of the level if
+  // it has none.
+  std::vector<NodeSPtr> tails_;
+
+  // The last node before `finger_key_` in every level, bottom level first,
+  // where the search of the next write starts if its key is not less.
+  std::vector<NodeSPtr> finger_;
+
+  Key finger_key_;
+
   size_t size_;
 
   size_t file_size_;
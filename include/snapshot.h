@@ -0,0 +1,23 @@
+#ifndef LSM_SNAPSHOT_H
+#define LSM_SNAPSHOT_H
+
+#include "common.h"
+
+/**
+ * Point-in-time view of a store, taken by `KVStore::GetSnapshot`. Reads
+ * through it see the writes with a sequence number up to its own, and
+ * compaction keeps the versions they need until it is released.
+ */
+class Snapshot {
+  friend class KVStore;
+
+ public:
+  SequenceNumber Sequence() const { return kSequence; }
+
+ private:
+  explicit Snapshot(SequenceNumber sequence) : kSequence(sequence) {}
+
+  const SequenceNumber kSequence;
+};
+
+#endif  // LSM_SNAPSHOT_H
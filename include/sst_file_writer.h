@@ -0,0 +1,45 @@
+#ifndef LSM_SST_FILE_WRITER_H
+#define LSM_SST_FILE_WRITER_H
+
+#include "options.h"
+#include "sstable.h"
+
+/**
+ * Builds SSTs offline from key-value pairs in ascending order of key, to be
+ * handed to `KVStore::IngestExternalFile`. The pairs go to `<dir>/<n>.sst`,
+ * starting a new file whenever one would outgrow the size of an SST.
+ */
+class SstFileWriter {
+ public:
+  /// `options` must match those of the store the files go to.
+  explicit SstFileWriter(const std::string &dir,
+                         const Options &options = Options());
+
+  void Put(uint64_t key, const std::string &value);
+
+  /// Write out the last file, and return the paths of all the files written.
+  std::vector<std::string> Finish();
+
+ private:
+  void FinishFile();
+
+  const std::string kDir;
+
+  const uint64_t kTtl;
+
+  // Whether some pair was put, and the key of the last one.
+  bool has_key_;
+
+  uint64_t last_key_;
+
+  // `nullptr` if no pair was put since the last file was written.
+  SSTableSPtr sst_ptr_;
+
+  std::vector<StringSPtr> values_;
+
+  size_t file_size_;
+
+  std::vector<std::string> file_paths_;
+};
+
+#endif  // LSM_SST_FILE_WRITER_H
@@ -3,6 +3,9 @@
 
 #include "bloom_filter.h"
 #include "common.h"
+#include "event_log.h"
+#include "io_backend.h"
+#include "rate_limiter.h"
 
 class SSTable;
 
@@ -28,8 +31,14 @@ class SSTable {
 
   friend class SkipList;
 
+  friend class SSTableIterator;
+
   friend class KVStore;
 
+  friend class SstFileWriter;
+
+  friend class MicroBench;
+
  private:
   std::string file_path_;
 
@@ -43,36 +52,101 @@ class SSTable {
 
   uint64_t max_key_;
 
+  size_t num_deletions_;
+
   BloomFilter<uint64_t> bloom_filter_;
 
+  // Keys of the entries in ascending order. A key may have several versions,
+  // newest first, kept for snapshots.
   std::vector<uint64_t> keys_;
 
+  std::vector<SequenceNumber> seqs_;
+
+  // Offsets of the values in the file. Left empty when all values but the
+  // deletion marks have the same size, since their offsets follow from it.
   std::vector<size_t> offset_;
 
+  // Size of every value but the deletion marks, if `offset_` is empty.
+  size_t value_size_ = 0;
+
+  // Indices of the values the size of a deletion mark, in ascending order, if
+  // `offset_` is empty and the other values have another size.
+  std::vector<uint32_t> mark_indices_;
+
+  SequenceNumber min_seq_ = 0;
+
+  SequenceNumber max_seq_ = 0;
+
+  // Set once the SST is compacted away, the file is removed along with the
+  // last reference to it.
+  bool obsolete_ = false;
+
+  // Where the removal of the file is logged, if anywhere.
+  std::shared_ptr<EventLog> event_log_;
+
   size_t BinarySearch(uint64_t key) const;
 
-  std::shared_ptr<std::vector<StringSPtr>> Values() const;
+  void LowerBounds(const uint64_t *keys, size_t n, size_t *ret) const;
+
+  size_t Find(uint64_t key, SequenceNumber snapshot) const;
+
+  void UpdateSequenceRange();
+
+  void UpdateValueLayout();
+
+  size_t ValueOffset(size_t idx) const;
+
+  size_t ValueEnd(size_t idx) const;
+
+  size_t IndexMemoryUsage() const;
+
+  std::vector<StringSPtr> ValuesByIndices(const std::vector<size_t> &indices,
+                                          IOBackend *io_backend) const;
+
+  std::shared_ptr<std::vector<StringSPtr>> Values(
+      RateLimiter *rate_limiter = nullptr,
+      IOBackend *io_backend = nullptr) const;
 
  public:
   SSTable() = default;
 
   SSTable(const std::string &path, Timestamp timestamp);
 
+  SSTable(const SSTable &) = default;
+
+  ~SSTable();
+
   static SSTable *FromFile(const std::string &file_path);
 
   bool IsProbablyPresent(uint64_t) const;
 
-  std::shared_ptr<std::string> ValueByKey(uint64_t) const;
+  std::shared_ptr<std::string> ValueByKey(
+      uint64_t key, SequenceNumber snapshot = kMaxSequenceNumber,
+      SequenceNumber *seq = nullptr) const;
 
   std::shared_ptr<std::string> ValueByIndex(size_t idx) const;
 
+  std::vector<StringSPtr> ValuesByKeys(const std::vector<uint64_t> &keys,
+                                       SequenceNumber snapshot,
+                                       std::vector<SequenceNumber> *seqs,
+                                       IOBackend *io_backend) const;
+
   bool Contains(uint64_t key) const;
 
+  bool HasKeyInRange(uint64_t first, uint64_t last) const;
+
   uint64_t MinKey() const;
 
   uint64_t MaxKey() const;
 
-  void ToFile(std::vector<std::shared_ptr<std::string>> &values);
+  void ToFile(std::vector<std::shared_ptr<std::string>> &values,
+              RateLimiter *rate_limiter = nullptr,
+              IOBackend *io_backend = nullptr);
+
+  void Ingest(const std::string &file_path, Timestamp timestamp,
+              SequenceNumber seq);
+
+  void Restamp(Timestamp timestamp);
 };
 
 inline bool SSTableComparatorForSort(const SSTableSPtr &t1,
@@ -91,7 +165,7 @@ inline bool operator<(const std::pair<SSTableSPtr, size_t> &p1,
   SSTableSPtr t2 = p2.first;
   return t1->keys_[p1.second] > t2->keys_[p2.second] ||
          (t1->keys_[p1.second] == t2->keys_[p2.second] &&
-          t1->timestamp_ < t2->timestamp_);
+          t1->seqs_[p1.second] < t2->seqs_[p2.second]);
 }
 
 inline bool operator<(const SSTableSPtr &t1, const SSTableSPtr &t2) {
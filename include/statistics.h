@@ -0,0 +1,154 @@
+#ifndef LSM_STATISTICS_H
+#define LSM_STATISTICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "histogram.h"
+
+/**
+ * Counters and latency histograms of what stores do, which may be shared by
+ * several stores. Counts and latencies go to one of a few stripes picked by
+ * thread, so that threads recording at once rarely share a cache line; reads
+ * merge the stripes. It is safe for concurrent use.
+ */
+class Statistics {
+ public:
+  enum Ticker {
+    kMemTableHits,
+    kMemTableMisses,
+    kRowCacheHits,
+    kRowCacheMisses,
+    // SST files opened to read values by `Get`.
+    kSSTFilesOpened,
+    // Bytes of values read from SSTs by `Get`.
+    kBytesRead,
+    // Bytes of keys and values written by users.
+    kBytesWritten,
+    kBytesFlushed,
+    kBytesIngested,
+    kBytesCompactionRead,
+    kBytesCompactionWritten,
+    kWriteStallMicros,
+    kNumTickers,
+  };
+
+  // Counted per level, by `Get`.
+  enum LevelTicker {
+    kBloomFilterChecks,
+    // Checks ruling the key out, which spare a search and a read of the SST.
+    kBloomFilterUseful,
+    kNumLevelTickers,
+  };
+
+  // Latencies in microseconds, of the calls to the store.
+  enum HistogramType {
+    kPutMicros,
+    kGetMicros,
+    kDelMicros,
+    kFlushMicros,
+    kNumHistograms,
+  };
+
+  // Levels deeper than this are counted as the last one.
+  static const size_t kMaxLevels = 16;
+
+  Statistics();
+
+  void Record(Ticker ticker, uint64_t count = 1);
+
+  void RecordLevel(LevelTicker ticker, size_t level, uint64_t count = 1);
+
+  uint64_t Get(Ticker ticker) const;
+
+  uint64_t GetLevel(LevelTicker ticker, size_t level) const;
+
+  void RecordTime(HistogramType type, uint64_t micros);
+
+  /// Record the time of a compaction out of a level.
+  void RecordCompactionTime(size_t level, uint64_t micros);
+
+  /// Merge the latencies recorded into `histogram`.
+  void GetHistogram(HistogramType type, Histogram *histogram) const;
+
+  void GetCompactionHistogram(size_t level, Histogram *histogram) const;
+
+  /// Bytes written to disk per byte flushed or ingested, 0 before any.
+  double WriteAmplification() const;
+
+  void Reset();
+
+  /// One line per ticker, `name: count`, then one line per level counted,
+  /// then one line per histogram recorded into.
+  std::string ToString() const;
+
+  static const char *Name(Ticker ticker);
+
+  static const char *Name(LevelTicker ticker);
+
+  static const char *Name(HistogramType type);
+
+ private:
+  static const size_t kNumStripes = 16;
+
+  static const size_t kCacheLineSize = 64;
+
+  static const size_t kCountersPerStripe =
+      kNumTickers + kMaxLevels * kNumLevelTickers;
+
+  // Padded to whole cache lines rather than aligned, since C++14 `new` does
+  // not honor alignments past that of `max_align_t`.
+  struct Stripe {
+    std::atomic<uint64_t> tickers[kNumTickers];
+
+    std::atomic<uint64_t> level_tickers[kMaxLevels][kNumLevelTickers];
+
+    char padding[kCacheLineSize -
+                 kCountersPerStripe * sizeof(uint64_t) % kCacheLineSize];
+  };
+
+  static size_t StripeIndex();
+
+  Stripe stripes_[kNumStripes];
+
+  Histogram histograms_[kNumStripes][kNumHistograms];
+
+  // Compactions run on background threads, one at a time per store, so they
+  // are not striped.
+  Histogram compaction_histograms_[kMaxLevels];
+};
+
+/**
+ * Records the time from its construction to its destruction into a histogram
+ * of latencies.
+ */
+class StopWatch {
+ public:
+  StopWatch(Statistics *statistics, Statistics::HistogramType type)
+      : statistics_(statistics),
+        type_(type),
+        start_(std::chrono::steady_clock::now()) {}
+
+  StopWatch(const StopWatch &) = delete;
+
+  StopWatch &operator=(const StopWatch &) = delete;
+
+  ~StopWatch() {
+    statistics_->RecordTime(
+        type_, std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::steady_clock::now() - start_)
+                   .count());
+  }
+
+ private:
+  Statistics *const statistics_;
+
+  const Statistics::HistogramType type_;
+
+  const std::chrono::steady_clock::time_point start_;
+};
+
+#endif  // LSM_STATISTICS_H
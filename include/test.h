@@ -9,8 +9,9 @@
 
 class Test {
  public:
-  explicit Test(const std::string &dir, bool v = true)
-      : kDir(dir), store_(dir), verbose_(v) {
+  explicit Test(const std::string &dir, bool v = true,
+                const Options &options = Options())
+      : kDir(dir), store_(dir, options), verbose_(v) {
     nr_tests_ = 0;
     nr_passed_tests_ = 0;
     nr_phases_ = 0;
@@ -0,0 +1,44 @@
+#ifndef LSM_THREAD_POOL_H
+#define LSM_THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Fixed set of threads running background work, such as compactions, for one
+ * or more stores.
+ */
+class ThreadPool {
+ public:
+  explicit ThreadPool(size_t num_threads);
+
+  ThreadPool(const ThreadPool &) = delete;
+
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  /// Run the tasks already scheduled, then join the threads.
+  ~ThreadPool();
+
+  void Schedule(std::function<void()> task);
+
+  size_t NumThreads() const { return threads_.size(); }
+
+ private:
+  void Work();
+
+  std::mutex mutex_;
+
+  std::condition_variable cv_;
+
+  std::deque<std::function<void()>> tasks_;
+
+  bool shutting_down_;
+
+  std::vector<std::thread> threads_;
+};
+
+#endif  // LSM_THREAD_POOL_H
@@ -0,0 +1,21 @@
+#ifndef LSM_VERSION_H
+#define LSM_VERSION_H
+
+#include "range_tombstone.h"
+#include "sstable.h"
+
+/**
+ * The SSTs of a store, level by level, and its range tombstones, as of a
+ * change. A version is never changed once installed: flushes and compactions
+ * install a new one, and readers search the one they pinned without the lock.
+ * The files of compacted SSTs go away once no version refers to them.
+ */
+struct Version {
+  std::vector<LevelSPtr> levels;
+
+  RangeTombstoneListSPtr range_tombstones;
+};
+
+typedef std::shared_ptr<const Version> VersionSPtr;
+
+#endif  // LSM_VERSION_H
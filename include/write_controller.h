@@ -0,0 +1,59 @@
+#ifndef LSM_WRITE_CONTROLLER_H
+#define LSM_WRITE_CONTROLLER_H
+
+#include <chrono>
+#include <cstddef>
+
+/**
+ * Backpressure on writers while background compaction falls behind.
+ *
+ * Writes slow down once level-0 holds `level0_slowdown_writes_trigger` SSTs or
+ * the pending compaction bytes reach `soft_pending_compaction_bytes_limit`.
+ * The allowed write rate starts at `delayed_write_rate` and shrinks linearly to
+ * a sixteenth of it as the store approaches the stop thresholds,
+ * `level0_stop_writes_trigger` and `hard_pending_compaction_bytes_limit`, where
+ * writes block until compaction catches up.
+ */
+class WriteController {
+ public:
+  /// Least delay a writer is asked to sleep for.
+  static constexpr std::chrono::microseconds kMinDelay =
+      std::chrono::microseconds(1000);
+
+  WriteController(size_t level0_slowdown_writes_trigger,
+                  size_t level0_stop_writes_trigger,
+                  size_t soft_pending_compaction_bytes_limit,
+                  size_t hard_pending_compaction_bytes_limit,
+                  size_t delayed_write_rate);
+
+  /// Refresh the state of the store, after a flush or a compaction.
+  void Update(size_t num_level0_ssts, size_t pending_compaction_bytes);
+
+  bool IsStopped() const { return stopped_; }
+
+  /// Account a write of `bytes`, and return how long the writer should sleep.
+  /// The delay is handed out in slices of at least `kMinDelay`, to keep
+  /// small writes from sleeping for a few microseconds each.
+  std::chrono::microseconds DelayFor(size_t bytes);
+
+ private:
+  const size_t kLevel0SlowdownWritesTrigger;
+
+  const size_t kLevel0StopWritesTrigger;
+
+  const size_t kSoftPendingCompactionBytesLimit;
+
+  const size_t kHardPendingCompactionBytesLimit;
+
+  const size_t kDelayedWriteRate;
+
+  bool stopped_;
+
+  // Allowed write rate in bytes/sec, 0 if writes are not delayed.
+  double write_rate_;
+
+  // Delay owed by the writes so far, not yet slept.
+  double owed_micros_;
+};
+
+#endif  // LSM_WRITE_CONTROLLER_H
@@ -0,0 +1,116 @@
+#include "../include/compaction_strategy.h"
+
+/**
+ * @Description: Compute `base^exp` for level capacities.
+ */
+static size_t Pow(size_t base, size_t exp) {
+  size_t ret = 1;
+  while (exp--) {
+    ret *= base;
+  }
+  return ret;
+}
+
+/**
+ * @Description: Expected write amplification of merging into a leveled level.
+ * Each byte that arrives there is rewritten along with on average half of the
+ * `size_ratio` times larger level it lands in.
+ */
+static double LeveledMergeCost(size_t size_ratio) {
+  return ((double)size_ratio + 1) / 2;
+}
+
+LeveledCompaction::LeveledCompaction(size_t size_ratio)
+    : kSizeRatio(size_ratio) {}
+
+std::string LeveledCompaction::Name() const { return "leveled"; }
+
+bool LeveledCompaction::IsTiered(size_t level, size_t /*num_levels*/) const {
+  return level == 0;
+}
+
+size_t LeveledCompaction::Capacity(size_t level, size_t /*num_levels*/) const {
+  return Pow(kSizeRatio, level + 1);
+}
+
+/**
+ * @Description: One write for the flush, then a leveled merge for every level
+ * below level-0.
+ */
+double LeveledCompaction::WriteAmplification(size_t num_levels) const {
+  if (num_levels <= 1) {
+    return 1;
+  }
+  return 1 + (double)(num_levels - 1) * LeveledMergeCost(kSizeRatio);
+}
+
+/**
+ * @Description: In the worst case every upper level holds overwrites of keys
+ * of the bottom level, which is `size_ratio` times larger than the one above.
+ */
+double LeveledCompaction::SpaceAmplification(size_t /*num_levels*/) const {
+  return 1 + 1 / ((double)kSizeRatio - 1);
+}
+
+TieredCompaction::TieredCompaction(size_t size_ratio)
+    : kSizeRatio(size_ratio) {}
+
+std::string TieredCompaction::Name() const { return "tiered"; }
+
+bool TieredCompaction::IsTiered(size_t /*level*/, size_t /*num_levels*/) const {
+  return true;
+}
+
+size_t TieredCompaction::Capacity(size_t /*level*/,
+                                  size_t /*num_levels*/) const {
+  return kSizeRatio;
+}
+
+/**
+ * @Description: Every byte is written once per level, since runs are only
+ * merged with the other runs of their own level.
+ */
+double TieredCompaction::WriteAmplification(size_t num_levels) const {
+  return num_levels ? (double)num_levels : 1;
+}
+
+/**
+ * @Description: The bottom level may hold `size_ratio` runs that all cover the
+ * same keys.
+ */
+double TieredCompaction::SpaceAmplification(size_t /*num_levels*/) const {
+  return (double)kSizeRatio;
+}
+
+LazyLevelingCompaction::LazyLevelingCompaction(size_t size_ratio)
+    : kSizeRatio(size_ratio) {}
+
+std::string LazyLevelingCompaction::Name() const { return "lazy-leveling"; }
+
+bool LazyLevelingCompaction::IsTiered(size_t level, size_t num_levels) const {
+  return level == 0 || level + 1 < num_levels;
+}
+
+size_t LazyLevelingCompaction::Capacity(size_t level,
+                                        size_t num_levels) const {
+  return IsTiered(level, num_levels) ? kSizeRatio : Pow(kSizeRatio, level + 1);
+}
+
+/**
+ * @Description: Tiered writes for all levels above the bottom one, and a
+ * leveled merge into the bottom level.
+ */
+double LazyLevelingCompaction::WriteAmplification(size_t num_levels) const {
+  if (num_levels <= 1) {
+    return 1;
+  }
+  return (double)(num_levels - 1) + LeveledMergeCost(kSizeRatio);
+}
+
+/**
+ * @Description: Same as leveling, since the bottom level, which holds most of
+ * the data, is a single run.
+ */
+double LazyLevelingCompaction::SpaceAmplification(size_t /*num_levels*/) const {
+  return 1 + 1 / ((double)kSizeRatio - 1);
+}
@@ -0,0 +1,138 @@
+#include "../include/event_log.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <system_error>
+
+/**
+ * @Description: Quote a string for JSON.
+ * @param s: The string.
+ * @return: The quoted string, with quotes, backslashes and control characters
+ * escaped.
+ */
+static std::string Quote(const std::string &s) {
+  std::string out = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if ((unsigned char)c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out += buf;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+void EventLog::Args::AddName(const std::string &name) {
+  if (!json_.empty()) {
+    json_ += ",";
+  }
+  json_ += Quote(name) + ":";
+}
+
+EventLog::Args &EventLog::Args::Add(const std::string &name,
+                                    const uint64_t value) {
+  AddName(name);
+  json_ += std::to_string(value);
+  return *this;
+}
+
+EventLog::Args &EventLog::Args::Add(const std::string &name,
+                                    const std::string &value) {
+  AddName(name);
+  json_ += Quote(value);
+  return *this;
+}
+
+EventLog::Args &EventLog::Args::Add(const std::string &name,
+                                    const std::vector<std::string> &values) {
+  AddName(name);
+  json_ += "[";
+  for (size_t i = 0; i < values.size(); ++i) {
+    json_ += (i ? "," : "") + Quote(values[i]);
+  }
+  json_ += "]";
+  return *this;
+}
+
+EventLog::EventLog(const size_t capacity)
+    : kCapacity(capacity), kStart(std::chrono::steady_clock::now()) {}
+
+/**
+ * @Description: Log an event of the calling thread, dropping the oldest one if
+ * the log is full. Each event holds both its start and its duration, so what
+ * is dropped is always a whole event.
+ * @param name: What the event is of.
+ * @param start: When the event began.
+ * @param args: Arguments of the event.
+ */
+void EventLog::Complete(const std::string &name,
+                        const std::chrono::steady_clock::time_point start,
+                        const Args &args) {
+  auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!kCapacity) {
+    return;
+  }
+  if (events_.size() == kCapacity) {
+    events_.pop_front();
+  }
+  auto tid = tids_.emplace(std::this_thread::get_id(), tids_.size() + 1).first;
+  events_.push_back(Event{name, MicrosSinceStart(start),
+                          MicrosSinceStart(now) - MicrosSinceStart(start),
+                          tid->second, args.Json()});
+}
+
+size_t EventLog::Size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return events_.size();
+}
+
+void EventLog::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  events_.clear();
+}
+
+uint64_t EventLog::MicrosSinceStart(
+    const std::chrono::steady_clock::time_point time) const {
+  return time < kStart ? 0
+                       : std::chrono::duration_cast<std::chrono::microseconds>(
+                             time - kStart)
+                             .count();
+}
+
+/**
+ * @Description: Print the events in the Chrome trace event format, as complete
+ * events of one process.
+ * @return: The JSON object.
+ */
+std::string EventLog::ToChromeTrace() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::string out = "{\"traceEvents\":[";
+  for (size_t i = 0; i < events_.size(); ++i) {
+    const Event &event = events_[i];
+    out += i ? ",\n" : "\n";
+    out += "{\"name\":" + Quote(event.name) +
+           ",\"cat\":\"lsm\",\"ph\":\"X\",\"ts\":" +
+           std::to_string(event.micros) +
+           ",\"dur\":" + std::to_string(event.duration_micros) +
+           ",\"pid\":1,\"tid\":" + std::to_string(event.tid) + ",\"args\":{" +
+           event.args + "}}";
+  }
+  return out + "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
+
+void EventLog::ExportChromeTrace(const std::string &path) const {
+  std::ofstream out(path, std::ios::trunc);
+  out << ToChromeTrace();
+  out.close();
+  if (!out) {
+    throw std::system_error(errno, std::generic_category(),
+                            "EventLog::ExportChromeTrace: " + path);
+  }
+}
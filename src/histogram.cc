@@ -0,0 +1,147 @@
+#include "../include/histogram.h"
+
+#include <cstdio>
+#include <limits>
+
+Histogram::Histogram() { Clear(); }
+
+/**
+ * @Description: Find the bucket of a value: the value itself if it is below
+ * `kSubBuckets`, else the power of two it lies in, and the `kSubBucketBits`
+ * bits below its top bit.
+ * @param value: The value.
+ * @return: The index of the bucket.
+ */
+size_t Histogram::BucketFor(const uint64_t value) {
+  if (value < kSubBuckets) {
+    return value;
+  }
+  size_t top_bit = 63 - __builtin_clzll(value);
+  size_t shift = top_bit - kSubBucketBits;
+  return (shift + 1) * kSubBuckets + ((value >> shift) - kSubBuckets);
+}
+
+/**
+ * @Description: Find the least value of a bucket.
+ * @param bucket: The index of the bucket, `kNumBuckets` for the end of the
+ * last one, which is saturated.
+ * @return: The least value.
+ */
+uint64_t Histogram::BucketLow(const size_t bucket) {
+  if (bucket < kSubBuckets) {
+    return bucket;
+  }
+  if (bucket >= kNumBuckets) {
+    return std::numeric_limits<uint64_t>::max();
+  }
+  size_t shift = bucket / kSubBuckets - 1;
+  return (uint64_t)(kSubBuckets + bucket % kSubBuckets) << shift;
+}
+
+void Histogram::Add(const uint64_t value) {
+  buckets_[BucketFor(value)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+
+  uint64_t min = min_.load(std::memory_order_relaxed);
+  while (value < min && !min_.compare_exchange_weak(
+                            min, value, std::memory_order_relaxed)) {
+  }
+  uint64_t max = max_.load(std::memory_order_relaxed);
+  while (value > max && !max_.compare_exchange_weak(
+                            max, value, std::memory_order_relaxed)) {
+  }
+}
+
+void Histogram::Merge(const Histogram &other) {
+  for (size_t i = 0; i < kNumBuckets; ++i) {
+    uint64_t count = other.buckets_[i].load(std::memory_order_relaxed);
+    if (count) {
+      buckets_[i].fetch_add(count, std::memory_order_relaxed);
+    }
+  }
+  count_.fetch_add(other.count_.load(std::memory_order_relaxed),
+                   std::memory_order_relaxed);
+  sum_.fetch_add(other.sum_.load(std::memory_order_relaxed),
+                 std::memory_order_relaxed);
+
+  uint64_t other_min = other.min_.load(std::memory_order_relaxed);
+  uint64_t min = min_.load(std::memory_order_relaxed);
+  while (other_min < min && !min_.compare_exchange_weak(
+                                min, other_min, std::memory_order_relaxed)) {
+  }
+  uint64_t other_max = other.max_.load(std::memory_order_relaxed);
+  uint64_t max = max_.load(std::memory_order_relaxed);
+  while (other_max > max && !max_.compare_exchange_weak(
+                                max, other_max, std::memory_order_relaxed)) {
+  }
+}
+
+void Histogram::Clear() {
+  for (auto &bucket : buckets_) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+  count_.store(0, std::memory_order_relaxed);
+  sum_.store(0, std::memory_order_relaxed);
+  min_.store(std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed);
+  max_.store(0, std::memory_order_relaxed);
+}
+
+uint64_t Histogram::Count() const {
+  return count_.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::Sum() const { return sum_.load(std::memory_order_relaxed); }
+
+uint64_t Histogram::Min() const {
+  return Count() ? min_.load(std::memory_order_relaxed) : 0;
+}
+
+uint64_t Histogram::Max() const {
+  return max_.load(std::memory_order_relaxed);
+}
+
+double Histogram::Average() const {
+  uint64_t count = Count();
+  return count ? (double)Sum() / (double)count : 0;
+}
+
+/**
+ * @Description: Estimate a percentile, by walking the buckets up to the one
+ * holding it, and interpolating linearly in that bucket.
+ * @param p: The percentile, from 0 to 100.
+ * @return: The estimate, within the least and greatest values added.
+ */
+double Histogram::Percentile(const double p) const {
+  uint64_t count = Count();
+  if (!count) {
+    return 0;
+  }
+  double rank = (double)count * p / 100;
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < kNumBuckets; ++i) {
+    uint64_t in_bucket = buckets_[i].load(std::memory_order_relaxed);
+    if (!in_bucket || (double)(cumulative + in_bucket) < rank) {
+      cumulative += in_bucket;
+      continue;
+    }
+    double low = (double)BucketLow(i);
+    double high = (double)BucketLow(i + 1);
+    double estimate =
+        low + (high - low) * (rank - (double)cumulative) / (double)in_bucket;
+    if (estimate < (double)Min()) {
+      return (double)Min();
+    }
+    return estimate > (double)Max() ? (double)Max() : estimate;
+  }
+  return (double)Max();
+}
+
+std::string Histogram::ToString() const {
+  char buf[160];
+  snprintf(buf, sizeof(buf),
+           "count: %llu avg: %.1f p50: %.1f p99: %.1f p99.9: %.1f max: %llu",
+           (unsigned long long)Count(), Average(), Percentile(50),
+           Percentile(99), Percentile(99.9), (unsigned long long)Max());
+  return buf;
+}
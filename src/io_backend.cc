@@ -0,0 +1,440 @@
+#include "../include/io_backend.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <thread>
+
+#ifdef LSM_HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+const size_t IOBackend::kMaxRequestSize;
+
+const unsigned IOBackend::kDefaultQueueDepth;
+
+void IOBackend::AddRequests(const int fd, const uint64_t offset,
+                            const size_t length, char *buf,
+                            std::vector<IORequest> &requests) {
+  for (size_t done = 0; done < length; done += kMaxRequestSize) {
+    requests.push_back(IORequest{fd, offset + done,
+                                 std::min(kMaxRequestSize, length - done),
+                                 buf + done, 0, 0});
+  }
+}
+
+std::shared_ptr<IOBackend> IOBackend::NewDefault() {
+#ifdef LSM_HAVE_IO_URING
+  std::shared_ptr<IOBackend> io_uring =
+      IoUringIOBackend::Create(kDefaultQueueDepth);
+  if (io_uring) {
+    return io_uring;
+  }
+#endif
+  return std::make_shared<PosixIOBackend>();
+}
+
+int IOBackend::Open(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::system_error(errno, std::generic_category(), "open " + path);
+  }
+  return fd;
+}
+
+int IOBackend::Create(const std::string &path) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    throw std::system_error(errno, std::generic_category(), "create " + path);
+  }
+  return fd;
+}
+
+/**
+ * @Description: Throw `std::system_error` for the first request not done in
+ * full.
+ * @param what: "read" or "write", for the message.
+ */
+static void CheckDone(const std::vector<IORequest> &requests,
+                      const std::string &path, const std::string &what) {
+  for (const IORequest &request : requests) {
+    if (request.bytes_done < request.length) {
+      throw std::system_error(request.error ? request.error : EIO,
+                              std::generic_category(),
+                              "short " + what + " of " + path + " at " +
+                                  std::to_string(request.offset));
+    }
+  }
+}
+
+void IOBackend::CheckRead(const std::vector<IORequest> &requests,
+                          const std::string &path) {
+  CheckDone(requests, path, "read");
+}
+
+void IOBackend::CheckWrite(const std::vector<IORequest> &requests,
+                           const std::string &path) {
+  CheckDone(requests, path, "write");
+}
+
+/**
+ * @Description: Serve the rest of a request with `pread`, up to the end of the
+ * file or an error, whose `errno` is kept in the request.
+ */
+void IOBackend::PosixRead(IORequest &request) {
+  while (request.bytes_done < request.length) {
+    ssize_t ret =
+        pread(request.fd, request.buf + request.bytes_done,
+              request.length - request.bytes_done,
+              (off_t)(request.offset + request.bytes_done));
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ret < 0) {
+      request.error = errno;
+    }
+    if (ret <= 0) {
+      return;
+    }
+    request.bytes_done += ret;
+  }
+}
+
+/**
+ * @Description: Serve the rest of a request with `pwrite`, up to an error,
+ * whose `errno` is kept in the request.
+ */
+void IOBackend::PosixWrite(IORequest &request) {
+  while (request.bytes_done < request.length) {
+    ssize_t ret =
+        pwrite(request.fd, request.buf + request.bytes_done,
+               request.length - request.bytes_done,
+               (off_t)(request.offset + request.bytes_done));
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ret < 0) {
+      request.error = errno;
+    }
+    if (ret <= 0) {
+      return;
+    }
+    request.bytes_done += ret;
+  }
+}
+
+void PosixIOBackend::Read(std::vector<IORequest> &requests) {
+  for (IORequest &request : requests) {
+    request.bytes_done = 0;
+    request.error = 0;
+    PosixRead(request);
+  }
+}
+
+void PosixIOBackend::Write(std::vector<IORequest> &requests) {
+  for (IORequest &request : requests) {
+    request.bytes_done = 0;
+    request.error = 0;
+    PosixWrite(request);
+  }
+}
+
+#ifdef LSM_HAVE_IO_URING
+IoUringIOBackend::IoUringIOBackend(const int ring_fd)
+    : kRingFd(ring_fd),
+      sq_entries_(0),
+      sq_ring_(MAP_FAILED),
+      sq_ring_size_(0),
+      cq_ring_(MAP_FAILED),
+      cq_ring_size_(0),
+      sqes_(static_cast<io_uring_sqe *>(MAP_FAILED)),
+      sqes_size_(0),
+      num_unsubmitted_(0),
+      num_in_flight_(0),
+      waiting_(false) {}
+
+std::unique_ptr<IoUringIOBackend> IoUringIOBackend::Create(
+    const unsigned queue_depth) {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int ring_fd = (int)syscall(__NR_io_uring_setup, queue_depth, &params);
+  if (ring_fd < 0) {
+    return nullptr;
+  }
+
+  std::unique_ptr<IoUringIOBackend> ret(new IoUringIOBackend(ring_fd));
+  if (!ret->MapRings(params)) {
+    return nullptr;
+  }
+  return ret;
+}
+
+IoUringIOBackend::~IoUringIOBackend() {
+  if (sqes_ != MAP_FAILED) {
+    munmap(sqes_, sqes_size_);
+  }
+  if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+    munmap(cq_ring_, cq_ring_size_);
+  }
+  if (sq_ring_ != MAP_FAILED) {
+    munmap(sq_ring_, sq_ring_size_);
+  }
+  close(kRingFd);
+}
+
+/**
+ * @Description: Map the submission and completion rings, and the submission
+ * queue entries, of the ring just set up.
+ * @return: `false` iff a mapping failed.
+ */
+bool IoUringIOBackend::MapRings(const io_uring_params &params) {
+  sq_entries_ = params.sq_entries;
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+  }
+
+  sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, kRingFd, IORING_OFF_SQ_RING);
+  if (sq_ring_ == MAP_FAILED) {
+    return false;
+  }
+  cq_ring_ = single_mmap
+                 ? sq_ring_
+                 : mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, kRingFd, IORING_OFF_CQ_RING);
+  if (cq_ring_ == MAP_FAILED) {
+    return false;
+  }
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  sqes_ = static_cast<io_uring_sqe *>(
+      mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, kRingFd, IORING_OFF_SQES));
+  if (sqes_ == MAP_FAILED) {
+    return false;
+  }
+
+  char *sq = static_cast<char *>(sq_ring_);
+  sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  sq_mask_ = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+  char *cq = static_cast<char *>(cq_ring_);
+  cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+  cq_mask_ = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+  return true;
+}
+
+/**
+ * @Description: Queue the rest of a request. The lock must be held, and the
+ * submission ring must have room.
+ * @param batch: The batch of the request.
+ * @param op: The request in flight, which comes back with the completion.
+ */
+void IoUringIOBackend::Prepare(const Batch &batch, const Op *op) {
+  const IORequest &request = (*batch.requests)[op->idx];
+  unsigned tail = *sq_tail_;
+  unsigned index = tail & *sq_mask_;
+  io_uring_sqe *sqe = &sqes_[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = batch.opcode;
+  sqe->fd = request.fd;
+  sqe->off = request.offset + request.bytes_done;
+  sqe->addr = reinterpret_cast<uint64_t>(request.buf + request.bytes_done);
+  sqe->len = (unsigned)(request.length - request.bytes_done);
+  sqe->user_data = reinterpret_cast<uint64_t>(op);
+  sq_array_[index] = index;
+  // The kernel must see the entry before the new tail.
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  ++num_unsubmitted_;
+  ++num_in_flight_;
+}
+
+/**
+ * @Description: Queue as many requests of a batch as the ring has room for,
+ * and hand everything queued to the kernel, without waiting. If the kernel
+ * fails the submission, the requests it did not take are taken back and the
+ * batch is marked failed. The lock must be held.
+ * @param batch: The batch.
+ */
+void IoUringIOBackend::Submit(Batch &batch) {
+  std::vector<IORequest> &requests = *batch.requests;
+  while (num_in_flight_ < sq_entries_ &&
+         (!batch.again.empty() || batch.next < requests.size())) {
+    size_t idx;
+    if (!batch.again.empty()) {
+      idx = batch.again.back();
+      batch.again.pop_back();
+    } else {
+      idx = batch.next++;
+    }
+    Prepare(batch, &batch.ops[idx]);
+  }
+
+  while (num_unsubmitted_) {
+    int ret = (int)syscall(__NR_io_uring_enter, kRingFd, num_unsubmitted_, 0,
+                           0, nullptr, 0);
+    if (ret < 0) {
+      if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+        continue;
+      }
+      Unqueue(batch);
+      return;
+    }
+    num_unsubmitted_ -= ret;
+  }
+}
+
+/**
+ * @Description: Take back the requests queued but not taken by the kernel,
+ * which all belong to the batch, since every call to `Submit` hands all it
+ * queues over or takes it back. They are served as failed, and so is the rest
+ * of the batch. The lock must be held.
+ * @param batch: The batch being submitted.
+ */
+void IoUringIOBackend::Unqueue(Batch &batch) {
+  // Without a polling thread, the kernel only reads the ring in the calls
+  // made under the lock, so the entries past its head are still free to take.
+  unsigned tail = *sq_tail_;
+  for (unsigned i = 0; i < num_unsubmitted_; ++i) {
+    const io_uring_sqe &sqe = sqes_[(tail - 1 - i) & *sq_mask_];
+    batch.failed.push_back(reinterpret_cast<const Op *>(sqe.user_data)->idx);
+  }
+  __atomic_store_n(sq_tail_, tail - num_unsubmitted_, __ATOMIC_RELEASE);
+  num_in_flight_ -= num_unsubmitted_;
+  num_unsubmitted_ = 0;
+  batch.ring_failed = true;
+}
+
+/**
+ * @Description: Take the completions off the ring, and route each to the batch
+ * of its request. Short reads are queued again for the rest. The lock must be
+ * held.
+ */
+void IoUringIOBackend::Reap() {
+  unsigned head = *cq_head_;
+  unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  for (; head != tail; ++head) {
+    const io_uring_cqe &cqe = cqes_[head & *cq_mask_];
+    const Op *op = reinterpret_cast<const Op *>(cqe.user_data);
+    Batch &batch = *op->batch;
+    IORequest &request = (*batch.requests)[op->idx];
+    --num_in_flight_;
+    if (cqe.res > 0) {
+      request.bytes_done += cqe.res;
+      if (request.bytes_done < request.length) {
+        batch.again.push_back(op->idx);
+        continue;
+      }
+    } else if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+      batch.again.push_back(op->idx);
+      continue;
+    } else if (cqe.res < 0) {
+      // E.g. a kernel too old for `IORING_OP_READ` or `IORING_OP_WRITE`.
+      batch.failed.push_back(op->idx);
+      continue;
+    }
+    ++batch.num_done;
+  }
+  __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+}
+
+void IoUringIOBackend::Read(std::vector<IORequest> &requests) {
+  Serve(requests, IORING_OP_READ);
+}
+
+void IoUringIOBackend::Write(std::vector<IORequest> &requests) {
+  Serve(requests, IORING_OP_WRITE);
+}
+
+/**
+ * @Description: Keep the ring full with the requests of a batch until all of
+ * them complete, sharing it with concurrent callers. The caller waiting in the
+ * kernel reaps the completions of all of them. Should the ring fail, the
+ * requests in flight are still waited for, since the kernel may write to their
+ * buffers and their completions point into the batch; the others are served
+ * with `pread` or `pwrite`.
+ * @param requests: The requests.
+ * @param opcode: `IORING_OP_READ` or `IORING_OP_WRITE`.
+ */
+void IoUringIOBackend::Serve(std::vector<IORequest> &requests,
+                             const uint8_t opcode) {
+  for (IORequest &request : requests) {
+    request.bytes_done = 0;
+    request.error = 0;
+  }
+  Batch batch{&requests, opcode, std::vector<Op>(requests.size()), 0, 0, {},
+              {}, false};
+  for (size_t i = 0; i < requests.size(); ++i) {
+    batch.ops[i] = Op{&batch, i};
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (batch.num_done < requests.size()) {
+    if (batch.ring_failed) {
+      batch.failed.insert(batch.failed.end(), batch.again.begin(),
+                          batch.again.end());
+      batch.again.clear();
+      for (; batch.next < requests.size(); ++batch.next) {
+        batch.failed.push_back(batch.next);
+      }
+    }
+    if (!batch.failed.empty()) {
+      std::vector<size_t> failed;
+      failed.swap(batch.failed);
+      lock.unlock();
+      for (size_t idx : failed) {
+        if (opcode == IORING_OP_READ) {
+          PosixRead(requests[idx]);
+        } else {
+          PosixWrite(requests[idx]);
+        }
+      }
+      lock.lock();
+      batch.num_done += failed.size();
+      continue;
+    }
+
+    if (!batch.ring_failed) {
+      Submit(batch);
+      if (batch.ring_failed) {
+        continue;
+      }
+    }
+    if (waiting_) {
+      reaped_cv_.wait(lock);
+      continue;
+    }
+
+    // Once the ring failed, the completions still come to it, but are
+    // polled for rather than waited for in the kernel.
+    waiting_ = true;
+    lock.unlock();
+    int ret = 0;
+    int error = 0;
+    if (batch.ring_failed) {
+      std::this_thread::yield();
+    } else {
+      ret = (int)syscall(__NR_io_uring_enter, kRingFd, 0, 1,
+                         IORING_ENTER_GETEVENTS, nullptr, 0);
+      error = errno;
+    }
+    lock.lock();
+    waiting_ = false;
+    Reap();
+    reaped_cv_.notify_all();
+    if (ret < 0 && error != EINTR && error != EAGAIN && error != EBUSY) {
+      batch.ring_failed = true;
+    }
+  }
+}
+#endif
@@ -0,0 +1,454 @@
+#include "../include/iterator.h"
+
+#include <unistd.h>
+
+const size_t SSTableIterator::kInitialReadahead;
+
+const size_t SSTableIterator::kMaxReadahead;
+
+VectorIterator::VectorIterator(std::vector<MemTableEntry> entries)
+    : entries_(std::move(entries)), idx_(entries_.size()) {}
+
+void VectorIterator::SeekToLast() {
+  idx_ = entries_.empty() ? 0 : entries_.size() - 1;
+}
+
+void VectorIterator::Seek(const uint64_t target) {
+  idx_ = std::lower_bound(entries_.begin(), entries_.end(), target,
+                          [](const MemTableEntry &entry, uint64_t key) {
+                            return entry.key < key;
+                          }) -
+         entries_.begin();
+}
+
+void VectorIterator::SeekForPrev(const uint64_t target) {
+  size_t end = std::upper_bound(entries_.begin(), entries_.end(), target,
+                                [](uint64_t key, const MemTableEntry &entry) {
+                                  return key < entry.key;
+                                }) -
+               entries_.begin();
+  idx_ = end ? end - 1 : entries_.size();
+}
+
+void VectorIterator::Prev() { idx_ = idx_ ? idx_ - 1 : entries_.size(); }
+
+SSTableIterator::SSTableIterator(SSTableSPtr sst_ptr,
+                                 const SequenceNumber snapshot,
+                                 IOBackend *io_backend)
+    : sst_ptr_(std::move(sst_ptr)),
+      kSnapshot(snapshot),
+      io_backend_(io_backend),
+      idx_(sst_ptr_->num_keys_),
+      forward_(true),
+      fd_(-1),
+      block_begin_(0),
+      block_end_(0),
+      readahead_(kInitialReadahead) {}
+
+SSTableIterator::~SSTableIterator() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+void SSTableIterator::SeekToFirst() {
+  idx_ = 0;
+  forward_ = true;
+  FindVisibleForward();
+}
+
+void SSTableIterator::SeekToLast() {
+  idx_ = sst_ptr_->num_keys_ ? sst_ptr_->num_keys_ - 1 : 0;
+  forward_ = false;
+  FindVisibleBackward();
+}
+
+void SSTableIterator::Seek(const uint64_t target) {
+  const std::vector<uint64_t> &keys = sst_ptr_->keys_;
+  idx_ = std::lower_bound(keys.begin(), keys.end(), target) - keys.begin();
+  forward_ = true;
+  FindVisibleForward();
+}
+
+void SSTableIterator::SeekForPrev(const uint64_t target) {
+  const std::vector<uint64_t> &keys = sst_ptr_->keys_;
+  size_t end =
+      std::upper_bound(keys.begin(), keys.end(), target) - keys.begin();
+  idx_ = end ? end - 1 : sst_ptr_->num_keys_;
+  forward_ = false;
+  FindVisibleBackward();
+}
+
+/**
+ * @Description: Move past the older versions of the current key, onto the
+ * newest visible version of the next key.
+ */
+void SSTableIterator::Next() {
+  const std::vector<uint64_t> &keys = sst_ptr_->keys_;
+  uint64_t key = keys[idx_];
+  while (idx_ < sst_ptr_->num_keys_ && keys[idx_] == key) {
+    ++idx_;
+  }
+  forward_ = true;
+  FindVisibleForward();
+}
+
+/**
+ * @Description: Move before the newer versions of the current key, onto the
+ * newest visible version of the previous key.
+ */
+void SSTableIterator::Prev() {
+  const std::vector<uint64_t> &keys = sst_ptr_->keys_;
+  uint64_t key = keys[idx_];
+  while (idx_ && keys[idx_ - 1] == key) {
+    --idx_;
+  }
+  idx_ = idx_ ? idx_ - 1 : sst_ptr_->num_keys_;
+  forward_ = false;
+  FindVisibleBackward();
+}
+
+/**
+ * @Description: From the first entry of a key, or past the versions of it
+ * newer than the snapshot, skip forward to the first visible entry. Versions
+ * go from newest to oldest, so it is the newest visible version of its key.
+ */
+void SSTableIterator::FindVisibleForward() {
+  while (idx_ < sst_ptr_->num_keys_ && sst_ptr_->seqs_[idx_] > kSnapshot) {
+    ++idx_;
+  }
+}
+
+/**
+ * @Description: From the last (oldest) entry of a key, skip backward over the
+ * keys with no visible version, then settle on the newest visible version.
+ */
+void SSTableIterator::FindVisibleBackward() {
+  const std::vector<uint64_t> &keys = sst_ptr_->keys_;
+  const std::vector<SequenceNumber> &seqs = sst_ptr_->seqs_;
+  while (idx_ < sst_ptr_->num_keys_ && seqs[idx_] > kSnapshot) {
+    // Even the oldest version of the key is too new.
+    uint64_t key = keys[idx_];
+    while (idx_ && keys[idx_ - 1] == key) {
+      --idx_;
+    }
+    idx_ = idx_ ? idx_ - 1 : sst_ptr_->num_keys_;
+  }
+  while (idx_ < sst_ptr_->num_keys_ && idx_ && keys[idx_ - 1] == keys[idx_] &&
+         seqs[idx_ - 1] <= kSnapshot) {
+    --idx_;
+  }
+}
+
+/**
+ * @Description: Get the value under the cursor, reading it along with its
+ * neighbours if it is not in the block read last.
+ */
+std::string SSTableIterator::Value() const {
+  if (idx_ < block_begin_ || idx_ >= block_end_) {
+    ReadAhead();
+  }
+  size_t offset =
+      sst_ptr_->ValueOffset(idx_) - sst_ptr_->ValueOffset(block_begin_);
+  return block_.substr(offset, ValueEnd(idx_) - sst_ptr_->ValueOffset(idx_));
+}
+
+/**
+ * @Description: Offset in the file past the value of an entry.
+ */
+size_t SSTableIterator::ValueEnd(const size_t idx) const {
+  return sst_ptr_->ValueEnd(idx);
+}
+
+/**
+ * @Description: Read the value under the cursor and the ones following it in
+ * the direction of the last move, within a single read of at most
+ * `readahead_` bytes. The read size doubles when the cursor just left the
+ * last block that way, and starts over otherwise.
+ */
+void SSTableIterator::ReadAhead() const {
+  // Values skipped by the merge, shadowed by newer entries, are not read, so
+  // the cursor may land a little past the last block.
+  const SSTable &sst = *sst_ptr_;
+  bool sequential =
+      forward_
+          ? block_end_ && idx_ >= block_end_ &&
+                sst.ValueOffset(idx_) - sst.ValueOffset(block_end_) <=
+                    readahead_
+          : idx_ < block_begin_ &&
+                ValueEnd(block_begin_ - 1) - ValueEnd(idx_) <= readahead_;
+  readahead_ = sequential ? std::min(readahead_ * 2, kMaxReadahead)
+                          : kInitialReadahead;
+
+  size_t begin = idx_;
+  size_t end = idx_ + 1;
+  if (forward_) {
+    while (end < sst_ptr_->num_keys_ &&
+           ValueEnd(end) - sst.ValueOffset(begin) <= readahead_) {
+      ++end;
+    }
+  } else {
+    while (begin > 0 &&
+           ValueEnd(idx_) - sst.ValueOffset(begin - 1) <= readahead_) {
+      --begin;
+    }
+  }
+
+  if (fd_ < 0) {
+    fd_ = IOBackend::Open(sst_ptr_->file_path_);
+  }
+  block_.resize(ValueEnd(end - 1) - sst.ValueOffset(begin));
+  std::vector<IORequest> requests;
+  IOBackend::AddRequests(fd_, sst.ValueOffset(begin), block_.size(),
+                         &block_[0], requests);
+  io_backend_->Read(requests);
+  IOBackend::CheckRead(requests, sst_ptr_->file_path_);
+  block_begin_ = begin;
+  block_end_ = end;
+}
+
+LevelIterator::LevelIterator(Level level, const SequenceNumber snapshot,
+                             IOBackend *io_backend)
+    : level_(std::move(level)),
+      kSnapshot(snapshot),
+      io_backend_(io_backend),
+      sst_idx_(0) {}
+
+void LevelIterator::SeekToFirst() {
+  OpenSST(0);
+  if (sst_it_) {
+    sst_it_->SeekToFirst();
+    SkipEmptySSTsForward();
+  }
+}
+
+void LevelIterator::SeekToLast() {
+  OpenSST(level_.size() - 1);
+  if (sst_it_) {
+    sst_it_->SeekToLast();
+    SkipEmptySSTsBackward();
+  }
+}
+
+/**
+ * @Description: Open the first SST whose max key is at least the target, and
+ * seek in it.
+ */
+void LevelIterator::Seek(const uint64_t target) {
+  auto sst_it = std::lower_bound(level_.begin(), level_.end(), target,
+                                 [](const SSTableSPtr &sst_ptr, uint64_t key) {
+                                   return sst_ptr->MaxKey() < key;
+                                 });
+  OpenSST(sst_it - level_.begin());
+  if (sst_it_) {
+    sst_it_->Seek(target);
+    SkipEmptySSTsForward();
+  }
+}
+
+/**
+ * @Description: Open the last SST whose min key is at most the target, and
+ * seek in it.
+ */
+void LevelIterator::SeekForPrev(const uint64_t target) {
+  auto sst_it = std::upper_bound(level_.begin(), level_.end(), target,
+                                 [](uint64_t key, const SSTableSPtr &sst_ptr) {
+                                   return key < sst_ptr->MinKey();
+                                 });
+  if (sst_it == level_.begin()) {
+    sst_it_.reset();
+    return;
+  }
+  OpenSST(sst_it - level_.begin() - 1);
+  sst_it_->SeekForPrev(target);
+  SkipEmptySSTsBackward();
+}
+
+void LevelIterator::Next() {
+  sst_it_->Next();
+  SkipEmptySSTsForward();
+}
+
+void LevelIterator::Prev() {
+  sst_it_->Prev();
+  SkipEmptySSTsBackward();
+}
+
+/**
+ * @Description: Put the cursor on an SST of the level, keeping the open one
+ * if it is the same. Closes it if the index is out of the level.
+ */
+void LevelIterator::OpenSST(const size_t idx) {
+  if (idx >= level_.size()) {
+    sst_it_.reset();
+    return;
+  }
+  if (!sst_it_ || sst_idx_ != idx) {
+    sst_idx_ = idx;
+    sst_it_.reset(new SSTableIterator(level_[idx], kSnapshot, io_backend_));
+  }
+}
+
+void LevelIterator::SkipEmptySSTsForward() {
+  while (sst_it_ && !sst_it_->Valid()) {
+    OpenSST(sst_idx_ + 1);
+    if (sst_it_) {
+      sst_it_->SeekToFirst();
+    }
+  }
+}
+
+void LevelIterator::SkipEmptySSTsBackward() {
+  while (sst_it_ && !sst_it_->Valid()) {
+    if (!sst_idx_) {
+      sst_it_.reset();
+      return;
+    }
+    OpenSST(sst_idx_ - 1);
+    sst_it_->SeekToLast();
+  }
+}
+
+MergingIterator::MergingIterator(
+    std::vector<std::unique_ptr<InternalIterator>> children,
+    RangeTombstoneListSPtr range_tombstones, const SequenceNumber snapshot,
+    const uint64_t first, const uint64_t last,
+    std::function<bool(const std::string &)> is_live,
+    std::function<std::string(uint64_t, SequenceNumber, const std::string &)>
+        user_value)
+    : children_(std::move(children)),
+      range_tombstones_(std::move(range_tombstones)),
+      kSnapshot(snapshot),
+      kFirst(first),
+      kLast(last),
+      kIsLive(std::move(is_live)),
+      kUserValue(std::move(user_value)),
+      current_(nullptr),
+      forward_(true) {}
+
+void MergingIterator::Seek(const uint64_t target) {
+  for (const auto &child : children_) {
+    child->Seek(std::max(target, kFirst));
+  }
+  forward_ = true;
+  FindForward();
+}
+
+void MergingIterator::SeekForPrev(const uint64_t target) {
+  for (const auto &child : children_) {
+    child->SeekForPrev(std::min(target, kLast));
+  }
+  forward_ = false;
+  FindBackward();
+}
+
+/**
+ * @Description: Move past the current key, in every child holding it.
+ */
+void MergingIterator::Next() {
+  uint64_t key = Key();
+  if (!forward_) {
+    // Children are behind the current key, bring them on or past it.
+    for (const auto &child : children_) {
+      child->Seek(key);
+    }
+    forward_ = true;
+  }
+  for (const auto &child : children_) {
+    if (child->Valid() && child->Key() == key) {
+      child->Next();
+    }
+  }
+  FindForward();
+}
+
+void MergingIterator::Prev() {
+  uint64_t key = Key();
+  if (forward_) {
+    for (const auto &child : children_) {
+      child->SeekForPrev(key);
+    }
+    forward_ = false;
+  }
+  for (const auto &child : children_) {
+    if (child->Valid() && child->Key() == key) {
+      child->Prev();
+    }
+  }
+  FindBackward();
+}
+
+/**
+ * @Description: Tell whether the entry under the cursor of a child is neither
+ * deleted by a range tombstone, nor a deletion mark, nor expired.
+ */
+bool MergingIterator::IsVisible(const InternalIterator &child) const {
+  return !range_tombstones_->Covers(child.Key(), child.Sequence(),
+                                    kSnapshot) &&
+         kIsLive(child.Value());
+}
+
+/**
+ * @Description: Settle on the least key of the children, skipping keys whose
+ * newest version is not visible. Of the versions of a key, the one of the
+ * greatest sequence number is the newest.
+ */
+void MergingIterator::FindForward() {
+  while (true) {
+    current_ = nullptr;
+    for (const auto &child : children_) {
+      if (child->Valid() &&
+          (!current_ || child->Key() < current_->Key() ||
+           (child->Key() == current_->Key() &&
+            child->Sequence() > current_->Sequence()))) {
+        current_ = child.get();
+      }
+    }
+    if (!current_ || current_->Key() > kLast) {
+      current_ = nullptr;
+      return;
+    }
+    if (IsVisible(*current_)) {
+      return;
+    }
+
+    uint64_t key = current_->Key();
+    for (const auto &child : children_) {
+      if (child->Valid() && child->Key() == key) {
+        child->Next();
+      }
+    }
+  }
+}
+
+/**
+ * @Description: Settle on the greatest key of the children, skipping keys
+ * whose newest version is not visible.
+ */
+void MergingIterator::FindBackward() {
+  while (true) {
+    current_ = nullptr;
+    for (const auto &child : children_) {
+      if (child->Valid() &&
+          (!current_ || child->Key() > current_->Key() ||
+           (child->Key() == current_->Key() &&
+            child->Sequence() > current_->Sequence()))) {
+        current_ = child.get();
+      }
+    }
+    if (!current_ || current_->Key() < kFirst) {
+      current_ = nullptr;
+      return;
+    }
+    if (IsVisible(*current_)) {
+      return;
+    }
+
+    uint64_t key = current_->Key();
+    for (const auto &child : children_) {
+      if (child->Valid() && child->Key() == key) {
+        child->Prev();
+      }
+    }
+  }
+}
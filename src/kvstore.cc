@@ -2,21 +2,74 @@
 
 #include <MacTypes.h>
 
+#include <ctime>
 #include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include <system_error>
+
+static const std::string kRangeTombstoneFile = "range_tombstones";
+
+static const std::string kLogFile = "LOG";
+
+static const std::string kPropertyPrefix = "lsm.";
+
+static const std::string kNumFilesAtLevelPrefix = "num-files-at-level";
 
 /**
  * @Description: Construct KVStore object with given base directory
  * @param dir: Base directory, where all SSTs are stored
+ * @param options: Tuning knobs of the store
  */
-KVStore::KVStore(const std::string &dir)
-    : KVStoreAPI(dir), kDir(dir), timestamp_(1), sst_no_(1) {
+KVStore::KVStore(const std::string &dir, const Options &options)
+    : KVStoreAPI(dir),
+      kDir(dir),
+      strategy_(options.compaction_strategy),
+      pick_policy_(options.compaction_pick_policy),
+      kTombstoneCompactionRatio(options.tombstone_compaction_ratio),
+      rate_limiter_(options.rate_limiter),
+      io_backend_(options.io_backend ? options.io_backend
+                                     : IOBackend::NewDefault()),
+      compaction_filter_(options.compaction_filter),
+      merge_operator_(options.merge_operator),
+      kTtl(options.ttl),
+      row_cache_(options.row_cache || !options.row_cache_capacity
+                     ? options.row_cache
+                     : std::make_shared<RowCache>(options.row_cache_capacity)),
+      statistics_(options.statistics ? options.statistics
+                                     : std::make_shared<Statistics>()),
+      kStatsDumpPeriodSec(options.stats_dump_period_sec),
+      event_log_(options.event_log),
+      timestamp_(1),
+      last_sequence_(0),
+      flushed_sequence_(0),
+      sst_no_(1),
+      write_controller_(options.level0_slowdown_writes_trigger,
+                        options.level0_stop_writes_trigger,
+                        options.soft_pending_compaction_bytes_limit,
+                        options.hard_pending_compaction_bytes_limit,
+                        options.delayed_write_rate),
+      pending_compaction_bytes_(0),
+      thread_pool_(options.thread_pool ? options.thread_pool
+                                       : std::make_shared<ThreadPool>(1)),
+      bg_scheduled_(false),
+      num_ingestions_waiting_(0),
+      shutting_down_(false) {
+  stats_.pick_policy = pick_policy_;
+
   // Create the directory first.
   if (!utils::DirExists(dir)) {
     utils::Mkdir(dir.c_str());
   }
 
   std::vector<std::string> level_list;
-  int num_level = utils::ScanDir(dir, level_list);
+  utils::ScanDir(dir, level_list);
+  level_list.erase(std::remove_if(level_list.begin(), level_list.end(),
+                                  [](const std::string &name) {
+                                    return name.compare(0, 6, "level-") != 0;
+                                  }),
+                   level_list.end());
+  int num_level = (int)level_list.size();
 
   std::sort(level_list.begin(), level_list.end());
 
@@ -39,7 +92,7 @@ KVStore::KVStore(const std::string &dir)
       std::string &file_name = file_list[j];
       size_t last_index = file_name.find_last_of('.');
       uint64_t file_sst_no = std::stoi(file_name.substr(0, last_index));
-      sst_no_ = file_sst_no >= sst_no_ ? file_sst_no + 1 : sst_no_;
+      sst_no_ = file_sst_no >= sst_no_ ? file_sst_no + 1 : sst_no_.load();
 
       auto sst_ptr =
           std::shared_ptr<SSTable>(SSTable::FromFile(level_name_with_slash + file_name));
@@ -48,32 +101,58 @@ KVStore::KVStore(const std::string &dir)
       if (sst_ptr->timestamp_ >= timestamp_) {
         timestamp_ = sst_ptr->timestamp_ + 1;
       }
+      last_sequence_ = std::max(last_sequence_, sst_ptr->max_seq_);
     }
 
-    // The first layer is unsorted, the rest is sorted by key range (disjoint).
-    if (i) {
-      sort(level_ptr->begin(), level_ptr->end(), SSTableComparatorForSort);
-    } else {
+    // Tiered levels are sorted by timestamp, the rest is sorted by key range
+    // (disjoint).
+    if (IsTiered(i)) {
       sort(level_ptr->begin(), level_ptr->end(), SSTableComparatorForSort0);
+    } else {
+      sort(level_ptr->begin(), level_ptr->end(), SSTableComparatorForSort);
     }
 
     ssts_[i] = level_ptr;
   }
-  Compaction();
+  range_tombstones_ = RangeTombstoneListSPtr(
+      RangeTombstoneList::FromFile(dir_with_slash + kRangeTombstoneFile));
+  last_sequence_ = std::max(last_sequence_, range_tombstones_->MaxSequence());
+  flushed_sequence_ = last_sequence_;
 #ifdef DEBUG
   cout << "========== Before  ==========" << endl;
   printSSTables();
 #endif
+
+  // Levels left overflowing by the last run are compacted in the background.
+  std::lock_guard<std::mutex> lock(mutex_);
+  InstallVersion();
+  UpdateWriteStall();
+  MaybeScheduleCompaction();
+  if (kStatsDumpPeriodSec) {
+    stats_dump_thread_ = std::thread([this] { DumpStats(); });
+  }
 }
 
 /**
- * @Description: Destruct `KVStore` object, write the content of memory to disk.
+ * @Description: Destruct `KVStore` object, write the content of memory to disk,
+ * and wait for the background compaction to finish the pending compactions.
  */
 KVStore::~KVStore() {
-  if (!mem_table_.IsEmpty()) {
-    SSTableSPtr sst = mem_table_.ToFile(timestamp_, sst_no_++, kDir);
-    ssts_[0]->emplace_back(sst);
-    Compaction();
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    shutting_down_ = true;
+    stats_dump_cv_.notify_all();
+    if (!mem_table_.IsEmpty()) {
+      Flush();
+    }
+    bg_done_cv_.wait(lock, [this] { return !bg_scheduled_; });
+  }
+  if (stats_dump_thread_.joinable()) {
+    stats_dump_thread_.join();
+  }
+
+  if (rate_limiter_) {
+    rate_limiter_->ReportPendingCompactionBytes(this, 0);
   }
 }
 
@@ -84,21 +163,10 @@ KVStore::~KVStore() {
  * @param s: Value in the key-value pair.
  */
 void KVStore::Put(const uint64_t key, const std::string &s) {
-  try {
-    mem_table_.Put(key, s);
-  } catch (const MemTableFull &) {
-    SSTableSPtr ssTablePtr = mem_table_.ToFile(timestamp_, sst_no_++, kDir);
-    ++timestamp_;
-#ifdef DEBUG
-    cout << "========== MEM TO DISK ==========" << endl;
-    cout << *ssTablePtr << endl;
-#endif
-    mem_table_.Reset();
-    mem_table_.Put(key, s);
-
-    ssts_[0]->emplace_back(ssTablePtr);
-    Compaction();
-  }
+  StopWatch stop_watch(statistics_.get(), Statistics::kPutMicros);
+  std::unique_lock<std::mutex> lock(mutex_);
+  DelayWrite(lock, sizeof(key) + s.size());
+  Write(key, kTtl ? AppendWriteTime(s) : s);
 }
 
 /**
@@ -107,39 +175,175 @@ void KVStore::Put(const uint64_t key, const std::string &s) {
  * @return: the (string) value of the given key. Empty string indicates not
  * found.
  */
-std::string KVStore::Get(uint64_t key) {
-  std::string *value_in_mem = mem_table_.Get(key);
-  if (value_in_mem) {
-    return *value_in_mem == kDeletionMark ? "" : *value_in_mem;
+std::string KVStore::Get(uint64_t key) { return Get(key, nullptr); }
+
+/**
+ * @Description: Find in KVStore by key as of a snapshot. Only the mem table is
+ * searched with the lock held; then the row cache, for reads of the newest
+ * values, and SSTs in the current version. A merge entry found is resolved
+ * through the older versions of the key.
+ * @param key: The key to find with
+ * @param snapshot: The snapshot to read at, `nullptr` to read the newest
+ * values.
+ * @return: the (string) value of the given key. Empty string indicates not
+ * found.
+ */
+std::string KVStore::Get(uint64_t key, const Snapshot *snapshot) {
+  StopWatch stop_watch(statistics_.get(), Statistics::kGetMicros);
+  SequenceNumber snapshot_seq =
+      snapshot ? snapshot->Sequence() : kMaxSequenceNumber;
+  std::shared_ptr<std::string> val_ptr;
+  bool in_mem_table;
+  SequenceNumber seq;
+  PendingMerge merge{key, {}, 0, nullptr};
+  SequenceNumber last_sequence;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    in_mem_table = LookupMemTable(key, snapshot_seq, &val_ptr, &seq);
+    statistics_->Record(in_mem_table ? Statistics::kMemTableHits
+                                     : Statistics::kMemTableMisses);
+    if (in_mem_table && val_ptr && IsLive(*val_ptr) &&
+        IsMergeEntry(*val_ptr)) {
+      merge = PendingMerge{key, {*val_ptr}, seq, nullptr};
+      ResolveMergeInMemTable(merge);
+    }
+    last_sequence = last_sequence_;
+  }
+  if (!merge.entries.empty()) {
+    if (!merge.value) {
+      ResolveMerge(*CurrentVersion(), merge);
+    }
+    val_ptr = merge.value;
   }
 
-  // Not found in mem table, search in SST.
-  for (const LevelSPtr &level_ptr : ssts_) {
-    if (level_ptr == *ssts_.begin()) {
-      // Sequential search in level-0.
-      for (auto sst_rit = level_ptr->rbegin(); sst_rit != level_ptr->rend();
-           ++sst_rit) {
-        // Search a pointer in a `SSTable`. Return `nullptr` if not found.
-        SSTableSPtr sst_ptr = *sst_rit;
-        std::shared_ptr<std::string> val_ptr = sst_ptr->ValueByKey(key);
-        if (val_ptr) {
-          std::string value = *val_ptr;
-          return (value == kDeletionMark) ? "" : value;
-        }
+  bool use_row_cache = row_cache_ && !snapshot;
+  if (!in_mem_table && use_row_cache) {
+    val_ptr = row_cache_->Lookup(key);
+    statistics_->Record(val_ptr ? Statistics::kRowCacheHits
+                                : Statistics::kRowCacheMisses);
+  }
+  // A flush of the mem table installs its SST before the lock is released,
+  // so the version loaded after it holds whatever the mem table missed.
+  if (!in_mem_table && !val_ptr) {
+    VersionSPtr version = CurrentVersion();
+    val_ptr = Lookup(*version, key, snapshot_seq, &seq);
+    val_ptr = ResolveMerge(*version, key, seq, val_ptr);
+    if (val_ptr && use_row_cache) {
+      // The value is still the newest only if nothing was written, flushed or
+      // compacted since the mem table was searched.
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (last_sequence_ == last_sequence && CurrentVersion() == version) {
+        row_cache_->Insert(key, val_ptr);
       }
+    }
+  }
+  if (val_ptr) {
+    return IsLive(*val_ptr) ? UserValue(*val_ptr) : "";
+  }
+  return "";
+}
+
+/**
+ * @Description: Find in KVStore by many keys at once. Keys are looked up in
+ * ascending order, level by level, and those falling in the same SST are
+ * looked up together, so every SST is searched and read at most once. The
+ * lookups in the mem table and in the index of an SST are interleaved.
+ * @param keys: The keys to find with, in any order.
+ * @param snapshot: The snapshot to read at, `nullptr` to read the newest
+ * values.
+ * @return: The (string) values of the keys, in the order of the keys. Empty
+ * strings indicate not found.
+ */
+std::vector<std::string> KVStore::MultiGet(const std::vector<uint64_t> &keys,
+                                           const Snapshot *snapshot) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  std::vector<std::string> ret(keys.size());
+  SequenceNumber snapshot_seq =
+      snapshot ? snapshot->Sequence() : kMaxSequenceNumber;
+
+  std::vector<size_t> sorted(keys.size());
+  std::iota(sorted.begin(), sorted.end(), 0);
+  std::sort(sorted.begin(), sorted.end(),
+            [&keys](size_t i, size_t j) { return keys[i] < keys[j]; });
+
+  std::vector<uint64_t> sorted_keys(keys.size());
+  for (size_t i = 0; i < sorted.size(); ++i) {
+    sorted_keys[i] = keys[sorted[i]];
+  }
+  std::vector<const std::string *> values_in_mem(keys.size());
+  std::vector<SequenceNumber> seqs(keys.size());
+  mem_table_.Get(sorted_keys.data(), sorted_keys.size(), snapshot_seq,
+                 values_in_mem.data(), seqs.data());
+
+  // Positions of the keys not found yet, in ascending order of key.
+  std::vector<size_t> pending;
+  // Merge entries found, with the positions of their keys.
+  std::vector<std::pair<size_t, PendingMerge>> merges;
+  for (size_t i = 0; i < sorted.size(); ++i) {
+    size_t pos = sorted[i];
+    SequenceNumber seq = seqs[i];
+    const std::string *value_in_mem = values_in_mem[i];
+    if (!value_in_mem) {
+      pending.push_back(pos);
+    } else if (range_tombstones_->Covers(keys[pos], seq, snapshot_seq) ||
+               !IsLive(*value_in_mem)) {
+      continue;
+    } else if (IsMergeEntry(*value_in_mem)) {
+      merges.emplace_back(
+          pos, PendingMerge{keys[pos], {*value_in_mem}, seq, nullptr});
+      ResolveMergeInMemTable(merges.back().second);
     } else {
-      // For other levels, do binary search.
-      SSTableSPtr sst_ptr = BinarySearch(level_ptr, key);
-      if (sst_ptr) {
-        std::shared_ptr<std::string> val_ptr = sst_ptr->ValueByKey(key);
-        if (val_ptr) {
-          std::string value = *val_ptr;
-          return value == kDeletionMark ? "" : value;
-        }
+      ret[pos] = UserValue(*value_in_mem);
+    }
+  }
+  lock.unlock();
+  statistics_->Record(Statistics::kMemTableHits, keys.size() - pending.size());
+  statistics_->Record(Statistics::kMemTableMisses, pending.size());
+
+  VersionSPtr version = CurrentVersion();
+  for (auto &pos_and_merge : merges) {
+    PendingMerge &merge = pos_and_merge.second;
+    if (!merge.value) {
+      ResolveMerge(*version, merge);
+    }
+    ret[pos_and_merge.first] = UserValue(*merge.value);
+  }
+
+  size_t num_levels = version->levels.size();
+  for (size_t i = 0; i < num_levels && !pending.empty(); ++i) {
+    const LevelSPtr &level_ptr = version->levels[i];
+    if (strategy_->IsTiered(i, num_levels)) {
+      // Newest SST first in tiered levels.
+      for (auto sst_rit = level_ptr->rbegin();
+           sst_rit != level_ptr->rend() && !pending.empty(); ++sst_rit) {
+        MultiGetFromSST(*version, *sst_rit, keys, snapshot_seq, pending, ret);
       }
+      continue;
     }
+
+    // The keys of an SST of a leveled level follow each other in `pending`.
+    std::vector<size_t> next_pending;
+    size_t begin = 0;
+    while (begin < pending.size()) {
+      SSTableSPtr sst_ptr = BinarySearch(level_ptr, keys[pending[begin]]);
+      if (!sst_ptr) {
+        next_pending.push_back(pending[begin++]);
+        continue;
+      }
+
+      size_t end = begin + 1;
+      while (end < pending.size() && keys[pending[end]] <= sst_ptr->max_key_) {
+        ++end;
+      }
+      std::vector<size_t> group(pending.begin() + (long)begin,
+                                pending.begin() + (long)end);
+      MultiGetFromSST(*version, sst_ptr, keys, snapshot_seq, group, ret);
+      next_pending.insert(next_pending.end(), group.begin(), group.end());
+      begin = end;
+    }
+    pending.swap(next_pending);
   }
-  return "";
+  return ret;
 }
 
 /**
@@ -148,70 +352,1114 @@ std::string KVStore::Get(uint64_t key) {
  * @return: `false` iff the key is not found.
  */
 bool KVStore::Del(uint64_t key) {
-  // TODO: decouple deletion mark.
-  // Find in mem table to see if the key is already deleted.
-  bool is_in_memory = mem_table_.Del(key);
-  bool is_deleted_in_memory = mem_table_.Get(key) != nullptr;
+  StopWatch stop_watch(statistics_.get(), Statistics::kDelMicros);
+  std::unique_lock<std::mutex> lock(mutex_);
+  DelayWrite(lock, sizeof(key) + kDeletionMark.size());
+
+  // Look the key up to see if it is already deleted. SSTs are searched in the
+  // pinned version without the lock, as in `Get`. Writes made meanwhile go to
+  // the mem table, which is searched again; a flush, compaction or ingestion
+  // installs a new version, which is searched again.
+  std::shared_ptr<std::string> val_ptr;
+  VersionSPtr version;
+  while (!LookupMemTable(key, kMaxSequenceNumber, &val_ptr) &&
+         CurrentVersion() != version) {
+    version = CurrentVersion();
+    lock.unlock();
+    val_ptr = Lookup(*version, key, kMaxSequenceNumber);
+    lock.lock();
+  }
+  bool ret = val_ptr && IsLive(*val_ptr);
+
   // Insert deletion mark.
-  Put(key, kDeletionMark);
-  if (is_in_memory) {
+  Write(key, kDeletionMark);
+  return ret;
+}
+
+/**
+ * @Description: Delete all key-value pairs in [begin, end) with a single range
+ * tombstone, instead of a deletion mark per key.
+ * @param begin: First key of the range.
+ * @param end: Key past the range.
+ */
+void KVStore::DeleteRange(const uint64_t begin, const uint64_t end) {
+  if (begin >= end) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  DelayWrite(lock, sizeof(begin) + sizeof(end));
+
+  // The tombstone covers the writes before it, in the mem table as well as on
+  // disk, and none of the writes after it.
+  auto range_tombstones =
+      std::make_shared<RangeTombstoneList>(*range_tombstones_);
+  range_tombstones->Add(begin, end, ++last_sequence_);
+  range_tombstones->ToFile(kDir + "/" + kRangeTombstoneFile);
+  range_tombstones_ = range_tombstones;
+  InstallVersion();
+  if (row_cache_) {
+    row_cache_->EraseRange(begin, end);
+  }
+}
+
+/**
+ * @Description: Apply an operand to the value of a key, without reading the
+ * value. The operand is folded into the newest version of the key in the mem
+ * table if that version is replaced anyway; else it is written on its own, and
+ * combined with the older versions by reads and by compaction.
+ * @param key: The key to merge into.
+ * @param operand: The operand, passed to the merge operator.
+ */
+void KVStore::Merge(const uint64_t key, const std::string &operand) {
+  if (!merge_operator_) {
+    throw std::logic_error("KVStore::Merge: no merge operator");
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  DelayWrite(lock, sizeof(key) + operand.size());
+
+  bool folded;
+  std::string stored = FoldMergeOperand(key, operand, &folded);
+  // The version folded in must not be flushed apart from the result, or reads
+  // would apply its operands twice.
+  if (folded && mem_table_.FileSize() + kIndexSizePerValue + stored.size() >
+                    kMaxSSTableSize) {
+    Flush();
+    stored = FoldMergeOperand(key, operand, &folded);
+  }
+  Write(key, stored);
+}
+
+/**
+ * @Description: Move SSTs built offline into the store, without rewriting
+ * their values. The files form one run, newer than every write before, placed
+ * in the lowest level it can go to without overlapping newer data.
+ * @param file_paths: Paths to the SSTs, which are moved away.
+ */
+void KVStore::IngestExternalFile(const std::vector<std::string> &file_paths) {
+  std::vector<SSTableSPtr> ssts;
+  for (const std::string &file_path : file_paths) {
+    if (!std::ifstream(file_path).good()) {
+      throw std::invalid_argument("IngestExternalFile: cannot open " +
+                                  file_path);
+    }
+    SSTableSPtr sst_ptr(SSTable::FromFile(file_path));
+    if (sst_ptr->num_keys_) {
+      ssts.emplace_back(sst_ptr);
+    }
+  }
+  sort(ssts.begin(), ssts.end(), SSTableComparatorForSort);
+  for (size_t i = 1; i < ssts.size(); ++i) {
+    if (ssts[i - 1]->max_key_ >= ssts[i]->min_key_) {
+      throw std::invalid_argument("IngestExternalFile: files overlap");
+    }
+  }
+  if (ssts.empty()) {
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  // Levels below level-0 are only changed by the background compaction, which
+  // is not scheduled again meanwhile, or a steady stream of writes could keep
+  // it busy for good.
+  ++num_ingestions_waiting_;
+  bg_done_cv_.wait(lock, [this] { return !bg_scheduled_; });
+  --num_ingestions_waiting_;
+  // Writes in the mem table are older than the files, so they must not shadow
+  // them. The lock is held from here until the files get their sequence
+  // number, so no write can slip in between; a compaction the flush schedules
+  // cannot start before the lock is released either.
+  for (const SSTableSPtr &sst_ptr : ssts) {
+    if (mem_table_.HasKeyInRange(sst_ptr->min_key_, sst_ptr->max_key_)) {
+      Flush();
+      break;
+    }
+  }
+
+  size_t level = LevelForIngestion(ssts);
+  SequenceNumber seq = ++last_sequence_;
+  LevelSPtr level_ptr = std::make_shared<Level>(*ssts_[level]);
+  for (const SSTableSPtr &sst_ptr : ssts) {
+    sst_ptr->Ingest(kDir + "/level-" + std::to_string(level) + "/" +
+                        std::to_string(sst_no_++) + ".sst",
+                    timestamp_, seq);
+    stats_.bytes_ingested += sst_ptr->file_size_;
+    statistics_->Record(Statistics::kBytesIngested, sst_ptr->file_size_);
+    level_ptr->emplace_back(sst_ptr);
+  }
+  ++timestamp_;
+  if (IsTiered(level)) {
+    sort(level_ptr->begin(), level_ptr->end(), SSTableComparatorForSort0);
+  } else {
+    sort(level_ptr->begin(), level_ptr->end(), SSTableComparatorForSort);
+  }
+  ssts_[level] = level_ptr;
+  InstallVersion();
+  if (row_cache_) {
+    row_cache_->Clear();
+  }
+  UpdateWriteStall();
+  MaybeScheduleCompaction();
+}
+
+std::unique_ptr<Iterator> KVStore::NewIterator(const Snapshot *snapshot) {
+  return NewIterator(0, std::numeric_limits<uint64_t>::max(),
+                     snapshot ? snapshot->Sequence() : kMaxSequenceNumber);
+}
+
+/**
+ * @Description: Collect the live key-value pairs in [begin, end).
+ * @param begin: First key of the range.
+ * @param end: Key past the range.
+ * @param snapshot: The snapshot to read at, `nullptr` to read the newest
+ * values.
+ * @return: The pairs in ascending order of key.
+ */
+std::vector<std::pair<uint64_t, std::string>> KVStore::Scan(
+    const uint64_t begin, const uint64_t end, const Snapshot *snapshot) {
+  std::vector<std::pair<uint64_t, std::string>> ret;
+  if (begin >= end) {
+    return ret;
+  }
+
+  std::unique_ptr<Iterator> it =
+      NewIterator(begin, end - 1,
+                  snapshot ? snapshot->Sequence() : kMaxSequenceNumber);
+  for (it->SeekToFirst(); it->Valid(); it->Next()) {
+    ret.emplace_back(it->Key(), it->Value());
+  }
+  return ret;
+}
+
+/**
+ * @Description: Take a snapshot of the store as of the last write.
+ * @return: The snapshot, to be released with `ReleaseSnapshot`.
+ */
+const Snapshot *KVStore::GetSnapshot() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  snapshots_.insert(last_sequence_);
+  return new Snapshot(last_sequence_);
+}
+
+/**
+ * @Description: Release a snapshot, letting compaction drop the versions only
+ * it could read.
+ * @param snapshot: A snapshot taken by `GetSnapshot`, which is freed.
+ */
+void KVStore::ReleaseSnapshot(const Snapshot *snapshot) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    snapshots_.erase(snapshots_.find(snapshot->Sequence()));
+  }
+  delete snapshot;
+}
+
+/**
+ * @Description: Describe the state of the store.
+ * @param property: The name of the property, see the header.
+ * @param value: Set to the value of the property, if it is known.
+ * @return: `false` iff the property is unknown.
+ */
+bool KVStore::GetProperty(const std::string &property, std::string *value) {
+  if (property.compare(0, kPropertyPrefix.size(), kPropertyPrefix) != 0) {
+    return false;
+  }
+  std::string name = property.substr(kPropertyPrefix.size());
+  VersionSPtr version = CurrentVersion();
+  size_t num_levels = version->levels.size();
+
+  if (name.compare(0, kNumFilesAtLevelPrefix.size(), kNumFilesAtLevelPrefix) ==
+      0) {
+    std::string level = name.substr(kNumFilesAtLevelPrefix.size());
+    if (level.empty() ||
+        level.find_first_not_of("0123456789") != std::string::npos) {
+      return false;
+    }
+    size_t i = std::stoul(level);
+    *value = std::to_string(i < num_levels ? version->levels[i]->size() : 0);
+  } else if (name == "total-sst-files-size") {
+    size_t total = 0;
+    for (const LevelSPtr &level_ptr : version->levels) {
+      for (const SSTableSPtr &sst_ptr : *level_ptr) {
+        total += sst_ptr->file_size_;
+      }
+    }
+    *value = std::to_string(total);
+  } else if (name == "estimate-table-readers-mem") {
+    size_t total = 0;
+    for (const LevelSPtr &level_ptr : version->levels) {
+      for (const SSTableSPtr &sst_ptr : *level_ptr) {
+        total += sst_ptr->IndexMemoryUsage();
+      }
+    }
+    *value = std::to_string(total);
+  } else if (name == "cur-size-active-mem-table") {
+    std::lock_guard<std::mutex> lock(mutex_);
+    *value = std::to_string(mem_table_.FileSize());
+  } else if (name == "write-amplification") {
+    *value = std::to_string(stats_.WriteAmplification());
+  } else if (name == "estimate-pending-compaction-bytes") {
+    *value = std::to_string(pending_compaction_bytes_);
+  } else if (name == "num-snapshots") {
+    std::lock_guard<std::mutex> lock(mutex_);
+    *value = std::to_string(snapshots_.size());
+  } else if (name == "stats") {
+    std::string out;
+    for (size_t i = 0; i < num_levels; ++i) {
+      size_t bytes = 0;
+      for (const SSTableSPtr &sst_ptr : *version->levels[i]) {
+        bytes += sst_ptr->file_size_;
+      }
+      out += "level " + std::to_string(i) + ": " +
+             std::to_string(version->levels[i]->size()) + " files, " +
+             std::to_string(bytes) + " bytes\n";
+    }
+    out += "compactions: " + std::to_string(stats_.num_compactions) + "\n";
+    out += "write amplification: " +
+           std::to_string(stats_.WriteAmplification()) + "\n";
+    out += "pending compaction bytes: " +
+           std::to_string(pending_compaction_bytes_) + "\n";
+    out += "write stalls: " + std::to_string(stats_.num_write_stalls) + "\n";
+    *value = out + statistics_->ToString();
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @Description: Append the `lsm.stats` property to the log file of the store
+ * every `kStatsDumpPeriodSec` seconds, until the store is closing. Runs on a
+ * thread of its own.
+ */
+void KVStore::DumpStats() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stats_dump_cv_.wait_for(lock,
+                                  std::chrono::seconds(kStatsDumpPeriodSec),
+                                  [this] { return shutting_down_; })) {
+    lock.unlock();
+    std::string stats;
+    GetProperty(kPropertyPrefix + "stats", &stats);
+    std::ofstream log(kDir + "/" + kLogFile, std::ios::app);
+    log << "** Stats at " << std::time(nullptr) << " **\n" << stats << std::endl;
+    lock.lock();
+  }
+}
+
+/**
+ * @Description: Resets the kvstore. All key-value pairs should be removed,
+ *               including mem table and all SST files.
+ */
+void KVStore::Reset() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  // A running compaction would install its result into the new levels.
+  bg_done_cv_.wait(lock, [this] { return !bg_scheduled_; });
+
+  mem_table_.Reset();
+  compact_cursor_.clear();
+  ssts_.clear();
+  ssts_.emplace_back(std::make_shared<Level>());
+  range_tombstones_ = std::make_shared<RangeTombstoneList>();
+  InstallVersion();
+  if (row_cache_) {
+    row_cache_->Clear();
+  }
+  utils::Rmfile((kDir + "/" + kRangeTombstoneFile).c_str());
+
+  // Remove all SST files.
+  std::vector<std::string> level_list;
+  utils::ScanDir(kDir, level_list);
+  level_list.erase(std::remove_if(level_list.begin(), level_list.end(),
+                                  [](const std::string &name) {
+                                    return name.compare(0, 6, "level-") != 0;
+                                  }),
+                   level_list.end());
+  int num_level = (int)level_list.size();
+  std::string dir_with_slash = kDir + "/";
+  for (int i = 0; i < num_level; ++i) {
+    std::vector<std::string> file_list;
+    utils::ScanDir(dir_with_slash + level_list[i], file_list);
+
+    std::string level_name_with_slash = dir_with_slash + level_list[i] + "/";
+    for (std::string &file_name : file_list) {
+      utils::Rmfile((level_name_with_slash + file_name).c_str());
+    }
+
+    utils::Rmdir((dir_with_slash + level_list[i]).c_str());
+  }
+  UpdateWriteStall();
+}
+
+/**
+ * @Description: Collect the live key-value pairs in [first, last], to move
+ * them to another store.
+ * @param first: First key of the range.
+ * @param last: Last key of the range.
+ * @return: The pairs in ascending order of key, values as they are stored.
+ */
+std::vector<std::pair<uint64_t, std::string>> KVStore::ExportRange(
+    const uint64_t first, const uint64_t last) {
+  std::vector<std::pair<uint64_t, std::string>> ret;
+  std::unique_ptr<Iterator> it =
+      NewIterator(first, last, kMaxSequenceNumber, true);
+  for (it->SeekToFirst(); it->Valid(); it->Next()) {
+    ret.emplace_back(it->Key(), it->Value());
+  }
+  return ret;
+}
+
+/**
+ * @Description: Write key-value pairs exported from another store, and flush
+ * them, since they were on disk already.
+ * @param entries: The pairs, values as they are stored.
+ */
+void KVStore::ImportRange(
+    const std::vector<std::pair<uint64_t, std::string>> &entries) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (const auto &key_and_value : entries) {
+    Write(key_and_value.first, key_and_value.second);
+  }
+  if (!mem_table_.IsEmpty()) {
+    Flush();
+  }
+}
+
+/**
+ * @Description: Snapshot the sources of the store into an iterator over
+ * [first, last]: the mem table, every SST of tiered levels of the current
+ * version, and one iterator per leveled level. SSTs without a key in the range
+ * are left out, and so are levels left without SSTs, so that a short scan over
+ * an empty range merges nothing. SST files stay around while the iterator
+ * refers to them, even if compacted away. Merge entries of the mem table are
+ * resolved up front, while the older versions they need are at hand.
+ * @param first: First key of the range.
+ * @param last: Last key of the range.
+ * @param snapshot: Sequence number to read at.
+ * @param stored_values: Whether values come out as they are stored, rather
+ * than as they were written.
+ */
+std::unique_ptr<Iterator> KVStore::NewIterator(const uint64_t first,
+                                               const uint64_t last,
+                                               const SequenceNumber snapshot,
+                                               const bool stored_values) {
+  std::vector<std::unique_ptr<InternalIterator>> children;
+
+  std::vector<MemTableEntry> mem_entries;
+  // Merge entries of the mem table, with their positions in it.
+  std::vector<std::pair<size_t, PendingMerge>> merges;
+  if (first <= last) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    mem_entries = mem_table_.Entries(first, last, snapshot);
+    for (size_t i = 0; i < mem_entries.size(); ++i) {
+      const MemTableEntry &entry = mem_entries[i];
+      if (IsLive(entry.value) && IsMergeEntry(entry.value) &&
+          !range_tombstones_->Covers(entry.key, entry.seq, snapshot)) {
+        merges.emplace_back(
+            i, PendingMerge{entry.key, {entry.value}, entry.seq, nullptr});
+        ResolveMergeInMemTable(merges.back().second);
+      }
+    }
+  }
+
+  VersionSPtr version = CurrentVersion();
+  for (auto &pos_and_merge : merges) {
+    PendingMerge &merge = pos_and_merge.second;
+    if (!merge.value) {
+      ResolveMerge(*version, merge);
+    }
+    mem_entries[pos_and_merge.first].value = *merge.value;
+  }
+  children.emplace_back(new VectorIterator(std::move(mem_entries)));
+
+  size_t num_levels = version->levels.size();
+  for (size_t i = 0; i < num_levels; ++i) {
+    const LevelSPtr &level_ptr = version->levels[i];
+    if (!strategy_->IsTiered(i, num_levels)) {
+      Level in_range;
+      for (long j = LowerBound(level_ptr, first);
+           j < (long)level_ptr->size() && (*level_ptr)[j]->min_key_ <= last;
+           ++j) {
+        if ((*level_ptr)[j]->HasKeyInRange(first, last)) {
+          in_range.emplace_back((*level_ptr)[j]);
+        }
+      }
+      if (!in_range.empty()) {
+        children.emplace_back(new LevelIterator(std::move(in_range), snapshot,
+                                                io_backend_.get()));
+      }
+      continue;
+    }
+    for (auto sst_rit = level_ptr->rbegin(); sst_rit != level_ptr->rend();
+         ++sst_rit) {
+      if ((*sst_rit)->HasKeyInRange(first, last)) {
+        children.emplace_back(
+            new SSTableIterator(*sst_rit, snapshot, io_backend_.get()));
+      }
+    }
+  }
+
+  // Merge entries of the mem table are resolved already, those of SSTs are
+  // resolved as they come out.
+  std::function<std::string(uint64_t, SequenceNumber, const std::string &)>
+      user_value = [this, version, stored_values](
+                       const uint64_t key, const SequenceNumber seq,
+                       const std::string &stored) {
+        if (!IsLive(stored) || !IsMergeEntry(stored)) {
+          return stored_values ? stored : UserValue(stored);
+        }
+        StringSPtr value = ResolveMerge(
+            *version, key, seq, std::make_shared<std::string>(stored));
+        return stored_values ? *value : UserValue(*value);
+      };
+  return std::unique_ptr<Iterator>(new MergingIterator(
+      std::move(children), version->range_tombstones, snapshot, first, last,
+      [this](const std::string &stored) { return IsLive(stored); },
+      user_value));
+}
+
+/**
+ * @Description: Append the current time to a value, for TTL expiry.
+ */
+std::string KVStore::AppendWriteTime(const std::string &s) {
+  uint64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+                     std::chrono::system_clock::now().time_since_epoch())
+                     .count();
+  std::string ret = s;
+  ret.append((const char *)&now, sizeof(now));
+  return ret;
+}
+
+/**
+ * @Description: Tell whether a stored value is neither a deletion mark nor
+ * expired.
+ */
+bool KVStore::IsLive(const std::string &stored) const {
+  if (stored == kDeletionMark) {
+    return false;
+  }
+  if (!kTtl || stored.size() < sizeof(uint64_t)) {
+    return true;
+  }
+
+  uint64_t write_time;
+  memcpy(&write_time, stored.data() + stored.size() - sizeof(write_time),
+         sizeof(write_time));
+  uint64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+                     std::chrono::system_clock::now().time_since_epoch())
+                     .count();
+  return now < write_time + kTtl;
+}
+
+/**
+ * @Description: Strip the write time off a stored value, if any.
+ */
+std::string KVStore::UserValue(const std::string &stored) const {
+  if (!kTtl || stored.size() < sizeof(uint64_t)) {
+    return stored;
+  }
+  return stored.substr(0, stored.size() - sizeof(uint64_t));
+}
+
+/**
+ * @Description: Give a value the write time of a stored one, if any.
+ */
+std::string KVStore::KeepWriteTime(const std::string &s,
+                                   const std::string &stored) const {
+  if (!kTtl || stored.size() < sizeof(uint64_t)) {
+    return s;
+  }
+  std::string ret = s;
+  ret.append(stored, stored.size() - sizeof(uint64_t), sizeof(uint64_t));
+  return ret;
+}
+
+/**
+ * @Description: Tell whether a stored value holds merge operands rather than a
+ * value. It may be expired all the same.
+ */
+bool KVStore::IsMergeEntry(const std::string &stored) {
+  return stored.compare(0, kMergeMark.size(), kMergeMark) == 0;
+}
+
+/**
+ * @Description: Encode merge operands as a merge entry: the merge mark, then
+ * the length and the bytes of each operand.
+ * @param operands: The operands, oldest first.
+ */
+std::string KVStore::EncodeMergeEntry(
+    const std::vector<std::string> &operands) {
+  std::string ret = kMergeMark;
+  for (const std::string &operand : operands) {
+    uint32_t size = (uint32_t)operand.size();
+    ret.append((const char *)&size, sizeof(size));
+    ret.append(operand);
+  }
+  return ret;
+}
+
+/**
+ * @Description: Decode the operands of a stored merge entry, oldest first.
+ */
+std::vector<std::string> KVStore::MergeOperands(
+    const std::string &stored) const {
+  std::string entry = UserValue(stored);
+  std::vector<std::string> ret;
+  size_t pos = kMergeMark.size();
+  while (pos + sizeof(uint32_t) <= entry.size()) {
+    uint32_t size;
+    memcpy(&size, entry.data() + pos, sizeof(size));
+    pos += sizeof(size);
+    ret.emplace_back(entry, pos, size);
+    pos += size;
+  }
+  return ret;
+}
+
+/**
+ * @Description: Apply merge operands to a value with the merge operator.
+ * @param key: The key of the value.
+ * @param base: The value, as it was written, or `nullptr` if there is none.
+ * @param operands: The operands, oldest first.
+ * @return: The value, as it is written.
+ */
+std::string KVStore::FullMerge(const uint64_t key, const std::string *base,
+                               const std::vector<std::string> &operands) const {
+  if (!merge_operator_) {
+    throw std::logic_error("KVStore: merge entries without a merge operator");
+  }
+  return merge_operator_->FullMerge(key, base, operands);
+}
+
+/**
+ * @Description: Build the stored value a merge writes. The operand is folded
+ * into the newest version of the key in the mem table, unless a snapshot reads
+ * that version, which thus stays. The lock must be held.
+ * @param key: The key to merge into.
+ * @param operand: The operand.
+ * @param folded: Set to whether a version was folded in.
+ * @return: A merge entry, or a value if the version folded in is one.
+ */
+std::string KVStore::FoldMergeOperand(const uint64_t key,
+                                      const std::string &operand,
+                                      bool *folded) const {
+  SequenceNumber seq;
+  const std::string *newest = mem_table_.Get(key, kMaxSequenceNumber, &seq);
+  SequenceNumber newest_snapshot =
+      snapshots_.empty() ? 0 : *snapshots_.rbegin();
+  *folded = newest && seq > newest_snapshot;
+
+  std::string ret;
+  if (!*folded) {
+    ret = EncodeMergeEntry({operand});
+  } else if (range_tombstones_->Covers(key, seq, kMaxSequenceNumber) ||
+             !IsLive(*newest)) {
+    ret = FullMerge(key, nullptr, {operand});
+  } else if (IsMergeEntry(*newest)) {
+    std::vector<std::string> operands = MergeOperands(*newest);
+    operands.push_back(operand);
+    ret = EncodeMergeEntry(operands);
+  } else {
+    std::string base = UserValue(*newest);
+    ret = FullMerge(key, &base, {operand});
+  }
+  return kTtl ? AppendWriteTime(ret) : ret;
+}
+
+/**
+ * @Description: Take the next older version of the key of a pending merge:
+ * collect it if it is a merge entry too, else resolve the merge on it.
+ * @param merge: The pending merge.
+ * @param value: The stored version, `nullptr` if there is none or if it is
+ * deleted by a range tombstone.
+ * @param seq: The sequence number of the version.
+ */
+void KVStore::AddToMerge(PendingMerge &merge, const StringSPtr &value,
+                         const SequenceNumber seq) const {
+  bool live = value && IsLive(*value);
+  if (live && IsMergeEntry(*value)) {
+    merge.entries.push_back(*value);
+    merge.seq = seq;
+    return;
+  }
+
+  std::vector<std::string> operands;
+  for (auto it = merge.entries.rbegin(); it != merge.entries.rend(); ++it) {
+    std::vector<std::string> entry_operands = MergeOperands(*it);
+    operands.insert(operands.end(), entry_operands.begin(),
+                    entry_operands.end());
+  }
+  std::string base = live ? UserValue(*value) : "";
+  merge.value = std::make_shared<std::string>(
+      KeepWriteTime(FullMerge(merge.key, live ? &base : nullptr, operands),
+                    merge.entries.front()));
+}
+
+/**
+ * @Description: Go on with a pending merge through the older versions of its
+ * key in the mem table. The lock must be held.
+ */
+void KVStore::ResolveMergeInMemTable(PendingMerge &merge) const {
+  StringSPtr value;
+  SequenceNumber seq;
+  while (!merge.value &&
+         LookupMemTable(merge.key, merge.seq - 1, &value, &seq)) {
+    AddToMerge(merge, value, seq);
+  }
+}
+
+/**
+ * @Description: Resolve a pending merge through the older versions of its key
+ * in the SSTs of a version. Versions are told apart by sequence number, so the
+ * version may hold the mem table the merge went through. The lock need not be
+ * held.
+ */
+void KVStore::ResolveMerge(const Version &version, PendingMerge &merge) const {
+  while (!merge.value) {
+    SequenceNumber seq;
+    StringSPtr value = Lookup(version, merge.key, merge.seq - 1, &seq);
+    AddToMerge(merge, value, seq);
+  }
+}
+
+/**
+ * @Description: Resolve a version found in the SSTs of a version, if it is a
+ * live merge entry.
+ * @param version: The version the SSTs belong to.
+ * @param key: The key of the version found.
+ * @param seq: The sequence number of the version found.
+ * @param value: The stored version, which may be `nullptr`.
+ * @return: The stored value, which is `value` unless it is a merge entry.
+ */
+StringSPtr KVStore::ResolveMerge(const Version &version, const uint64_t key,
+                                 const SequenceNumber seq,
+                                 const StringSPtr &value) const {
+  if (!value || !IsLive(*value) || !IsMergeEntry(*value)) {
+    return value;
+  }
+  PendingMerge merge{key, {*value}, seq, nullptr};
+  ResolveMerge(version, merge);
+  return merge.value;
+}
+
+/**
+ * @Description: Run TTL expiry and the compaction filter on a value a merge
+ * is about to write.
+ * @param level: The level the merge writes to.
+ * @param key: The key of the value.
+ * @param value: The stored value, replaced if the filter changes it.
+ * @return: `true` iff the key is to be removed.
+ */
+bool KVStore::FilterValue(const size_t level, const uint64_t key,
+                          StringSPtr &value) const {
+  if (*value == kDeletionMark) {
+    return false;
+  }
+  if (!IsLive(*value)) {
     return true;
-  } else if (is_deleted_in_memory) {
+  }
+  // Operands are only filtered once combined with a value.
+  if (!compaction_filter_ || IsMergeEntry(*value)) {
+    return false;
+  }
+
+  std::string new_value;
+  switch (compaction_filter_->Filter(level, key, UserValue(*value),
+                                     &new_value)) {
+    case CompactionFilter::Decision::kRemove:
+      return true;
+    case CompactionFilter::Decision::kChangeValue:
+      // Keep the original write time.
+      value = std::make_shared<std::string>(KeepWriteTime(new_value, *value));
+      return false;
+    default:
+      return false;
+  }
+}
+
+/**
+ * @Description: Gather what a merge into a level needs, as of now. The lock
+ * must be held.
+ * @param level: The level the merge writes to.
+ * @param remove_deletion_mark: Whether nothing older than the merged entries
+ * lies below the level.
+ */
+KVStore::MergeContext KVStore::NewMergeContext(
+    const size_t level, const bool remove_deletion_mark) const {
+  return MergeContext{level,
+                      remove_deletion_mark,
+                      range_tombstones_,
+                      std::vector<SequenceNumber>(snapshots_.begin(),
+                                                  snapshots_.end()),
+                      false,
+                      0,
+                      0,
+                      nullptr};
+}
+
+/**
+ * @Description: Decide whether a merge keeps a version of a key. Versions
+ * come in ascending order of key, newest first. The snapshots split the
+ * versions of a key into stripes: a stripe holds the versions no snapshot
+ * tells apart, of which only the newest can be read. TTL expiry and the
+ * compaction filter only apply to the newest stripe, which no snapshot reads.
+ * The older versions of a stripe fold into a merge entry kept for it.
+ * @param ctx: The context of the merge, which remembers the last version.
+ * @param key: The key of the version.
+ * @param seq: The sequence number of the version.
+ * @param value: The stored value, replaced if the filter changes it.
+ * @return: `true` iff the version is to be written.
+ */
+bool KVStore::KeepVersion(MergeContext &ctx, const uint64_t key,
+                          const SequenceNumber seq, StringSPtr &value) const {
+  const std::vector<SequenceNumber> &snapshots = ctx.snapshots;
+  // Index of the oldest snapshot that reads the version, if any.
+  size_t stripe = std::lower_bound(snapshots.begin(), snapshots.end(), seq) -
+                  snapshots.begin();
+  bool shadowed = ctx.has_key && ctx.key == key && ctx.stripe == stripe;
+  ctx.has_key = true;
+  ctx.key = key;
+  ctx.stripe = stripe;
+  SequenceNumber visible_to =
+      stripe < snapshots.size() ? snapshots[stripe] : kMaxSequenceNumber;
+  if (shadowed) {
+    if (ctx.merge_value) {
+      FoldIntoMergeValue(ctx, key, *value,
+                         ctx.range_tombstones->Covers(key, seq, visible_to));
+    }
+    return false;
+  }
+  ctx.merge_value = nullptr;
+
+  // A key removed by the filter shadows its older values like a deletion.
+  if (stripe == snapshots.size() && FilterValue(ctx.level, key, value)) {
+    value = std::make_shared<std::string>(kDeletionMark);
+  }
+
+  // Check range tombstones, against the readers of the stripe.
+  if (ctx.range_tombstones->Covers(key, seq, visible_to)) {
+    return false;
+  }
+  if (merge_operator_ && IsLive(*value) && IsMergeEntry(*value)) {
+    // Values are shared with the SSTs merged, so fold into a copy.
+    value = std::make_shared<std::string>(*value);
+    ctx.merge_value = value;
+  }
+  // A deletion mark is dropped only if no snapshot reads an older version.
+  return !(ctx.remove_deletion_mark && stripe == 0 && *value == kDeletionMark);
+}
+
+/**
+ * @Description: Fold a version shadowed in its stripe into the merge entry
+ * kept for the stripe. The entry stays a merge entry if the version is one,
+ * else it becomes a value, into which nothing older folds.
+ * @param ctx: The context of the merge, which holds the merge entry.
+ * @param key: The key of the version.
+ * @param older: The stored version.
+ * @param covered: Whether the version is deleted by a range tombstone.
+ */
+void KVStore::FoldIntoMergeValue(MergeContext &ctx, const uint64_t key,
+                                 const std::string &older,
+                                 const bool covered) const {
+  std::string &merge_value = *ctx.merge_value;
+  bool live = !covered && IsLive(older);
+  std::vector<std::string> operands = MergeOperands(merge_value);
+  if (live && IsMergeEntry(older)) {
+    std::vector<std::string> older_operands = MergeOperands(older);
+    operands.insert(operands.begin(), older_operands.begin(),
+                    older_operands.end());
+    merge_value = KeepWriteTime(EncodeMergeEntry(operands), merge_value);
+    return;
+  }
+
+  std::string base = live ? UserValue(older) : "";
+  merge_value = KeepWriteTime(
+      FullMerge(key, live ? &base : nullptr, operands), merge_value);
+  ctx.merge_value = nullptr;
+}
+
+/**
+ * @Description: Write a key-value pair into the mem table, flushing it first
+ * if it is full, and drop the key from the row cache. The lock must be held.
+ * @param key: Key in the key-value pair.
+ * @param s: Value in the key-value pair.
+ */
+void KVStore::Write(const uint64_t key, const std::string &s) {
+  if (row_cache_) {
+    row_cache_->Erase(key);
+  }
+  // Replaced versions a snapshot may read stay in the mem table.
+  SequenceNumber newest_snapshot =
+      snapshots_.empty() ? 0 : *snapshots_.rbegin();
+  try {
+    mem_table_.Put(key, s, last_sequence_ + 1, newest_snapshot);
+  } catch (const MemTableFull &) {
+    Flush();
+    mem_table_.Put(key, s, last_sequence_ + 1, newest_snapshot);
+  }
+  ++last_sequence_;
+}
+
+/**
+ * @Description: Write the mem table to a new SST in level-0, and schedule a
+ * compaction if needed. The lock must be held.
+ */
+void KVStore::Flush() {
+  StopWatch stop_watch(statistics_.get(), Statistics::kFlushMicros);
+  EventSpan span(event_log_.get(), "flush",
+                 EventLog::Args().Add("dir", kDir).Add("level", 0));
+  SSTableSPtr ssTablePtr =
+      mem_table_.ToFile(timestamp_, sst_no_++, kDir, rate_limiter_.get());
+  if (span.Enabled()) {
+    span.EndArgs()
+        .Add("output_files", std::vector<std::string>{ssTablePtr->file_path_})
+        .Add("bytes_written", ssTablePtr->file_size_)
+        .Add("keys_dropped", mem_table_.Size() > ssTablePtr->num_keys_
+                                 ? mem_table_.Size() - ssTablePtr->num_keys_
+                                 : 0);
+  }
+  stats_.bytes_flushed += ssTablePtr->file_size_;
+  statistics_->Record(Statistics::kBytesFlushed, ssTablePtr->file_size_);
+  ++timestamp_;
+  flushed_sequence_ = last_sequence_;
+#ifdef DEBUG
+  cout << "========== MEM TO DISK ==========" << endl;
+  cout << *ssTablePtr << endl;
+#endif
+  mem_table_.Reset();
+
+  LevelSPtr level0_ptr = std::make_shared<Level>(*ssts_[0]);
+  level0_ptr->emplace_back(ssTablePtr);
+  ssts_[0] = level0_ptr;
+  InstallVersion();
+  UpdateWriteStall();
+  MaybeScheduleCompaction();
+}
+
+/**
+ * @Description: Pin the current version, which stays valid, files included,
+ * for as long as it is held. The lock need not be held.
+ */
+VersionSPtr KVStore::CurrentVersion() const {
+  return std::atomic_load(&current_);
+}
+
+/**
+ * @Description: Publish the levels and range tombstones as a new version.
+ * Readers of older versions are not disturbed, and the SSTs only they refer to
+ * are removed when the last of them is released. The lock must be held.
+ */
+void KVStore::InstallVersion() {
+  auto version = std::make_shared<Version>();
+  version->levels = ssts_;
+  version->range_tombstones = range_tombstones_;
+  std::atomic_store(&current_, VersionSPtr(std::move(version)));
+}
+
+/**
+ * @Description: Hold a write back while compaction falls behind: block while
+ * writes are stopped, or sleep for the delay the write controller asks for.
+ * The write is counted in the statistics. The lock must be held, and is
+ * released while waiting.
+ * @param lock: Lock on `mutex_`.
+ * @param bytes: Size of the write.
+ */
+void KVStore::DelayWrite(std::unique_lock<std::mutex> &lock,
+                         const size_t bytes) {
+  auto start = std::chrono::steady_clock::now();
+  bool stalled = false;
+
+  // Nothing would wake the writer up if there were nothing to compact.
+  while (write_controller_.IsStopped() && NeedsCompaction()) {
+    stalled = true;
+    bg_done_cv_.wait(lock);
+  }
+
+  std::chrono::microseconds delay = write_controller_.DelayFor(bytes);
+  if (delay.count()) {
+    stalled = true;
+    lock.unlock();
+    std::this_thread::sleep_for(delay);
+    lock.lock();
+  }
+
+  statistics_->Record(Statistics::kBytesWritten, bytes);
+  if (stalled) {
+    size_t micros = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+    ++stats_.num_write_stalls;
+    stats_.write_stall_micros += micros;
+    statistics_->Record(Statistics::kWriteStallMicros, micros);
+    if (event_log_) {
+      event_log_->Complete("write_stall", start,
+                           EventLog::Args().Add("dir", kDir));
+    }
+  }
+}
+
+/**
+ * @Description: Refresh the pending compaction bytes, and pass them on to the
+ * write controller and the rate limiter. The lock must be held.
+ */
+void KVStore::UpdateWriteStall() {
+  pending_compaction_bytes_ = ComputePendingCompactionBytes();
+  write_controller_.Update(ssts_[0]->size(), pending_compaction_bytes_);
+  if (rate_limiter_) {
+    rate_limiter_->ReportPendingCompactionBytes(this,
+                                                pending_compaction_bytes_);
+  }
+}
+
+/**
+ * @Description: Find the newest value of a key as of a snapshot in the mem
+ * table. The lock must be held.
+ * @param key: The key to search with
+ * @param snapshot: Sequence number to read at.
+ * @param value: Set to the value, which may be a deletion mark, or to
+ * `nullptr` if it is deleted by a range tombstone.
+ * @param seq: Set to the sequence number of the version, if not `nullptr`.
+ * @return: `false` iff the mem table holds no version of the key.
+ */
+bool KVStore::LookupMemTable(uint64_t key, const SequenceNumber snapshot,
+                             StringSPtr *value, SequenceNumber *seq) const {
+  SequenceNumber found_seq;
+  const std::string *value_in_mem = mem_table_.Get(key, snapshot, &found_seq);
+  if (!value_in_mem) {
     return false;
   }
+  if (seq) {
+    *seq = found_seq;
+  }
+  *value = range_tombstones_->Covers(key, found_seq, snapshot)
+               ? nullptr
+               : std::make_shared<std::string>(*value_in_mem);
+  return true;
+}
+
+/**
+ * @Description: Find the newest value of a key as of a snapshot in an SST,
+ * counting the checks of its bloom filter and the reads of its file.
+ * @param sst: The SST to search in.
+ * @param level: The level of the SST.
+ * @param key: The key to search with
+ * @param snapshot: Sequence number to read at.
+ * @param seq: Set to the sequence number of the version found.
+ * @return: Pointer to the value, `nullptr` if the SST holds no version of the
+ * key as of the snapshot.
+ */
+StringSPtr KVStore::LookupSST(const SSTable &sst, const size_t level,
+                              const uint64_t key, const SequenceNumber snapshot,
+                              SequenceNumber *seq) const {
+  if (!sst.Contains(key)) {
+    return nullptr;
+  }
+  statistics_->RecordLevel(Statistics::kBloomFilterChecks, level);
+  if (!sst.IsProbablyPresent(key)) {
+    statistics_->RecordLevel(Statistics::kBloomFilterUseful, level);
+    return nullptr;
+  }
+  size_t idx = sst.Find(key, snapshot);
+  if (idx == std::numeric_limits<size_t>::max()) {
+    return nullptr;
+  }
+  *seq = sst.seqs_[idx];
+  StringSPtr value = sst.ValueByIndex(idx);
+  statistics_->Record(Statistics::kSSTFilesOpened);
+  statistics_->Record(Statistics::kBytesRead, value->size());
+  return value;
+}
 
-  for (const LevelSPtr &level_ptr : ssts_) {
-    if (level_ptr == *ssts_.begin()) {
-      // Do sequential search in level-0.
+/**
+ * @Description: Find the newest value of a key as of a snapshot in the SSTs of
+ * a version, level by level. The lock need not be held.
+ * @param version: The version to search in.
+ * @param key: The key to search with
+ * @param snapshot: Sequence number to read at.
+ * @param seq: Set to the sequence number of the version found, if not
+ * `nullptr`.
+ * @return: Pointer to the value, which may be a deletion mark, or `nullptr` if
+ * the key is absent or deleted by a range tombstone.
+ */
+std::shared_ptr<std::string> KVStore::Lookup(
+    const Version &version, uint64_t key, const SequenceNumber snapshot,
+    SequenceNumber *seq) const {
+  const RangeTombstoneList &range_tombstones = *version.range_tombstones;
+  SequenceNumber found_seq;
+  size_t num_levels = version.levels.size();
+  for (size_t i = 0; i < num_levels; ++i) {
+    const LevelSPtr &level_ptr = version.levels[i];
+    if (strategy_->IsTiered(i, num_levels)) {
+      // Sequential search in tiered levels, newest SST first.
       for (auto sst_rit = level_ptr->rbegin(); sst_rit != level_ptr->rend();
            ++sst_rit) {
-        SSTableSPtr sst_ptr = *sst_rit;
-        std::shared_ptr<std::string> val_ptr = sst_ptr->ValueByKey(key);
+        // Search a pointer in a `SSTable`. Return `nullptr` if not found.
+        std::shared_ptr<std::string> val_ptr =
+            LookupSST(**sst_rit, i, key, snapshot, &found_seq);
         if (val_ptr) {
-          std::string value = *val_ptr;
-          return !(value == kDeletionMark);
+          if (seq) {
+            *seq = found_seq;
+          }
+          return range_tombstones.Covers(key, found_seq, snapshot) ? nullptr
+                                                                   : val_ptr;
         }
       }
     } else {
-      // Do binary search in other levels.
+      // For other levels, do binary search.
       SSTableSPtr sst_ptr = BinarySearch(level_ptr, key);
       if (sst_ptr) {
-        std::shared_ptr<std::string> val_ptr = sst_ptr->ValueByKey(key);
+        std::shared_ptr<std::string> val_ptr =
+            LookupSST(*sst_ptr, i, key, snapshot, &found_seq);
         if (val_ptr) {
-          std::string value = *val_ptr;
-          return !(value == kDeletionMark);
+          if (seq) {
+            *seq = found_seq;
+          }
+          return range_tombstones.Covers(key, found_seq, snapshot) ? nullptr
+                                                                   : val_ptr;
         }
       }
     }
     // Find in the next level.
   }
-  return false;
+  return nullptr;
 }
 
 /**
- * @Description: Resets the kvstore. All key-value pairs should be removed,
- *               including mem table and all SST files.
+ * @Description: Look keys up in an SST, for `MultiGet`.
+ * @param version: The version the SST belongs to.
+ * @param sst_ptr: The SST to search in.
+ * @param keys: All the keys of the `MultiGet`.
+ * @param snapshot: Sequence number to read at.
+ * @param pending: Positions of the keys to look up, in ascending order of key.
+ * Those found in the SST are removed.
+ * @param values: Values of the keys, set for the keys found.
  */
-void KVStore::Reset() {
-  mem_table_.Reset();
-  ssts_.clear();
-  ssts_.emplace_back(std::make_shared<Level>());
-
-  // Remove all SST files.
-  std::vector<std::string> level_list;
-  int num_level = utils::ScanDir(kDir, level_list);
-  std::string dir_with_slash = kDir + "/";
-  for (int i = 0; i < num_level; ++i) {
-    std::vector<std::string> file_list;
-    utils::ScanDir(dir_with_slash + level_list[i], file_list);
+void KVStore::MultiGetFromSST(const Version &version,
+                              const SSTableSPtr &sst_ptr,
+                              const std::vector<uint64_t> &keys,
+                              const SequenceNumber snapshot,
+                              std::vector<size_t> &pending,
+                              std::vector<std::string> &values) const {
+  std::vector<uint64_t> pending_keys;
+  pending_keys.reserve(pending.size());
+  for (size_t pos : pending) {
+    pending_keys.push_back(keys[pos]);
+  }
 
-    std::string level_name_with_slash = dir_with_slash + level_list[i] + "/";
-    for (std::string &file_name : file_list) {
-      utils::Rmfile((level_name_with_slash + file_name).c_str());
+  std::vector<SequenceNumber> seqs;
+  std::vector<StringSPtr> found =
+      sst_ptr->ValuesByKeys(pending_keys, snapshot, &seqs, io_backend_.get());
+  std::vector<size_t> rest;
+  for (size_t i = 0; i < pending.size(); ++i) {
+    const StringSPtr &val_ptr = found[i];
+    if (!val_ptr) {
+      rest.push_back(pending[i]);
+    } else if (!version.range_tombstones->Covers(pending_keys[i], seqs[i],
+                                                 snapshot) &&
+               IsLive(*val_ptr)) {
+      values[pending[i]] = UserValue(
+          *ResolveMerge(version, pending_keys[i], seqs[i], val_ptr));
     }
-
-    utils::Rmdir((dir_with_slash + level_list[i]).c_str());
   }
+  pending.swap(rest);
 }
 
 /**
@@ -241,10 +1489,11 @@ SSTableSPtr KVStore::BinarySearch(const LevelSPtr &level_ptr, uint64_t key) {
  * @Description: Debug utility function, print all SSTs cached in memory.
  */
 __attribute__((unused)) void KVStore::PrintSSTables() const {
-  int num_levels = (int)ssts_.size();
+  VersionSPtr version = CurrentVersion();
+  int num_levels = (int)version->levels.size();
   for (int i = 0; i < num_levels; ++i) {
     std::cout << "Level " << i << std::endl;
-    Level level = *ssts_[i];
+    Level level = *version->levels[i];
     for (const SSTableSPtr &ssTablePtr : level) {
       std::cout << *ssTablePtr << std::endl;
     }
@@ -252,53 +1501,451 @@ __attribute__((unused)) void KVStore::PrintSSTables() const {
 }
 
 /**
- * @Description: Handle Compaction for all levels, level-0 and other levels are
- * handled separately.
+ * @Description: Tell whether a level holds overlapping sorted runs.
+ */
+bool KVStore::IsTiered(size_t level) const {
+  return strategy_->IsTiered(level, ssts_.size());
+}
+
+/**
+ * @Description: Tell whether a level holds more SSTs (leveled) or sorted runs
+ * (tiered) than the compaction strategy allows.
+ */
+bool KVStore::IsOverflowing(size_t level) const {
+  const LevelSPtr &level_ptr = ssts_[level];
+  size_t capacity = strategy_->Capacity(level, ssts_.size());
+  if (!IsTiered(level)) {
+    return level_ptr->size() > capacity;
+  }
+
+  // SSTs of the same run share the timestamp of the merge that wrote them.
+  std::unordered_set<Timestamp> runs;
+  for (const SSTableSPtr &sst_ptr : *level_ptr) {
+    runs.insert(sst_ptr->timestamp_);
+  }
+  return runs.size() > capacity;
+}
+
+/**
+ * @Description: Append an empty bottom level, both on disk and in memory. The
+ * lock must be held.
+ */
+void KVStore::AddLevel() {
+  std::string level_name = kDir + "/level-" + std::to_string(ssts_.size());
+  if (!utils::DirExists(level_name)) {
+    utils::Mkdir(level_name.c_str());
+  }
+  bool was_tiered = IsTiered(ssts_.size() - 1);
+  ssts_.emplace_back(std::make_shared<Level>());
+
+  // The old bottom level may turn tiered, e.g. with lazy leveling. Its SSTs
+  // carry the timestamps of the merges that wrote them, but form one run, and
+  // must count as one, or the level would overflow at once and be rewritten
+  // as a whole into the new bottom level. A level tiered all along holds
+  // runs of its own. Versions may still hold the SSTs, so the others are
+  // restamped as copies, in a level of their own.
+  size_t old_bottom = ssts_.size() - 2;
+  const LevelSPtr &level_ptr = ssts_[old_bottom];
+  if (!was_tiered && IsTiered(old_bottom) && !level_ptr->empty()) {
+    Timestamp run = 0;
+    for (const SSTableSPtr &sst_ptr : *level_ptr) {
+      run = std::max(run, sst_ptr->timestamp_);
+    }
+    LevelSPtr run_level = std::make_shared<Level>();
+    for (const SSTableSPtr &sst_ptr : *level_ptr) {
+      if (sst_ptr->timestamp_ == run) {
+        run_level->emplace_back(sst_ptr);
+        continue;
+      }
+      SSTableSPtr copy = CopyToLevel(sst_ptr, old_bottom);
+      copy->Restamp(run);
+      run_level->emplace_back(copy);
+      MarkObsolete(sst_ptr);
+    }
+    ssts_[old_bottom] = run_level;
+  }
+  InstallVersion();
+}
+
+/**
+ * @Description: Tell whether the key range of some SST of a level overlaps
+ * that of one of `ssts`.
  */
-void KVStore::Compaction() {
-  // handle level0 special case
-  if (ssts_[0]->size() > 2) {
-    CompactionLevel0();
+bool KVStore::Overlaps(const Level &level,
+                       const std::vector<SSTableSPtr> &ssts) {
+  for (const SSTableSPtr &sst_ptr : level) {
+    for (const SSTableSPtr &other : ssts) {
+      if (sst_ptr->min_key_ <= other->max_key_ &&
+          other->min_key_ <= sst_ptr->max_key_) {
+        return true;
+      }
+    }
   }
+  return false;
+}
 
-  size_t num_levels = ssts_.size();
-  size_t num_levels_to_iterate = num_levels - 1;
-  for (size_t i = 1; i < num_levels_to_iterate; ++i) {
-    if (ssts_[i]->size() > (2 << i)) {
-      Compaction(i, i == num_levels_to_iterate - 1);
+/**
+ * @Description: Pick the level for a run of ingested SSTs: the lowest one
+ * such that no level above it overlaps the run, nor the level itself unless
+ * it is tiered, where the run becomes the newest. A run that overlaps no level
+ * goes to the bottom level, below which empty levels are added until the run
+ * fits, so that a bulk load is not merged or copied down later on. Level-0
+ * takes the flushes, so it does not count as the bottom. The lock must be
+ * held.
+ * @param ssts: The SSTs of the run.
+ * @return: The level.
+ */
+size_t KVStore::LevelForIngestion(const std::vector<SSTableSPtr> &ssts) {
+  size_t ret = 0;
+  for (size_t level = 0; level < ssts_.size(); ++level) {
+    bool overlaps = Overlaps(*ssts_[level], ssts);
+    if (!overlaps || IsTiered(level)) {
+      ret = level;
+    }
+    if (overlaps) {
+      return ret;
+    }
+  }
+
+  auto fits = [this, &ssts](size_t level) {
+    return IsTiered(level) ||
+           ssts_[level]->size() + ssts.size() <=
+               strategy_->Capacity(level, ssts_.size());
+  };
+  while (ssts_.size() == 1 || !fits(ssts_.size() - 1)) {
+    AddLevel();
+  }
+  return ssts_.size() - 1;
+}
+
+/**
+ * @Description: Tell whether some level overflows.
+ */
+bool KVStore::NeedsCompaction() const {
+  for (size_t level = 0; level < ssts_.size(); ++level) {
+    if (IsOverflowing(level) || HasTombstoneDenseSST(level)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @Description: Tell whether enough of the entries of an SST are deletion
+ * marks for it to be compacted regardless of the room in its level.
+ */
+bool KVStore::IsTombstoneDense(const SSTableSPtr &sst_ptr) const {
+  return kTombstoneCompactionRatio > 0 && sst_ptr->num_keys_ &&
+         (double)sst_ptr->num_deletions_ >=
+             kTombstoneCompactionRatio * (double)sst_ptr->num_keys_;
+}
+
+/**
+ * @Description: Tell whether a leveled level above the bottom one holds an
+ * SST dense with deletion marks. Tiered levels are compacted as a whole, and
+ * the marks of the bottom level have nowhere to go.
+ */
+bool KVStore::HasTombstoneDenseSST(const size_t level) const {
+  if (IsTiered(level) || level + 1 >= ssts_.size()) {
+    return false;
+  }
+  for (const SSTableSPtr &sst_ptr : *ssts_[level]) {
+    if (IsTombstoneDense(sst_ptr)) {
+      return true;
     }
   }
+  return false;
+}
+
+/**
+ * @Description: Schedule a background compaction on the thread pool if some
+ * level overflows, none is scheduled yet and no ingestion waits for one to be
+ * done. The lock must be held.
+ */
+void KVStore::MaybeScheduleCompaction() {
+  if (bg_scheduled_ || num_ingestions_waiting_ || !NeedsCompaction()) {
+    return;
+  }
+  bg_scheduled_ = true;
+  thread_pool_->Schedule([this] { BackgroundCompaction(); });
+}
+
+/**
+ * @Description: Background compaction task. Compact every overflowing level,
+ * and schedule another task if the levels still overflow.
+ */
+void KVStore::BackgroundCompaction() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  size_t bytes_read = stats_.bytes_compaction_read;
+  size_t bytes_written = stats_.bytes_compaction_written;
+  Compaction(lock);
+  statistics_->Record(Statistics::kBytesCompactionRead,
+                      stats_.bytes_compaction_read - bytes_read);
+  statistics_->Record(Statistics::kBytesCompactionWritten,
+                      stats_.bytes_compaction_written - bytes_written);
+  DropObsoleteRangeTombstones();
+  bg_scheduled_ = false;
+  MaybeScheduleCompaction();
+  bg_done_cv_.notify_all();
+}
+
+/**
+ * @Description: Drop the range tombstones no entry older than them may lie
+ * under, since compaction removed every key they cover: no SST overlapping
+ * them holds an older entry, and the mem table holds none either. The lock
+ * must be held.
+ */
+void KVStore::DropObsoleteRangeTombstones() {
+  if (range_tombstones_->IsEmpty()) {
+    return;
+  }
+
+  auto range_tombstones =
+      std::make_shared<RangeTombstoneList>(*range_tombstones_);
+  bool changed =
+      range_tombstones->Filter([this](const RangeTombstone &tombstone) {
+        if (tombstone.seq > flushed_sequence_) {
+          return true;
+        }
+        for (const LevelSPtr &level_ptr : ssts_) {
+          for (const SSTableSPtr &sst_ptr : *level_ptr) {
+            if (sst_ptr->min_seq_ < tombstone.seq &&
+                sst_ptr->min_key_ < tombstone.end &&
+                sst_ptr->max_key_ >= tombstone.begin) {
+              return true;
+            }
+          }
+        }
+        return false;
+      });
+  if (!changed) {
+    return;
+  }
+  // Keeping the tombstones is always safe, so a failed write only delays the
+  // drop to the next compaction.
+  try {
+    range_tombstones->ToFile(kDir + "/" + kRangeTombstoneFile);
+  } catch (const std::system_error &) {
+    return;
+  }
+  range_tombstones_ = range_tombstones;
+  InstallVersion();
+}
+
+/**
+ * @Description: Handle Compaction for all levels from top to bottom. How a
+ * level is compacted depends on the shape the strategy gives it and the level
+ * below it. Only called by the background compaction.
+ * @param lock: Lock on `mutex_`, held on entry and on return, and released
+ * while merging.
+ */
+void KVStore::Compaction(std::unique_lock<std::mutex> &lock) {
+  for (size_t level = 0; level < ssts_.size(); ++level) {
+    bool overflowing = IsOverflowing(level);
+    if (!overflowing && !HasTombstoneDenseSST(level)) {
+      continue;
+    }
+
+    bool is_last_level = level + 1 == ssts_.size();
+    if (is_last_level) {
+      AddLevel();
+      // A level turned tiered holds a single run, which may fit.
+      if (!IsOverflowing(level) && !HasTombstoneDenseSST(level)) {
+        continue;
+      }
+    }
 
-  // Check for the last level, just put the SSTs with the largest timestamps to
-  // the next level
-  auto last_level_ptr = ssts_[num_levels_to_iterate];
-  if (last_level_ptr->size() > (2 << num_levels_to_iterate)) {
-    std::string level_name = kDir + "/level-" + std::to_string(num_levels);
-    if (!utils::DirExists(kDir + "/level")) {
-      utils::Mkdir(level_name.c_str());
+    // What the level held against its capacity tells why compactions cascade
+    // down the levels.
+    EventSpan job(event_log_.get(), "compaction",
+                  EventLog::Args()
+                      .Add("dir", kDir)
+                      .Add("level", level)
+                      .Add("kind", IsTiered(level) ? "tiered"
+                                   : is_last_level ? "move"
+                                                   : "leveled")
+                      .Add("reason", overflowing ? "overflow" : "tombstones")
+                      .Add("files_at_level", ssts_[level]->size())
+                      .Add("capacity",
+                           strategy_->Capacity(level, ssts_.size())));
+    size_t bytes_read = stats_.bytes_compaction_read;
+    size_t bytes_written = stats_.bytes_compaction_written;
+
+    // Deletion marks can be dropped only when nothing older can lie below.
+    bool into_last_level = level + 2 == ssts_.size();
+    auto start = std::chrono::steady_clock::now();
+    if (IsTiered(level)) {
+      bool next_level_is_run = IsTiered(level + 1);
+      CompactionTiered(level,
+                       into_last_level &&
+                           (!next_level_is_run || ssts_[level + 1]->empty()),
+                       lock);
+    } else if (is_last_level) {
+      MoveToNextLevel(level, lock);
+    } else {
+      Compaction(level, into_last_level, lock);
+    }
+    statistics_->RecordCompactionTime(
+        level, std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::steady_clock::now() - start)
+                   .count());
+    if (job.Enabled()) {
+      job.EndArgs()
+          .Add("bytes_read", stats_.bytes_compaction_read - bytes_read)
+          .Add("bytes_written", stats_.bytes_compaction_written - bytes_written)
+          .Add("files_left_at_level", ssts_[level]->size())
+          .Add("files_at_next_level", ssts_[level + 1]->size());
     }
 
-    auto cur_level_discard_sst =
-        SSTForCompaction(num_levels_to_iterate,
-                         last_level_ptr->size() - (2 << num_levels_to_iterate));
+    // Values the compaction filter rewrote must not be read from the cache.
+    if (row_cache_ && compaction_filter_) {
+      row_cache_->Clear();
+    }
 
-    LevelSPtr newLevel = std::make_shared<Level>();
+    // Writers stalled on this level may go on.
+    UpdateWriteStall();
+    bg_done_cv_.notify_all();
+  }
+}
 
-    for (const auto &sst : *cur_level_discard_sst) {
-      std::string old_path = sst->file_path_;
-      sst->file_path_ = level_name + "/" + std::to_string(sst_no_++) + ".sst";
+/**
+ * @Description: Estimate the bytes compaction has to rewrite to bring every
+ * level back within its capacity: all SSTs of an overflowing tiered level,
+ * and the SSTs beyond the capacity of an overflowing leveled level.
+ * @return: The estimated pending compaction bytes.
+ */
+size_t KVStore::ComputePendingCompactionBytes() const {
+  size_t ret = 0;
+  size_t num_levels = ssts_.size();
+  for (size_t level = 0; level < num_levels; ++level) {
+    if (!IsOverflowing(level)) {
+      continue;
+    }
 
-      std::ifstream src(old_path, std::ios::binary);
-      std::ofstream dst(sst->file_path_, std::ios::binary);
-      dst << src.rdbuf();
-      src.close();
-      dst.close();
-      utils::Rmfile(old_path.c_str());
-      newLevel->emplace_back(sst);
+    const LevelSPtr &level_ptr = ssts_[level];
+    size_t level_bytes = 0;
+    for (const SSTableSPtr &sst_ptr : *level_ptr) {
+      level_bytes += sst_ptr->file_size_;
     }
-    ssts_.emplace_back(newLevel);
-    ReconstructLevel(num_levels_to_iterate, cur_level_discard_sst);
+    if (IsTiered(level)) {
+      ret += level_bytes;
+    } else {
+      size_t num_excess =
+          level_ptr->size() - strategy_->Capacity(level, num_levels);
+      ret += level_bytes / level_ptr->size() * num_excess;
+    }
+  }
+  return ret;
+}
+
+/**
+ * @Description: List the files of SSTs, for the event log.
+ * @param ssts: The SSTs.
+ * @return: Their paths.
+ */
+std::vector<std::string> KVStore::FilePaths(const Level &ssts) {
+  std::vector<std::string> ret;
+  for (const SSTableSPtr &sst_ptr : ssts) {
+    ret.emplace_back(sst_ptr->file_path_);
+  }
+  return ret;
+}
+
+size_t KVStore::NumKeys(const Level &ssts) {
+  size_t ret = 0;
+  for (const SSTableSPtr &sst_ptr : ssts) {
+    ret += sst_ptr->num_keys_;
+  }
+  return ret;
+}
+
+/**
+ * @Description: Describe what a compaction did in the event of its span:
+ * the files it merged and wrote, the bytes it moved and the versions it
+ * dropped.
+ * @param span: The span of the compaction.
+ * @param inputs: The SSTs merged.
+ * @param outputs: The SSTs written.
+ * @param bytes_read: `stats_.bytes_compaction_read` when the span began.
+ * @param bytes_written: `stats_.bytes_compaction_written` when the span began.
+ */
+void KVStore::EndCompactionSpan(EventSpan &span, const Level &inputs,
+                                const Level &outputs, const size_t bytes_read,
+                                const size_t bytes_written) const {
+  if (!span.Enabled()) {
+    return;
+  }
+  size_t keys_in = NumKeys(inputs);
+  size_t keys_out = NumKeys(outputs);
+  span.EndArgs()
+      .Add("input_files", FilePaths(inputs))
+      .Add("output_files", FilePaths(outputs))
+      .Add("bytes_read", stats_.bytes_compaction_read - bytes_read)
+      .Add("bytes_written", stats_.bytes_compaction_written - bytes_written)
+      .Add("keys_dropped", keys_in > keys_out ? keys_in - keys_out : 0);
+}
+
+/**
+ * @Description: Copy the file of an SST into another level.
+ * @param sst_ptr: The SST to copy.
+ * @param level: The level to copy to.
+ * @return: The copy, which takes a new SST number.
+ */
+SSTableSPtr KVStore::CopyToLevel(const SSTableSPtr &sst_ptr,
+                                 const size_t level) {
+  auto ret = std::make_shared<SSTable>(*sst_ptr);
+  ret->file_path_ = kDir + "/level-" + std::to_string(level) + "/" +
+                    std::to_string(sst_no_++) + ".sst";
+  if (rate_limiter_) {
+    // Both the read and the write of the copy.
+    rate_limiter_->Request(sst_ptr->file_size_, IOPriority::kCompaction);
+    rate_limiter_->Request(sst_ptr->file_size_, IOPriority::kCompaction);
+  }
+
+  std::ifstream src(sst_ptr->file_path_, std::ios::binary);
+  std::ofstream dst(ret->file_path_, std::ios::binary);
+  dst << src.rdbuf();
+  src.close();
+  dst.close();
+  stats_.bytes_compaction_read += sst_ptr->file_size_;
+  stats_.bytes_compaction_written += sst_ptr->file_size_;
+  return ret;
+}
+
+/**
+ * @Description: Move the SSTs that overflow the bottom level to the new level
+ * below it, without merging.
+ * @param level: The number of level that is overflowing currently
+ * @param lock: Lock on `mutex_`, released while copying.
+ */
+void KVStore::MoveToNextLevel(const size_t level,
+                              std::unique_lock<std::mutex> &lock) {
+  LevelSPtr level_ptr = ssts_[level];
+
+  auto cur_level_discard_sst = SSTForCompaction(
+      level, level_ptr->size() - strategy_->Capacity(level, ssts_.size()));
+
+  lock.unlock();
+  EventSpan span(event_log_.get(), "subcompaction",
+                 EventLog::Args().Add("level", level));
+  size_t bytes_read = stats_.bytes_compaction_read;
+  size_t bytes_written = stats_.bytes_compaction_written;
+  std::vector<SSTableSPtr> copies;
+  for (const auto &sst : *cur_level_discard_sst) {
+    copies.emplace_back(CopyToLevel(sst, level + 1));
   }
+  EndCompactionSpan(span,
+                    Level(cur_level_discard_sst->begin(),
+                          cur_level_discard_sst->end()),
+                    copies, bytes_read, bytes_written);
+  lock.lock();
+
+  LevelSPtr next_level_ptr = std::make_shared<Level>(*ssts_[level + 1]);
+  next_level_ptr->insert(next_level_ptr->end(), copies.begin(), copies.end());
+  ssts_[level + 1] = next_level_ptr;
+  ++stats_.num_compactions;
+  ReconstructLevel(level, cur_level_discard_sst);
+  InstallVersion();
 }
 
 /**
@@ -307,19 +1954,41 @@ void KVStore::Compaction() {
  * @param remove_deletion_mark: A flag that decides whether "~DELETED~"
  * should be removed It is true only when level is the level above the bottom
  * level
+ * @param lock: Lock on `mutex_`, released while merging.
  */
-void KVStore::Compaction(const size_t level, bool remove_deletion_mark) {
+void KVStore::Compaction(const size_t level, bool remove_deletion_mark,
+                         std::unique_lock<std::mutex> &lock) {
   LevelSPtr cur_level_ptr = ssts_[level];
 
   // Max number of SSTs of current level.
-  size_t max_size = 2 << level;
-  size_t num_sst_to_merge = cur_level_ptr->size() - max_size;
+  size_t max_size = strategy_->Capacity(level, ssts_.size());
+  size_t num_sst_to_merge =
+      cur_level_ptr->size() > max_size ? cur_level_ptr->size() - max_size : 0;
 
   // Step1: find the SSTs with the least time stamp.
   std::shared_ptr<std::set<SSTableSPtr>> cur_level_discard_sst =
       SSTForCompaction(level, num_sst_to_merge);
 
+  // SSTs dense with deletion marks go along, even if the level has room.
+  for (const SSTableSPtr &sst_ptr : *cur_level_ptr) {
+    if (IsTombstoneDense(sst_ptr) &&
+        cur_level_discard_sst->insert(sst_ptr).second) {
+      ++stats_.num_tombstone_compactions;
+    }
+  }
+  const MergeContext base_ctx =
+      NewMergeContext(level + 1, remove_deletion_mark);
+
+  // Levels below level-0 are only changed by the background compaction, they
+  // can be read without the lock.
+  lock.unlock();
   for (const auto &sst_ptr : *cur_level_discard_sst) {
+    // Each SST merges with its overlap on its own, as a subcompaction.
+    EventSpan span(event_log_.get(), "subcompaction",
+                   EventLog::Args().Add("level", level));
+    size_t bytes_read = stats_.bytes_compaction_read;
+    size_t bytes_written = stats_.bytes_compaction_written;
+
     // Step2: Iterate over these SSTs, find the overlapping sstables, Put
     // them in a vector
     LevelSPtr next_level_ptr = ssts_[level + 1];
@@ -341,7 +2010,9 @@ void KVStore::Compaction(const size_t level, bool remove_deletion_mark) {
       if (next_level_sst_ptr->min_key_ <= max_key) {
         overlap.emplace_back(next_level_sst_ptr);
         next_level_discard.insert(next_level_sst_ptr);
-        all_values[next_level_sst_ptr] = next_level_sst_ptr->Values();
+        all_values[next_level_sst_ptr] =
+            next_level_sst_ptr->Values(rate_limiter_.get(), io_backend_.get());
+        stats_.bytes_compaction_read += next_level_sst_ptr->file_size_;
       } else {
         break;
       }
@@ -350,26 +2021,29 @@ void KVStore::Compaction(const size_t level, bool remove_deletion_mark) {
     // Step3: merge that vector and this singe sstable, files are created along
     // the way but if there's no overlapping sst, just copy the file
     std::vector<SSTableSPtr> merge_res;
-
-    if (overlap.empty()) {
-      std::string oldPath = sst_ptr->file_path_;
-      sst_ptr->file_path_ = kDir + "/level-" + std::to_string(level + 1) + "/" +
-                            std::to_string(sst_no_++) + ".sst";
-
-      std::ifstream src(oldPath, std::ios::binary);
-      std::ofstream dst(sst_ptr->file_path_, std::ios::binary);
-      dst << src.rdbuf();
-      src.close();
-      dst.close();
-      utils::Rmfile(oldPath.c_str());
-      merge_res.emplace_back(sst_ptr);
+    MergeContext ctx = base_ctx;
+
+    if (overlap.empty() && !(remove_deletion_mark && sst_ptr->num_deletions_)) {
+      merge_res.emplace_back(CopyToLevel(sst_ptr, level + 1));
+    } else if (overlap.empty()) {
+      // Rewrite the SST alone, to drop its deletion marks.
+      std::priority_queue<std::pair<SSTableSPtr, size_t>> pq;
+      pq.push(std::make_pair(sst_ptr, 0));
+      all_values[sst_ptr] =
+          sst_ptr->Values(rate_limiter_.get(), io_backend_.get());
+      stats_.bytes_compaction_read += sst_ptr->file_size_;
+      merge_res = MergeSSTLevel0(sst_ptr->timestamp_, pq, all_values, ctx);
     } else {
-      all_values[sst_ptr] = sst_ptr->Values();
+      all_values[sst_ptr] =
+          sst_ptr->Values(rate_limiter_.get(), io_backend_.get());
+      stats_.bytes_compaction_read += sst_ptr->file_size_;
       Timestamp max_timestamp =
           MaxTimestampInCompaction(*cur_level_discard_sst, next_level_discard);
-      merge_res = MergeSST(level + 1, max_timestamp, sst_ptr, overlap,
-                           all_values, remove_deletion_mark);
+      merge_res = MergeSST(max_timestamp, sst_ptr, overlap, all_values, ctx);
     }
+    Level inputs{sst_ptr};
+    inputs.insert(inputs.end(), overlap.begin(), overlap.end());
+    EndCompactionSpan(span, inputs, merge_res, bytes_read, bytes_written);
 
 #ifdef DEBUG
     cout << "================= merge result =================" << endl;
@@ -387,7 +2061,14 @@ void KVStore::Compaction(const size_t level, bool remove_deletion_mark) {
     }
 #endif
 
+    // The SST leaves its level in the version the merge result comes in, or
+    // readers would see the merge operands folded by the merge twice.
+    lock.lock();
     ReconstructLevel(level + 1, next_level_discard, merge_res);
+    ReconstructLevel(level, std::make_shared<std::set<SSTableSPtr>>(
+                                std::set<SSTableSPtr>{sst_ptr}));
+    InstallVersion();
+    lock.unlock();
 
 #ifdef DEBUG
     LevelPtr newNextLevel = ssTables[level + 1];
@@ -397,28 +2078,30 @@ void KVStore::Compaction(const size_t level, bool remove_deletion_mark) {
     }
 #endif
   }
+  lock.lock();
 
-  // step5: after iterating through all SSTs, reconstruct the top level
-  ReconstructLevel(level, cur_level_discard_sst);
+  ++stats_.num_compactions;
 }
 
 /**
- * @Description: Merge SSTs for level-0 using priority queue
- *               It also handles the creation of level-1, if level-0 is full.
- * @param level: Number of level to merge TO, which must exist already.
+ * @Description: Merge SSTs of a tiered level (such as level-0) using priority
+ *               queue.
  * @param max_timestamp: Gives a hint for the timestamp for the new SST.
  * @param pq: The priority queue that Contains all SSTs to be merged
  * @param all_values: The values that are stored in SSTs in the priority queue.
+ * @param ctx: The level to merge TO, which must exist already, and what
+ * decides the versions to keep.
  * @return: A vector of new SSTs as the result of the merge. Copy elision should
  * handle necessary copies.
  */
 std::vector<SSTableSPtr> KVStore::MergeSSTLevel0(
-    const size_t level, const size_t max_timestamp,
+    const size_t max_timestamp,
     std::priority_queue<std::pair<SSTableSPtr, size_t>> &pq,
     std::unordered_map<SSTableSPtr, std::shared_ptr<std::vector<StringSPtr>>>
-        &all_values) {
+        &all_values,
+    MergeContext &ctx) {
+  const size_t level = ctx.level;
   std::vector<SSTableSPtr> ret;
-  std::unordered_set<uint64_t> duplicate_checker;
 
   while (!pq.empty()) {
     // Initialize fields for new SST.
@@ -442,48 +2125,46 @@ std::vector<SSTableSPtr> KVStore::MergeSSTLevel0(
       SSTableSPtr sst = sst_and_index.first;
       size_t idx = sst_and_index.second;
       uint64_t key = sst->keys_[idx];
-      // Key already exists, do nothing except checking if there's
-      // any key left in this SST.
-      if (duplicate_checker.count(key)) {
-        if (++idx < sst->num_keys_) {
-          pq.push(make_pair(sst, idx));
-        } else {
-          utils::Rmfile(sst->file_path_.c_str());
-        }
-        continue;
-      }
+      SequenceNumber seq = sst->seqs_[idx];
 
       // Get value, which cannot possibly be null
       StringSPtr value = all_values[sst]->at(idx);
 
-      // Check file size.
+      // Check file size. The versions of a key stay in one SST, so that a
+      // leveled level holds each key in a single SST.
       size_t new_file_size = file_size + kIndexSizePerValue + value->size();
-      if (new_file_size > kMaxSSTableSize) {
+      if (new_file_size > kMaxSSTableSize && num_keys && key != max_key) {
         // Put the value back.
         pq.push(make_pair(sst, idx));
-        Save(new_sst_ptr, file_size, num_keys, min_key, max_key, values);
+        Save(new_sst_ptr, num_keys, min_key, max_key, values);
         ret.emplace_back(new_sst_ptr);
         break;
       }
+
+      if (!KeepVersion(ctx, key, seq, value)) {
+        if (++idx < sst->num_keys_) {
+          pq.push(make_pair(sst, idx));
+        }
+        continue;
+      }
+
       // Pass all checks, can modify SST in memory and write to disk
-      file_size = new_file_size;
-      duplicate_checker.insert(key);
+      file_size += kIndexSizePerValue + value->size();
       values.emplace_back(value);
       new_sst_ptr->bloom_filter_.Put(key);
       new_sst_ptr->keys_.emplace_back(key);
+      new_sst_ptr->seqs_.emplace_back(seq);
       ++num_keys;
       min_key = key < min_key ? key : min_key;
       max_key = key > max_key ? key : max_key;
       if (++idx < sst->num_keys_) {
         pq.push(make_pair(sst, idx));
-      } else {
-        utils::Rmfile(sst->file_path_.c_str());
       }
     }
 
     // pq is empty, but there's still a bit of data in an sstable
     if (pq.empty() && !values.empty()) {
-      Save(new_sst_ptr, file_size, num_keys, min_key, max_key, values);
+      Save(new_sst_ptr, num_keys, min_key, max_key, values);
       ret.emplace_back(new_sst_ptr);
     }
   }
@@ -492,21 +2173,24 @@ std::vector<SSTableSPtr> KVStore::MergeSSTLevel0(
 
 /**
  * @Description: Given value of various fields of SSTable, initialize it with
- * these values, and persist the sst object to disk.
+ * these values, and persist the sst object to disk. The file size follows
+ * from the values, which folding merge operands may have changed.
  * @param sst_ptr: Pointer to the SST to be initialized and saved.
- * @param file_size: File size of the entire SST files.
  * @param num_key: Number of keys in the SST.
  * @param min_key: Minimum key of the SST.
  * @param max_key: Maximum key of the SST.
  * @param values: Values corresponding to keys in the SST.
  */
-void KVStore::Save(SSTableSPtr &sst_ptr, size_t file_size, size_t num_key,
-                   const uint64_t min_key, const uint64_t max_key,
+void KVStore::Save(SSTableSPtr &sst_ptr, size_t num_key, const uint64_t min_key,
+                   const uint64_t max_key,
                    std::vector<std::shared_ptr<std::string>> &values) {
-  sst_ptr->file_size_ = file_size;
   sst_ptr->num_keys_ = num_key;
   sst_ptr->min_key_ = min_key;
   sst_ptr->max_key_ = max_key;
+  sst_ptr->num_deletions_ = 0;
+  for (const StringSPtr &value : values) {
+    sst_ptr->num_deletions_ += *value == kDeletionMark;
+  }
 
   size_t offset =
       kSSTHeaderSize + kBloomFilterSize + num_key * kIndexSizePerValue;
@@ -515,22 +2199,20 @@ void KVStore::Save(SSTableSPtr &sst_ptr, size_t file_size, size_t num_key,
     sst_ptr->offset_[i] = offset;
     offset += values[i]->size();
   }
+  sst_ptr->file_size_ = offset;
+  stats_.bytes_compaction_written += offset;
+  sst_ptr->UpdateSequenceRange();
+  sst_ptr->UpdateValueLayout();
 
-#ifdef DEBUG
-  // check fileSize
-  size_t fs =
-      kSSTHeaderSize + kBloomFilterSize + numOfKeys * kIndexSizePerValue;
-  for (int i = 0; i < numOfKeys; ++i) {
-    fs += values[i]->size();
-  }
-  if (fs != fileSize) {
-    cout << "File size error! Difference: " << fileSize - fs << endl;
-  }
-#endif
-
-  sst_ptr->ToFile(values);
+  sst_ptr->ToFile(values, rate_limiter_.get(), io_backend_.get());
 }
 
+/**
+ * @Description Rebuild a level without the SSTs compacted away from it. The
+ * caller installs the new version.
+ * @param level: The number of level to reconstruct, starting at 0.
+ * @param sst_to_discard: A set of SSTPtr to delete in this level.
+ */
 void KVStore::ReconstructLevel(
     const size_t level,
     const std::shared_ptr<std::set<SSTableSPtr>> &sst_to_discard) {
@@ -543,6 +2225,8 @@ void KVStore::ReconstructLevel(
     SSTableSPtr sstPtr = level_ptr->at(i);
     if (!sst_to_discard->count(sstPtr)) {
       new_level_sst->emplace_back(sstPtr);
+    } else {
+      MarkObsolete(sstPtr);
     }
   }
 
@@ -550,24 +2234,50 @@ void KVStore::ReconstructLevel(
 }
 
 /**
- * @Description: Special case handling for Compaction at level-0.
- *               Uses priority queue to do multi-way merge
- *               Handles the creation of the first level, if it does not exist
+ * @Description: Mark an SST compacted away, so that its file is removed, and
+ * the removal logged, along with the last reference to it.
+ * @param sst_ptr: The SST.
+ */
+void KVStore::MarkObsolete(const SSTableSPtr &sst_ptr) const {
+  sst_ptr->obsolete_ = true;
+  sst_ptr->event_log_ = event_log_;
+}
+
+/**
+ * @Description: Handle Compaction for a tiered level, level-0 included.
+ *               Uses priority queue to do multi-way merge of all its SSTs.
+ *               The result is merged with the overlapping SSTs of a leveled
+ *               next level, or becomes the newest run of a tiered one.
+ * @param level: The number of level that is overflowing currently, which must
+ * have a next level.
+ * @param remove_deletion_mark: A flag that decides whether "~DELETED~"
+ * should be removed
+ * @param lock: Lock on `mutex_`, released while merging.
  */
-void KVStore::CompactionLevel0() {
-  LevelSPtr level0_ptr = ssts_[0];
+void KVStore::CompactionTiered(const size_t level, bool remove_deletion_mark,
+                               std::unique_lock<std::mutex> &lock) {
+  // Flushes may append SSTs to level-0 while merging, so merge a copy of it.
+  Level level_copy = *ssts_[level];
+  const size_t next_level = level + 1;
+  const bool next_level_is_run = IsTiered(next_level);
+  MergeContext ctx = NewMergeContext(next_level, remove_deletion_mark);
+  lock.unlock();
+  EventSpan span(event_log_.get(), "subcompaction",
+                 EventLog::Args().Add("level", level));
+  size_t bytes_read = stats_.bytes_compaction_read;
+  size_t bytes_written = stats_.bytes_compaction_written;
 
   uint64_t min_key = std::numeric_limits<uint64_t>::max();
   uint64_t max_key = std::numeric_limits<uint64_t>::min();
 
   size_t max_timestamp;
 
-  // Put SSts in level-0 into priority queue.
+  // Put SSTs of the level into priority queue.
   std::priority_queue<std::pair<SSTableSPtr, size_t>> pq;
   // Store complete values of all SSTs in advance.
   std::unordered_map<SSTableSPtr, std::shared_ptr<std::vector<StringSPtr>>>
       values;
-  for (const auto &sst_ptr : *level0_ptr) {
+  for (const auto &sst_ptr : level_copy) {
 #ifdef DEBUG
     cout << "================= before merge =================" << endl;
 #endif
@@ -577,7 +2287,9 @@ void KVStore::CompactionLevel0() {
 #endif
 
     pq.push(std::make_pair(sst_ptr, 0));
-    values[sst_ptr] = sst_ptr->Values();
+    values[sst_ptr] =
+        sst_ptr->Values(rate_limiter_.get(), io_backend_.get());
+    stats_.bytes_compaction_read += sst_ptr->file_size_;
 
     uint64_t mi_key = sst_ptr->MinKey();
     uint64_t ma_key = sst_ptr->MaxKey();
@@ -585,15 +2297,13 @@ void KVStore::CompactionLevel0() {
     max_key = ma_key > max_key ? ma_key : max_key;
   }
 
-  max_timestamp = level0_ptr->back()->timestamp_;
+  max_timestamp = level_copy.back()->timestamp_;
 
-  // level-1 needs creating.
-  if (ssts_.size() == 1) {
-    if (!utils::DirExists(kDir + "/level-1")) {
-      utils::Mkdir((kDir + "/level-1").c_str());
-    }
+  if (next_level_is_run) {
+    // The merge result is newer than every run of the next level.
     std::vector<SSTableSPtr> merge_res =
-        MergeSSTLevel0(1, max_timestamp, pq, values);
+        MergeSSTLevel0(max_timestamp, pq, values, ctx);
+    EndCompactionSpan(span, level_copy, merge_res, bytes_read, bytes_written);
 
 #ifdef DEBUG
     cout << "================= merge result =================" << endl;
@@ -602,20 +2312,26 @@ void KVStore::CompactionLevel0() {
     }
 #endif
 
-    ssts_.emplace_back(std::make_shared<Level>(merge_res));
+    lock.lock();
+    LevelSPtr next_level_ptr = std::make_shared<Level>(*ssts_[next_level]);
+    next_level_ptr->insert(next_level_ptr->end(), merge_res.begin(),
+                           merge_res.end());
+    ssts_[next_level] = next_level_ptr;
   } else {
-    LevelSPtr level1_ptr = ssts_[1];
-    size_t level1_size = level1_ptr->size();
+    LevelSPtr next_level_ptr = ssts_[next_level];
+    size_t next_level_size = next_level_ptr->size();
     std::set<SSTableSPtr> next_level_discard;
 
     // Search for overlapping interval.
-    long start_idx = LowerBound(level1_ptr, min_key);
-    for (long i = start_idx; i < level1_size; ++i) {
-      SSTableSPtr sst_ptr = level1_ptr->at(i);
+    long start_idx = LowerBound(next_level_ptr, min_key);
+    for (long i = start_idx; i < next_level_size; ++i) {
+      SSTableSPtr sst_ptr = next_level_ptr->at(i);
       Timestamp ts = sst_ptr->timestamp_;
       if (sst_ptr->MinKey() <= max_key) {
         pq.push(make_pair(sst_ptr, 0));
-        values[sst_ptr] = sst_ptr->Values();
+        values[sst_ptr] =
+        sst_ptr->Values(rate_limiter_.get(), io_backend_.get());
+        stats_.bytes_compaction_read += sst_ptr->file_size_;
         next_level_discard.insert(sst_ptr);
         max_timestamp = ts > max_timestamp ? ts : max_timestamp;
       } else {
@@ -624,22 +2340,38 @@ void KVStore::CompactionLevel0() {
     }
 
     std::vector<SSTableSPtr> merge_result =
-        MergeSSTLevel0(1, max_timestamp, pq, values);
+        MergeSSTLevel0(max_timestamp, pq, values, ctx);
+    Level inputs = level_copy;
+    inputs.insert(inputs.end(), next_level_discard.begin(),
+                  next_level_discard.end());
+    EndCompactionSpan(span, inputs, merge_result, bytes_read, bytes_written);
 #ifdef DEBUG
     cout << "================= merge result =================" << endl;
     for (auto i : mergeResult) {
       cout << *i << endl;
     }
 #endif
-    ReconstructLevel(1, next_level_discard, merge_result);
+    lock.lock();
+    ReconstructLevel(next_level, next_level_discard, merge_result);
   }
 
-  ssts_[0]->clear();
+  // Drop the merged SSTs, which are still the oldest of the level. They are
+  // not told apart by a set, since SSTs of a tiered level may share min keys.
+  LevelSPtr new_level_ptr = std::make_shared<Level>(
+      ssts_[level]->begin() + (long)level_copy.size(), ssts_[level]->end());
+  for (const SSTableSPtr &sst_ptr : level_copy) {
+    MarkObsolete(sst_ptr);
+  }
+  ssts_[level] = new_level_ptr;
+  InstallVersion();
+  ++stats_.num_compactions;
 }
 
 /**
  * @Description Rebuild a level of SSTablePtr with information of SSTs to
- * discard at the upper level and SSTs to add at the lower level.
+ * discard at the upper level and SSTs to add at the lower level. The caller
+ * installs the new version, along with the removal of the merged SSTs from the
+ * upper level.
  * @param level: The number of level to reconstruct, starting at 0.
  * @param sst_to_discard: A set of SSTPtr to delete in this level.
  * @param merge_result: A vector of SSTPtr to add to this level.
@@ -648,7 +2380,10 @@ void KVStore::ReconstructLevel(const size_t level,
                                std::set<SSTableSPtr> &sst_to_discard,
                                std::vector<SSTableSPtr> &merge_result) {
   LevelSPtr level_ptr = ssts_[level];
-  uint64_t min_result_key = merge_result[0]->MinKey();
+  // The merge result may be empty if all keys are deleted.
+  uint64_t min_result_key = merge_result.empty()
+                                ? std::numeric_limits<uint64_t>::max()
+                                : merge_result[0]->MinKey();
 
   LevelSPtr new_level_ptr = std::make_shared<Level>();
   size_t level_size = level_ptr->size();
@@ -658,6 +2393,9 @@ void KVStore::ReconstructLevel(const size_t level,
       new_level_ptr->emplace_back(level_ptr->at(i));
     }
   }
+  for (const SSTableSPtr &sst_ptr : sst_to_discard) {
+    MarkObsolete(sst_ptr);
+  }
 
   new_level_ptr->insert(new_level_ptr->end(), merge_result.begin(),
                         merge_result.end());
@@ -673,8 +2411,9 @@ void KVStore::ReconstructLevel(const size_t level,
 /**
  * @Description: When doing compaction for levels other than level 0,
  * find out the SSTs that overflow, which should be deleted after the merge
- * Strategy for choosing overflowing SST: Pick ones with the least timestamp,
- * if two SSTs have, the same timestamp, pick the one with smaller keys.
+ * Strategy for choosing overflowing SST: Pick ones with the least score given
+ * by the pick policy, if two SSTs have the same score, pick the one with the
+ * least timestamp, then the one with smaller keys.
  *
  * This is essentially a min-K problem.
  * @param level: The upper level for compaction.
@@ -683,19 +2422,31 @@ void KVStore::ReconstructLevel(const size_t level,
  */
 std::shared_ptr<std::set<SSTableSPtr>> KVStore::SSTForCompaction(
     const size_t level, const size_t num_overlapping_sst) {
+  if (pick_policy_ == CompactionPickPolicy::kRoundRobin) {
+    return SSTForCompactionRoundRobin(level, num_overlapping_sst);
+  }
+
   auto ret = std::make_shared<std::set<SSTableSPtr>>();
-  auto comparator = [](const SSTableSPtr &t1, const SSTableSPtr &t2) {
-    return t1->timestamp_ < t2->timestamp_ ||
-           (t1->timestamp_ == t2->timestamp_ && t1->min_key_ < t2->min_key_);
+  LevelSPtr level_ptr = ssts_[level];
+  size_t level_size = level_ptr->size();
+
+  std::unordered_map<SSTableSPtr, double> scores;
+  for (int i = 0; i < level_size; ++i) {
+    scores[level_ptr->at(i)] = PickScore(level, level_ptr->at(i));
+  }
+
+  auto comparator = [&scores](const SSTableSPtr &t1, const SSTableSPtr &t2) {
+    double s1 = scores[t1];
+    double s2 = scores[t2];
+    return s1 < s2 || (s1 == s2 && t1->timestamp_ < t2->timestamp_) ||
+           (s1 == s2 && t1->timestamp_ == t2->timestamp_ &&
+            t1->min_key_ < t2->min_key_);
   };
 
   std::priority_queue<SSTableSPtr, std::vector<SSTableSPtr>,
                       decltype(comparator)>
       pq(comparator);
 
-  LevelSPtr level_ptr = ssts_[level];
-  size_t level_size = level_ptr->size();
-
   for (int i = 0; i < level_size; ++i) {
     pq.push(level_ptr->at(i));
     if (pq.size() > num_overlapping_sst) {
@@ -711,24 +2462,91 @@ std::shared_ptr<std::set<SSTableSPtr>> KVStore::SSTForCompaction(
   return ret;
 }
 
+/**
+ * @Description: Score an SST for picking, the lower the sooner it is picked.
+ * @param level: The level the SST is in.
+ * @param sst_ptr: The SST to score.
+ * @return: The score under the pick policy of the store.
+ */
+double KVStore::PickScore(const size_t level,
+                          const SSTableSPtr &sst_ptr) const {
+  switch (pick_policy_) {
+    case CompactionPickPolicy::kMinOverlappingRatio: {
+      if (level + 1 >= ssts_.size()) {
+        return 0;
+      }
+      // Bytes of the next level rewritten along with this SST.
+      const LevelSPtr &next_level_ptr = ssts_[level + 1];
+      size_t overlapping_bytes = 0;
+      size_t next_level_size = next_level_ptr->size();
+      for (long i = LowerBound(next_level_ptr, sst_ptr->min_key_);
+           i < next_level_size; ++i) {
+        const SSTableSPtr &next_level_sst_ptr = next_level_ptr->at(i);
+        if (next_level_sst_ptr->min_key_ > sst_ptr->max_key_) {
+          break;
+        }
+        overlapping_bytes += next_level_sst_ptr->file_size_;
+      }
+      return (double)overlapping_bytes / (double)sst_ptr->file_size_;
+    }
+    case CompactionPickPolicy::kMostTombstones:
+      return -(double)sst_ptr->num_deletions_;
+    default:
+      return 0;
+  }
+}
+
+/**
+ * @Description: Pick the SSTs that follow the cursor of the level in key
+ * order, wrapping around at the end of the level, and move the cursor past
+ * them.
+ * @param level: The upper level for compaction.
+ * @param num_overlapping_sst: Number of SSTs that overflow.
+ * @return: A pointer to a set of SSTs, they are sorted by min key.
+ */
+std::shared_ptr<std::set<SSTableSPtr>> KVStore::SSTForCompactionRoundRobin(
+    const size_t level, const size_t num_overlapping_sst) {
+  auto ret = std::make_shared<std::set<SSTableSPtr>>();
+  LevelSPtr level_ptr = ssts_[level];
+  size_t level_size = level_ptr->size();
+  if (!level_size) {
+    return ret;
+  }
+
+  if (compact_cursor_.size() <= level) {
+    compact_cursor_.resize(level + 1, std::numeric_limits<uint64_t>::max());
+  }
+  uint64_t &cursor = compact_cursor_[level];
+
+  size_t idx = cursor == std::numeric_limits<uint64_t>::max()
+                   ? 0
+                   : LowerBound(level_ptr, cursor + 1) % level_size;
+  for (size_t i = 0; i < num_overlapping_sst && i < level_size; ++i) {
+    const SSTableSPtr &sst_ptr = level_ptr->at(idx);
+    ret->insert(sst_ptr);
+    cursor = sst_ptr->max_key_;
+    idx = (idx + 1) % level_size;
+  }
+
+  return ret;
+}
+
 /**
  * @Description: Merging routine for levels other than level 0, using 2-way
  * merging
- * @param level: The number of upper level of Compaction
  * @param max_timestamp: The timestamp for all SSTs that are created
  * @param sst: The SST at the upper level
  * @param overlap: The SSTs whose key range overlaps with <sst>
  * @param all_values: The values for all SSTs concerned
- * @param remove_deletion_mark: A flag indicating whether deletion marks
- * should be removed
+ * @param ctx: The level to merge to, and what decides the versions to keep.
  * @return A vector of SST pointers as the result of the merge
  */
 std::vector<SSTableSPtr> KVStore::MergeSST(
-    const size_t level, const size_t max_timestamp, const SSTableSPtr &sst,
+    const size_t max_timestamp, const SSTableSPtr &sst,
     std::vector<SSTableSPtr> &overlap,
     std::unordered_map<SSTableSPtr, std::shared_ptr<std::vector<StringSPtr>>>
         &all_values,
-    bool remove_deletion_mark) {
+    MergeContext &ctx) {
 #ifdef DEBUG
   cout << "================= merge from =================" << endl;
   cout << *sst << endl;
@@ -736,8 +2554,8 @@ std::vector<SSTableSPtr> KVStore::MergeSST(
     cout << **sstPtr;
 #endif
 
+    const size_t level = ctx.level;
     std::vector<SSTableSPtr> ret;
-    std::unordered_set<uint64_t> duplicate_checker;
 
     size_t num_overlap = overlap.size();
 
@@ -788,76 +2606,73 @@ std::vector<SSTableSPtr> KVStore::MergeSST(
       // In each loop, Put one key into the new SST.
       while (should_continue_merge()) {
         uint64_t key;
+        SequenceNumber seq;
         bool choose_sst = false;
 
-        // Decide which sequence to choose the next key from.
+        // Decide which sequence to choose the next key from. Of two versions
+        // of a key, the newer goes first.
         if (idx_in_sst < num_sst_key && idx_in_overlap < num_overlap) {
           uint64_t key1 = sst->keys_[idx_in_sst];
           uint64_t key2 = cur_overlap_sst_ptr->keys_[idx_in_keys_in_overlap];
-          if (key1 <= key2) {
+          SequenceNumber seq1 = sst->seqs_[idx_in_sst];
+          SequenceNumber seq2 =
+              cur_overlap_sst_ptr->seqs_[idx_in_keys_in_overlap];
+          if (key1 < key2 || (key1 == key2 && seq1 > seq2)) {
             choose_sst = true;
             key = key1;
+            seq = seq1;
           } else {
             key = key2;
+            seq = seq2;
           }
         } else if (idx_in_sst >= num_sst_key) {
           // Data remaining in SST.
           key = cur_overlap_sst_ptr->keys_[idx_in_keys_in_overlap];
+          seq = cur_overlap_sst_ptr->seqs_[idx_in_keys_in_overlap];
         } else {
           // Data remaining in overlapping SSTs.
           key = sst->keys_[idx_in_sst];
+          seq = sst->seqs_[idx_in_sst];
           choose_sst = true;
         }
 
-        // Check for duplicate key, only handle error case.
-        if (duplicate_checker.count(key)) {
-          increment_idx(choose_sst);
-          continue;
-        }
-
         // Get value, which cannot possibly be null.
         StringSPtr value =
             choose_sst
                 ? all_values[sst]->at(idx_in_sst)
                 : all_values[cur_overlap_sst_ptr]->at(idx_in_keys_in_overlap);
 
-        // Check deletion mark.
-        if (remove_deletion_mark && *value == kDeletionMark) {
-          increment_idx(choose_sst);
-          continue;
-        }
-
-        // Check file size.
+        // Check file size. The versions of a key stay in one SST.
         size_t new_file_size = file_size + kIndexSizePerValue + value->size();
-        if (new_file_size > kMaxSSTableSize) {
-          Save(new_sst_ptr, file_size, num_keys, min_key, max_key, values);
+        if (new_file_size > kMaxSSTableSize && num_keys && key != max_key) {
+          Save(new_sst_ptr, num_keys, min_key, max_key, values);
           ret.emplace_back(new_sst_ptr);
           break;
         }
 
+        if (!KeepVersion(ctx, key, seq, value)) {
+          increment_idx(choose_sst);
+          continue;
+        }
+
         // Pass all check, write data.
         new_sst_ptr->keys_.emplace_back(key);
+        new_sst_ptr->seqs_.emplace_back(seq);
         new_sst_ptr->bloom_filter_.Put(key);
         ++num_keys;
         max_key = key;
         min_key = key < min_key ? key : min_key;
         values.emplace_back(value);
-        file_size = new_file_size;
+        file_size += kIndexSizePerValue + value->size();
         increment_idx(choose_sst);
-        duplicate_checker.insert(key);
       }
 
       if (!should_continue_merge() && !values.empty()) {
-        Save(new_sst_ptr, file_size, num_keys, min_key, max_key, values);
+        Save(new_sst_ptr, num_keys, min_key, max_key, values);
         ret.emplace_back(new_sst_ptr);
       }
     }
 
-    // after merging, delete all files
-    utils::Rmfile(sst->file_path_.c_str());
-    for (const SSTableSPtr &sstPtr : overlap) {
-      utils::Rmfile(sstPtr->file_path_.c_str());
-    }
     return ret;
   }
 
@@ -0,0 +1,80 @@
+#include "../include/range_tombstone.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <system_error>
+
+/**
+ * @Description: Read the range tombstones of a store, an empty list if the
+ * file does not exist.
+ * @param file_path: Full(relative) path to the file on disk
+ */
+RangeTombstoneList *RangeTombstoneList::FromFile(
+    const std::string &file_path) {
+  auto *list = new RangeTombstoneList();
+  std::ifstream in_file(file_path, std::ios::binary);
+  if (!in_file) {
+    return list;
+  }
+
+  uint64_t num_tombstones = 0;
+  in_file.read((char *)&num_tombstones, 8);
+  list->tombstones_.resize(num_tombstones);
+  for (RangeTombstone &tombstone : list->tombstones_) {
+    in_file.read((char *)&tombstone.begin, 8)
+        .read((char *)&tombstone.end, 8)
+        .read((char *)&tombstone.seq, 8);
+  }
+  return list;
+}
+
+/**
+ * @Description: Persist the range tombstones, replacing the file. The list is
+ * written to a temporary file that is renamed over the old one, so that a
+ * crash or a failed write never leaves the file half written.
+ * @param file_path: Full(relative) path to the file on disk
+ */
+void RangeTombstoneList::ToFile(const std::string &file_path) const {
+  std::string tmp_path = file_path + ".tmp";
+  std::ofstream out_file(tmp_path, std::ios::out | std::ios::binary);
+  uint64_t num_tombstones = tombstones_.size();
+  out_file.write((char *)&num_tombstones, 8);
+  for (const RangeTombstone &tombstone : tombstones_) {
+    out_file.write((char *)&tombstone.begin, 8)
+        .write((char *)&tombstone.end, 8)
+        .write((char *)&tombstone.seq, 8);
+  }
+  out_file.close();
+  if (!out_file || std::rename(tmp_path.c_str(), file_path.c_str())) {
+    int error = errno;
+    std::remove(tmp_path.c_str());
+    throw std::system_error(error, std::generic_category(),
+                            "RangeTombstoneList::ToFile: " + file_path);
+  }
+}
+
+void RangeTombstoneList::Add(const uint64_t begin, const uint64_t end,
+                             const SequenceNumber seq) {
+  if (begin < end) {
+    tombstones_.push_back(RangeTombstone{begin, end, seq});
+  }
+}
+
+bool RangeTombstoneList::Covers(const uint64_t key,
+                                const SequenceNumber entry_seq,
+                                const SequenceNumber snapshot) const {
+  for (const RangeTombstone &tombstone : tombstones_) {
+    if (tombstone.Covers(key, entry_seq, snapshot)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+SequenceNumber RangeTombstoneList::MaxSequence() const {
+  SequenceNumber ret = 0;
+  for (const RangeTombstone &tombstone : tombstones_) {
+    ret = tombstone.seq > ret ? tombstone.seq : ret;
+  }
+  return ret;
+}
@@ -0,0 +1,137 @@
+#include "../include/rate_limiter.h"
+
+#include <algorithm>
+
+RateLimiter::RateLimiter(size_t bytes_per_sec, bool auto_tuned,
+                         size_t debt_for_full_speed,
+                         std::chrono::microseconds refill_period)
+    : max_bytes_per_sec_(bytes_per_sec),
+      bytes_per_sec_(bytes_per_sec),
+      kAutoTuned(auto_tuned),
+      kDebtForFullSpeed(debt_for_full_speed),
+      kRefillPeriod(refill_period),
+      total_bytes_through_() {
+  Tune();
+  available_bytes_ = RefillBytes();
+  next_refill_ = Clock::now() + kRefillPeriod;
+}
+
+/**
+ * @Description: Block until the bucket holds enough tokens for the request,
+ * and all requests of higher priority or queued earlier are served.
+ * @param bytes: Number of bytes about to be read or written.
+ * @param priority: Priority of the I/O.
+ */
+void RateLimiter::Request(size_t bytes, IOPriority priority) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto &queue = queues_[static_cast<size_t>(priority)];
+  total_bytes_through_[static_cast<size_t>(priority)] += bytes;
+
+  while (bytes) {
+    // Split the request into rounds no larger than one refill.
+    PendingRequest request{std::min(bytes, RefillBytes()), false};
+    bytes -= request.bytes;
+    queue.push_back(&request);
+    GrantRequests();
+
+    while (!request.granted) {
+      Clock::time_point now = Clock::now();
+      if (now >= next_refill_) {
+        Refill(now);
+        GrantRequests();
+      } else {
+        cv_.wait_until(lock, next_refill_);
+      }
+    }
+  }
+}
+
+void RateLimiter::SetBytesPerSecond(size_t bytes_per_sec) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  max_bytes_per_sec_ = bytes_per_sec;
+  Tune();
+}
+
+size_t RateLimiter::BytesPerSecond() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return bytes_per_sec_;
+}
+
+void RateLimiter::ReportPendingCompactionBytes(const void *source,
+                                               size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (bytes) {
+    pending_compaction_bytes_[source] = bytes;
+  } else {
+    pending_compaction_bytes_.erase(source);
+  }
+  Tune();
+}
+
+size_t RateLimiter::TotalBytesThrough(IOPriority priority) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return total_bytes_through_[static_cast<size_t>(priority)];
+}
+
+/**
+ * @Description: Number of tokens put in the bucket every refill period, which
+ * is also the size of the bucket.
+ */
+size_t RateLimiter::RefillBytes() const {
+  double period_sec = std::chrono::duration<double>(kRefillPeriod).count();
+  size_t refill = (size_t)((double)bytes_per_sec_ * period_sec);
+  return refill ? refill : 1;
+}
+
+void RateLimiter::Refill(Clock::time_point now) {
+  available_bytes_ = std::min(available_bytes_ + RefillBytes(), RefillBytes());
+  next_refill_ = now + kRefillPeriod;
+}
+
+/**
+ * @Description: Grant queued requests in priority order as long as there are
+ * tokens left. A request queued before the budget was lowered may be larger
+ * than the bucket, it is granted once the bucket is full.
+ */
+void RateLimiter::GrantRequests() {
+  bool granted = false;
+  for (auto &queue : queues_) {
+    while (!queue.empty()) {
+      PendingRequest *request = queue.front();
+      if (available_bytes_ < std::min(request->bytes, RefillBytes())) {
+        // Lower priorities must not overtake the head of this queue.
+        if (granted) {
+          cv_.notify_all();
+        }
+        return;
+      }
+      available_bytes_ -= std::min(request->bytes, available_bytes_);
+      request->granted = true;
+      granted = true;
+      queue.pop_front();
+    }
+  }
+  if (granted) {
+    cv_.notify_all();
+  }
+}
+
+/**
+ * @Description: Follow the pending compaction debt if auto-tuned, so that
+ * compaction gets more bandwidth as it falls behind.
+ */
+void RateLimiter::Tune() {
+  if (!kAutoTuned) {
+    bytes_per_sec_ = max_bytes_per_sec_;
+    return;
+  }
+
+  size_t debt = 0;
+  for (const auto &source_and_bytes : pending_compaction_bytes_) {
+    debt += source_and_bytes.second;
+  }
+  double ratio = 0.125 + 0.875 * (double)debt / (double)kDebtForFullSpeed;
+  ratio = std::min(ratio, 1.0);
+  bytes_per_sec_ = std::max((size_t)((double)max_bytes_per_sec_ * ratio),
+                            (size_t)1);
+}
@@ -0,0 +1,85 @@
+#include "../include/row_cache.h"
+
+RowCache::RowCache(size_t capacity)
+    : kCapacity(capacity), usage_(0), num_hits_(0), num_misses_(0) {}
+
+/**
+ * @Description: Find a key in the cache, marking it as the most recently used.
+ * @param key: The key to find.
+ * @return: The value as it is stored, `nullptr` if the key is not cached.
+ */
+StringSPtr RowCache::Lookup(const uint64_t key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    ++num_misses_;
+    return nullptr;
+  }
+  ++num_hits_;
+  lru_.splice(lru_.begin(), lru_, it->second);
+  return it->second->second;
+}
+
+/**
+ * @Description: Cache the value of a key, replacing the cached one, and evict
+ * the least recently used entries while the cache is over capacity. A value
+ * larger than the whole cache is not cached.
+ * @param key: The key.
+ * @param value: The value as it is stored.
+ */
+void RowCache::Insert(const uint64_t key, StringSPtr value) {
+  size_t charge = Charge(value);
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(key);
+  if (it != index_.end()) {
+    EraseEntry(it->second);
+  }
+  if (charge > kCapacity) {
+    return;
+  }
+
+  lru_.emplace_front(key, std::move(value));
+  index_[key] = lru_.begin();
+  usage_ += charge;
+  while (usage_ > kCapacity) {
+    EraseEntry(std::prev(lru_.end()));
+  }
+}
+
+void RowCache::Erase(const uint64_t key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(key);
+  if (it != index_.end()) {
+    EraseEntry(it->second);
+  }
+}
+
+/**
+ * @Description: Erase the keys in [begin, end), by a pass over the whole
+ * cache, as range deletions are rare.
+ */
+void RowCache::EraseRange(const uint64_t begin, const uint64_t end) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto it = lru_.begin(); it != lru_.end();) {
+    auto entry = it++;
+    if (entry->first >= begin && entry->first < end) {
+      EraseEntry(entry);
+    }
+  }
+}
+
+void RowCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  lru_.clear();
+  index_.clear();
+  usage_ = 0;
+}
+
+/**
+ * @Description: Drop an entry. The lock must be held.
+ */
+void RowCache::EraseEntry(const LruList::iterator entry) {
+  usage_ -= Charge(entry->second);
+  index_.erase(entry->first);
+  lru_.erase(entry);
+}
@@ -0,0 +1,336 @@
+#include "../include/sharded_kvstore.h"
+
+#include <cstdio>
+
+static const std::string kManifestFile = "shards";
+
+const size_t ShardedKVStore::kNumKeySamples;
+
+/**
+ * @Description: Open the shards listed in the manifest of `dir`, or create
+ * `num_shards` shards of even key ranges if there is none.
+ * @param dir: Base directory, with one sub-directory per shard.
+ * @param sharding_options: How the key space is split into shards.
+ * @param options: Tuning knobs of every shard.
+ */
+ShardedKVStore::ShardedKVStore(const std::string &dir,
+                               const ShardingOptions &sharding_options,
+                               const Options &options)
+    : KVStoreAPI(dir),
+      kDir(dir),
+      kShardingOptions(sharding_options),
+      options_(options),
+      next_shard_id_(0),
+      num_writes_(0) {
+  if (!options_.thread_pool) {
+    options_.thread_pool =
+        std::make_shared<ThreadPool>(std::thread::hardware_concurrency());
+  }
+  // Shards count into the same statistics, for totals over the store.
+  if (!options_.statistics) {
+    options_.statistics = std::make_shared<Statistics>();
+  }
+  // Shards hold disjoint keys, so they share one row cache, of the capacity
+  // the options give for the store as a whole.
+  if (!options_.row_cache && options_.row_cache_capacity) {
+    options_.row_cache =
+        std::make_shared<RowCache>(options_.row_cache_capacity);
+  }
+  if (!utils::DirExists(dir)) {
+    utils::Mkdir(dir.c_str());
+  }
+
+  // Each line of the manifest holds the first key and the id of a shard.
+  std::ifstream manifest(kDir + "/" + kManifestFile);
+  uint64_t first_key;
+  uint64_t id;
+  while (manifest >> first_key >> id) {
+    shards_[first_key] = OpenShard(id);
+    next_shard_id_ = id >= next_shard_id_ ? id + 1 : next_shard_id_;
+  }
+
+  if (shards_.empty()) {
+    size_t num_shards =
+        kShardingOptions.num_shards ? kShardingOptions.num_shards : 1;
+    uint64_t range_size = std::numeric_limits<uint64_t>::max() / num_shards;
+    for (size_t i = 0; i < num_shards; ++i) {
+      shards_[range_size * i] = OpenShard(next_shard_id_++);
+    }
+    WriteManifest();
+  }
+}
+
+void ShardedKVStore::Put(const uint64_t key, const std::string &s) {
+  bool should_check;
+  {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex_);
+    Shard &shard = ShardFor(key);
+    shard.store->Put(key, s);
+    should_check = RecordWrite(shard, key);
+  }
+  if (should_check) {
+    MaybeSplit();
+  }
+}
+
+std::string ShardedKVStore::Get(const uint64_t key) {
+  std::shared_lock<std::shared_timed_mutex> lock(mutex_);
+  return ShardFor(key).store->Get(key);
+}
+
+/**
+ * @Description: Find by many keys at once, with a `MultiGet` per shard.
+ */
+std::vector<std::string> ShardedKVStore::MultiGet(
+    const std::vector<uint64_t> &keys) {
+  std::shared_lock<std::shared_timed_mutex> lock(mutex_);
+  // Positions of the keys of every shard.
+  std::unordered_map<Shard *, std::vector<size_t>> positions;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    positions[&ShardFor(keys[i])].push_back(i);
+  }
+
+  std::vector<std::string> ret(keys.size());
+  for (const auto &shard_and_positions : positions) {
+    const std::vector<size_t> &shard_positions = shard_and_positions.second;
+    std::vector<uint64_t> shard_keys;
+    shard_keys.reserve(shard_positions.size());
+    for (size_t pos : shard_positions) {
+      shard_keys.push_back(keys[pos]);
+    }
+
+    std::vector<std::string> values =
+        shard_and_positions.first->store->MultiGet(shard_keys);
+    for (size_t i = 0; i < shard_positions.size(); ++i) {
+      ret[shard_positions[i]] = std::move(values[i]);
+    }
+  }
+  return ret;
+}
+
+bool ShardedKVStore::Del(const uint64_t key) {
+  bool ret;
+  bool should_check;
+  {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex_);
+    Shard &shard = ShardFor(key);
+    ret = shard.store->Del(key);
+    should_check = RecordWrite(shard, key);
+  }
+  if (should_check) {
+    MaybeSplit();
+  }
+  return ret;
+}
+
+/**
+ * @Description: Delete all key-value pairs in [begin, end), with a range
+ * tombstone in every shard the range overlaps.
+ */
+void ShardedKVStore::DeleteRange(const uint64_t begin, const uint64_t end) {
+  if (begin >= end) {
+    return;
+  }
+
+  std::shared_lock<std::shared_timed_mutex> lock(mutex_);
+  auto shard_it = std::prev(shards_.upper_bound(begin));
+  for (; shard_it != shards_.end() && shard_it->first < end; ++shard_it) {
+    auto next_it = std::next(shard_it);
+    uint64_t shard_begin = std::max(begin, shard_it->first);
+    uint64_t shard_end =
+        next_it == shards_.end() ? end : std::min(end, next_it->first);
+    shard_it->second->store->DeleteRange(shard_begin, shard_end);
+  }
+}
+
+void ShardedKVStore::Merge(const uint64_t key, const std::string &operand) {
+  bool should_check;
+  {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex_);
+    Shard &shard = ShardFor(key);
+    shard.store->Merge(key, operand);
+    should_check = RecordWrite(shard, key);
+  }
+  if (should_check) {
+    MaybeSplit();
+  }
+}
+
+/**
+ * @Description: Collect the live key-value pairs in [begin, end), shard by
+ * shard in the order of their ranges.
+ */
+std::vector<std::pair<uint64_t, std::string>> ShardedKVStore::Scan(
+    const uint64_t begin, const uint64_t end) {
+  std::vector<std::pair<uint64_t, std::string>> ret;
+  if (begin >= end) {
+    return ret;
+  }
+
+  std::shared_lock<std::shared_timed_mutex> lock(mutex_);
+  auto shard_it = std::prev(shards_.upper_bound(begin));
+  for (; shard_it != shards_.end() && shard_it->first < end; ++shard_it) {
+    auto next_it = std::next(shard_it);
+    uint64_t shard_begin = std::max(begin, shard_it->first);
+    uint64_t shard_end =
+        next_it == shards_.end() ? end : std::min(end, next_it->first);
+    std::vector<std::pair<uint64_t, std::string>> entries =
+        shard_it->second->store->Scan(shard_begin, shard_end);
+    ret.insert(ret.end(), std::make_move_iterator(entries.begin()),
+               std::make_move_iterator(entries.end()));
+  }
+  return ret;
+}
+
+/**
+ * @Description: Remove all key-value pairs, keeping the shards.
+ */
+void ShardedKVStore::Reset() {
+  std::unique_lock<std::shared_timed_mutex> lock(mutex_);
+  for (auto &first_key_and_shard : shards_) {
+    first_key_and_shard.second->store->Reset();
+    first_key_and_shard.second->num_writes = 0;
+  }
+}
+
+size_t ShardedKVStore::NumShards() const {
+  std::shared_lock<std::shared_timed_mutex> lock(mutex_);
+  return shards_.size();
+}
+
+/**
+ * @Description: Find the shard whose range holds a key. The lock must be held.
+ */
+ShardedKVStore::Shard &ShardedKVStore::ShardFor(const uint64_t key) {
+  return *std::prev(shards_.upper_bound(key))->second;
+}
+
+/**
+ * @Description: Count a write to a shard, and sample its key.
+ * @return: `true` iff it is time to check for hot shards.
+ */
+bool ShardedKVStore::RecordWrite(Shard &shard, const uint64_t key) {
+  ++shard.num_writes;
+  shard.key_samples[shard.num_key_samples++ % kNumKeySamples] = key;
+  return ++num_writes_ % kShardingOptions.split_check_interval == 0;
+}
+
+/**
+ * @Description: Split the shard that took the most writes since the last
+ * check, if it is hot, and start counting again.
+ */
+void ShardedKVStore::MaybeSplit() {
+  std::unique_lock<std::shared_timed_mutex> lock(mutex_);
+
+  size_t total_writes = 0;
+  size_t hottest_writes = 0;
+  ShardIterator hottest = shards_.end();
+  for (auto it = shards_.begin(); it != shards_.end(); ++it) {
+    size_t num_writes = it->second->num_writes.exchange(0);
+    total_writes += num_writes;
+    if (num_writes > hottest_writes) {
+      hottest_writes = num_writes;
+      hottest = it;
+    }
+  }
+
+  if (hottest == shards_.end() ||
+      shards_.size() >= kShardingOptions.max_shards) {
+    return;
+  }
+  double fair_share = (double)total_writes / (double)shards_.size();
+  if ((double)hottest_writes <= kShardingOptions.hot_shard_ratio * fair_share) {
+    return;
+  }
+
+  // Split at the median of the sampled keys, leaving out the ones sampled
+  // before an earlier split moved them away.
+  Shard &shard = *hottest->second;
+  uint64_t first = hottest->first;
+  auto next_it = std::next(hottest);
+  std::vector<uint64_t> samples;
+  size_t num_samples = std::min(shard.num_key_samples.load(), kNumKeySamples);
+  for (size_t i = 0; i < num_samples; ++i) {
+    uint64_t key = shard.key_samples[i];
+    if (key >= first && (next_it == shards_.end() || key < next_it->first)) {
+      samples.emplace_back(key);
+    }
+  }
+  if (samples.empty()) {
+    return;
+  }
+
+  auto median_it = samples.begin() + (long)samples.size() / 2;
+  std::nth_element(samples.begin(), median_it, samples.end());
+  uint64_t split_key = *median_it;
+  // A single hot key at the start of the range is moved to a shard of its
+  // own.
+  if (split_key == first && first < std::numeric_limits<uint64_t>::max()) {
+    ++split_key;
+  }
+  if (split_key > first &&
+      (next_it == shards_.end() || split_key < next_it->first)) {
+    Split(hottest, split_key);
+  }
+}
+
+/**
+ * @Description: Move the keys of a shard from `split_key` on to a new shard.
+ * The exclusive lock must be held.
+ * @param shard_it: The shard to split.
+ * @param split_key: First key of the new shard.
+ */
+void ShardedKVStore::Split(const ShardIterator shard_it,
+                           const uint64_t split_key) {
+  Shard &parent = *shard_it->second;
+  auto next_it = std::next(shard_it);
+  uint64_t last = next_it == shards_.end()
+                      ? std::numeric_limits<uint64_t>::max()
+                      : next_it->first - 1;
+
+  // Files may be left over by a split that crashed before the manifest was
+  // written.
+  ShardSPtr child = OpenShard(next_shard_id_++);
+  child->store->Reset();
+  child->store->ImportRange(parent.store->ExportRange(split_key, last));
+
+  shards_[split_key] = child;
+  WriteManifest();
+
+  // The parent no longer serves the moved keys, drop them.
+  if (last < std::numeric_limits<uint64_t>::max()) {
+    parent.store->DeleteRange(split_key, last + 1);
+  } else {
+    parent.store->DeleteRange(split_key, last);
+    parent.store->Del(last);
+  }
+  parent.num_key_samples = 0;
+}
+
+/**
+ * @Description: Open the store of a shard.
+ */
+ShardedKVStore::ShardSPtr ShardedKVStore::OpenShard(const uint64_t id) const {
+  auto shard = std::make_shared<Shard>();
+  shard->id = id;
+  shard->store.reset(
+      new KVStore(kDir + "/shard-" + std::to_string(id), options_));
+  return shard;
+}
+
+/**
+ * @Description: Persist the shard ranges. The manifest is replaced with a
+ * rename, so it never ends up half written.
+ */
+void ShardedKVStore::WriteManifest() const {
+  std::string path = kDir + "/" + kManifestFile;
+  std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream manifest(tmp_path);
+    for (const auto &first_key_and_shard : shards_) {
+      manifest << first_key_and_shard.first << " "
+               << first_key_and_shard.second->id << std::endl;
+    }
+  }
+  std::rename(tmp_path.c_str(), path.c_str());
+}
@@ -4,6 +4,9 @@ SkipList::SkipList() {
   size_ = 0;
   file_size_ = kSSTHeaderSize + kBloomFilterSize;  // header and bloom filter
   head_ = std::make_shared<Node>();
+  tails_ = {head_};
+  finger_ = {head_};
+  finger_key_ = 0;
 }
 
 SkipList::~SkipList() {
@@ -24,7 +27,7 @@ SkipList::~SkipList() {
 
 __attribute__((unused)) size_t SkipList::Size() const { return size_; }
 
-__attribute__((unused)) size_t SkipList::FileSize() const { return file_size_; }
+size_t SkipList::FileSize() const { return file_size_; }
 
 SkipList::Value *SkipList::Get(const Key &key) const {
   if (!bloom_filter_.IsProbablyPresent(key)) {
@@ -39,24 +42,121 @@ SkipList::Value *SkipList::Get(const Key &key) const {
   return nullptr;
 }
 
-void SkipList::Put(const Key key, const Value &value) {
-  std::stack<NodeSPtr> path_stack;
-  NodeSPtr p = head_;
-  while (p) {
-    while (p->right_ && p->right_->key_ < key) {
-      p = p->right_;
+/**
+ * @Description: Find the newest version of a key as of a snapshot.
+ * @param key: The key to find with.
+ * @param snapshot: Versions of a greater sequence number are skipped.
+ * @param seq: Set to the sequence number of the version found.
+ * @return: Pointer to the value, `nullptr` if the key has no version as of the
+ * snapshot.
+ */
+const SkipList::Value *SkipList::Get(const Key &key,
+                                     const SequenceNumber snapshot,
+                                     SequenceNumber *seq) const {
+  if (!bloom_filter_.IsProbablyPresent(key)) {
+    return nullptr;
+  }
+
+  NodeSPtr node = NodeByKey(key);
+  return node ? VersionAt(*node, snapshot, seq) : nullptr;
+}
+
+/**
+ * @Description: Find the newest versions of many keys as of a snapshot. The
+ * searches go down the list side by side, taking one step each in turn. A step
+ * prefetches the node its search reads next, and the steps of the other
+ * searches run while it loads, instead of each search stalling on every node.
+ * @param keys: The keys to find with.
+ * @param n: Number of keys.
+ * @param snapshot: Versions of a greater sequence number are skipped.
+ * @param values: Set to pointers to the values, `nullptr` for the keys without
+ * a version as of the snapshot.
+ * @param seqs: Set to the sequence numbers of the versions found.
+ */
+void SkipList::Get(const Key *keys, const size_t n,
+                   const SequenceNumber snapshot, const Value **values,
+                   SequenceNumber *seqs) const {
+  std::unique_ptr<bool[]> probably_present(new bool[n]);
+  bloom_filter_.IsProbablyPresent(keys, n, probably_present.get());
+
+  // A search stands on `node`. `right` is its right neighbour, loaded by the
+  // next step if `fetch_right`, i.e. right after going down.
+  struct Search {
+    size_t idx;
+    const Node *node;
+    const Node *right;
+    bool fetch_right;
+  };
+  // Both the key and the links of a node are read, which may not share a
+  // cache line.
+  auto prefetch = [](const Node *node) {
+    if (node) {
+      __builtin_prefetch(&node->key_);
+      __builtin_prefetch(&node->right_);
     }
-    path_stack.push(p);
-    p = p->down_;
+  };
+
+  std::vector<Search> searches;
+  searches.reserve(n);
+  prefetch(head_.get());
+  for (size_t i = 0; i < n; ++i) {
+    values[i] = nullptr;
+    if (probably_present[i]) {
+      searches.push_back(Search{i, head_.get(), nullptr, true});
+    }
+  }
+  while (!searches.empty()) {
+    size_t num_active = 0;
+    for (Search search : searches) {
+      const Key key = keys[search.idx];
+      if (search.fetch_right) {
+        search.right = search.node->right_.get();
+        search.fetch_right = false;
+        prefetch(search.right);
+      } else if (search.right && search.right->key_ < key) {
+        search.node = search.right;
+        search.right = search.node->right_.get();
+        prefetch(search.right);
+      } else if (search.right && search.right->key_ == key) {
+        values[search.idx] =
+            VersionAt(*search.right, snapshot, &seqs[search.idx]);
+        continue;
+      } else {
+        search.node = search.node->down_.get();
+        if (!search.node) {
+          continue;
+        }
+        search.fetch_right = true;
+        prefetch(search.node);
+      }
+      searches[num_active++] = search;
+    }
+    searches.resize(num_active);
   }
+}
+
+/**
+ * @Description: Insert or replace the value of a key. The replaced version is
+ * kept if a snapshot may read it, i.e. if it is not newer than the newest
+ * snapshot.
+ * @param key: The key.
+ * @param value: The new value.
+ * @param seq: Sequence number of the write.
+ * @param newest_snapshot: Sequence number of the newest snapshot, 0 if there
+ * is none.
+ */
+void SkipList::Put(const Key key, const Value &value, const SequenceNumber seq,
+                   const SequenceNumber newest_snapshot) {
+  Seek(key);
 
   // 替换，_size不变，_fileSize改变
-  NodeSPtr node_to_insert =
-      path_stack.empty() ? nullptr : path_stack.top()->right_;
+  NodeSPtr node_to_insert = finger_[0]->right_;
   if (node_to_insert && node_to_insert->key_ == key) {
+    bool keep_replaced = node_to_insert->seq_ <= newest_snapshot;
     // 修改文件大小， 不用修改filter
     int fileSizeDifference =
-        ComputeFileSizeChange(node_to_insert->value_, value);
+        keep_replaced ? ComputeFileSizeChange(value)
+                      : ComputeFileSizeChange(node_to_insert->value_, value);
     if (file_size_ + fileSizeDifference > kMaxSSTableSize) {
       throw MemTableFull();
     }
@@ -64,15 +164,24 @@ void SkipList::Put(const Key key, const Value &value) {
     bloom_filter_.Put(key);
     file_size_ += fileSizeDifference;
 
-    ComputeFileSizeChange(node_to_insert->value_, value);
-    while (!path_stack.empty()) {
-      NodeSPtr left_to_the_replaced = path_stack.top();
+    VersionsSPtr older = node_to_insert->older_;
+    if (keep_replaced) {
+      auto versions = std::make_shared<Versions>();
+      versions->emplace_back(node_to_insert->seq_, node_to_insert->value_);
+      if (older) {
+        versions->insert(versions->end(), older->begin(), older->end());
+      }
+      older = versions;
+      ++size_;
+    }
+    for (const NodeSPtr &left_to_the_replaced : finger_) {
       if (!left_to_the_replaced->right_ ||
           left_to_the_replaced->right_->key_ != key) {
         return;
       }
-      path_stack.pop();
       left_to_the_replaced->right_->value_ = value;
+      left_to_the_replaced->right_->seq_ = seq;
+      left_to_the_replaced->right_->older_ = older;
     }
     return;
   }
@@ -88,14 +197,16 @@ void SkipList::Put(const Key key, const Value &value) {
   // 插入且当前层依然存在，_size和_fileSize都增加
   bool insertUp = true;
   NodeSPtr downNode = nullptr;
-  while (insertUp && !path_stack.empty()) {
-    NodeSPtr insert = path_stack.top();
-    path_stack.pop();
-    insert->right_ = std::make_shared<Node>(key, value, insert, insert->right_,
+  for (size_t level = 0; insertUp && level < finger_.size(); ++level) {
+    const NodeSPtr &insert = finger_[level];
+    insert->right_ = std::make_shared<Node>(key, value, seq, insert,
+                                            insert->right_,
                                             downNode);  // add新结点
     downNode = insert->right_;
     if (downNode->right_) {
       downNode->right_->left_ = downNode;
+    } else {
+      tails_[level] = downNode;
     }
     insertUp = ShouldInsertUp();
   }
@@ -105,36 +216,180 @@ void SkipList::Put(const Key key, const Value &value) {
     NodeSPtr oldHead = head_;
     head_ = std::make_shared<Node>();
     head_->right_ =
-        std::make_shared<Node>(key, value, head_, nullptr, downNode);
+        std::make_shared<Node>(key, value, seq, head_, nullptr, downNode);
     downNode = head_->right_;
     head_->down_ = oldHead;
+    tails_.push_back(downNode);
+    finger_.push_back(head_);
     insertUp = ShouldInsertUp();
   }
 }
 
 bool SkipList::Del(const Key key) {
   // Find the top level of the "tower".
-  NodeSPtr top_node = NodeByKey(key);
+  Seek(key);
+  NodeSPtr top_node;
+  for (const NodeSPtr &node : finger_) {
+    if (!node->right_ || node->right_->key_ != key) {
+      break;
+    }
+    top_node = node->right_;
+  }
 
   // Hitting a deletion mark also indicates not found.
   if (top_node == nullptr || top_node->value_ == kDeletionMark) {
     return false;
   }
 
+  Erase(top_node);
+  return true;
+}
+
+/**
+ * @Description: Copy the newest version of every key in [first, last] as of a
+ * snapshot, deletion marks included.
+ * @param first: First key of the range.
+ * @param last: Last key of the range.
+ * @param snapshot: Versions of a greater sequence number are skipped.
+ * @return: The entries in ascending order of key.
+ */
+std::vector<MemTableEntry> SkipList::Entries(
+    const Key first, const Key last, const SequenceNumber snapshot) const {
+  std::vector<MemTableEntry> ret;
+  for (NodeSPtr node = LastNodeBefore(first)->right_;
+       node && node->key_ <= last; node = node->right_) {
+    SequenceNumber seq;
+    const Value *value = VersionAt(*node, snapshot, &seq);
+    if (value) {
+      ret.push_back(MemTableEntry{node->key_, seq, *value});
+    }
+  }
+  return ret;
+}
+
+/**
+ * @Description: Tell whether some key, deleted ones included, lies in
+ * [first, last].
+ */
+bool SkipList::HasKeyInRange(const Key first, const Key last) const {
+  NodeSPtr node = LastNodeBefore(first)->right_;
+  return node && node->key_ <= last;
+}
+
+/**
+ * @Description: Find the newest version of a node as of a snapshot.
+ * @return: Pointer to the value, `nullptr` if there is none.
+ */
+const SkipList::Value *SkipList::VersionAt(const Node &node,
+                                           const SequenceNumber snapshot,
+                                           SequenceNumber *seq) {
+  if (node.seq_ <= snapshot) {
+    *seq = node.seq_;
+    return &node.value_;
+  }
+  if (node.older_) {
+    for (const auto &version : *node.older_) {
+      if (version.first <= snapshot) {
+        *seq = version.first;
+        return &version.second;
+      }
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * @Description: Find the last node of the bottom level whose key is less than
+ * `key`, the head of the bottom level if there is none.
+ */
+SkipList::NodeSPtr SkipList::LastNodeBefore(const Key &key) const {
+  NodeSPtr node = head_;
+  while (true) {
+    while (node->right_ && node->right_->key_ < key) node = node->right_;
+    if (!node->down_) return node;
+    node = node->down_;
+  }
+}
+
+/**
+ * @Description: Find the last node before `key` in every level, into
+ * `finger_`. A key past the max key takes the tails as they are, and a key not
+ * less than that of the last search starts from its finger: up from the bottom
+ * level while the next node is still less than the key, and back down from
+ * there. Other keys are searched from the head. Time-ordered keys thus take
+ * O(1) expected steps.
+ */
+void SkipList::Seek(const Key key) {
+  bool past_finger = key >= finger_key_;
+  finger_key_ = key;
+  if (key > tails_[0]->key_) {
+    finger_ = tails_;
+    return;
+  }
+
+  size_t level;
+  NodeSPtr node;
+  if (past_finger) {
+    level = 0;
+    while (level < finger_.size() && finger_[level]->right_ &&
+           finger_[level]->right_->key_ < key) {
+      ++level;
+    }
+    // The finger of the level reached and those above still hold.
+    if (!level) {
+      return;
+    }
+    node = finger_[--level];
+  } else {
+    level = finger_.size() - 1;
+    node = head_;
+  }
+  while (true) {
+    while (node->right_ && node->right_->key_ < key) {
+      node = node->right_;
+    }
+    finger_[level] = node;
+    if (!level--) {
+      return;
+    }
+    node = node->down_;
+  }
+}
+
+/**
+ * @Description: Unlink a "tower" of nodes.
+ * @param top_node: The top node of the tower.
+ */
+void SkipList::Erase(NodeSPtr top_node) {
   int decremented_file_size = ComputeFileSizeChange(top_node->value_);
   file_size_ -= decremented_file_size;
   --size_;
+  if (top_node->older_) {
+    for (const auto &version : *top_node->older_) {
+      file_size_ -= ComputeFileSizeChange(version.second);
+      --size_;
+    }
+  }
+
+  std::vector<NodeSPtr> tower;
+  for (NodeSPtr node = top_node; node; node = node->down_) {
+    tower.push_back(node);
+  }
 
   // Delete nodes downward.
-  NodeSPtr old_node;
-  while (top_node) {
-    old_node = top_node;
-    top_node->left_->right_ = top_node->right_;
-    if (top_node->right_) {
-      top_node->right_->left_ = top_node->left_;
+  for (size_t i = 0; i < tower.size(); ++i) {
+    const NodeSPtr &node = tower[i];
+    size_t level = tower.size() - 1 - i;
+    node->left_->right_ = node->right_;
+    if (node->right_) {
+      node->right_->left_ = node->left_;
+    }
+    if (tails_[level] == node) {
+      tails_[level] = node->left_;
+    }
+    if (finger_[level] == node) {
+      finger_[level] = node->left_;
     }
-    top_node = top_node->down_;
-    old_node.reset();
   }
 
   // Delete extraneous levels.
@@ -142,9 +397,9 @@ bool SkipList::Del(const Key key) {
     NodeSPtr oldHead = head_;
     head_ = head_->down_;
     oldHead.reset();
+    tails_.pop_back();
+    finger_.pop_back();
   }
-
-  return true;
 }
 
 void SkipList::Reset() {
@@ -167,6 +422,9 @@ void SkipList::Reset() {
   }
 
   head_ = std::make_shared<Node>();
+  tails_ = {head_};
+  finger_ = {head_};
+  finger_key_ = 0;
 }
 
 bool SkipList::ShouldInsertUp() { return rand() & 1; }
@@ -208,62 +466,92 @@ SkipList::NodeSPtr SkipList::NodeByKey(const Key &key) const {
  * @param timestamp: The timestamp of the SST.
  * @param sst_no: The fileName of the SST.
  * @param dir: Base directory to store files in.
+ * @param rate_limiter: Limiter to draw the write from at flush priority, or
+ * `nullptr` to write at full speed.
  * @return: The in-memory representation of SST that is written to disk.
  */
 SSTableSPtr SkipList::ToFile(const Timestamp timestamp, uint64_t sst_no,
-                             const std::string &dir) const {
+                             const std::string &dir,
+                             RateLimiter *rate_limiter) const {
   std::string level0_path = dir + "/level-0";
   std::string file_path = level0_path + "/" + std::to_string(sst_no) + ".sst";
 
   Key min_key = MinKey();
   Key max_key = MaxKey();
 
+  // Every version of every key, newest version first.
+  struct Entry {
+    Key key;
+    SequenceNumber seq;
+    const Value *value;
+  };
+  std::vector<Entry> entries;
+  entries.reserve(size_);
+  for (NodeSPtr node = BottomHead()->right_; node; node = node->right_) {
+    entries.push_back(Entry{node->key_, node->seq_, &node->value_});
+    if (node->older_) {
+      for (const auto &version : *node->older_) {
+        entries.push_back(Entry{node->key_, version.first, &version.second});
+      }
+    }
+  }
+
+  size_t num_deletions = 0;
+  for (const Entry &entry : entries) {
+    num_deletions += *entry.value == kDeletionMark;
+  }
+
   if (!utils::DirExists(level0_path)) {
     utils::Mkdir(level0_path.c_str());
   }
 
+  if (rate_limiter) {
+    rate_limiter->Request(file_size_, IOPriority::kFlush);
+  }
+
   std::ofstream sst_file(file_path, std::ios::out | std::ios::binary);
 
   // Write header.
   sst_file.write((char *)&timestamp, 8)
       .write((char *)&size_, 8)
       .write((char *)&min_key, 8)
-      .write((char *)&max_key, 8);
+      .write((char *)&max_key, 8)
+      .write((char *)&num_deletions, 8);
 
   SSTableSPtr sst_ptr = std::make_shared<SSTable>(file_path, timestamp);
   sst_ptr->num_keys_ = size_;
   sst_ptr->min_key_ = min_key;
   sst_ptr->max_key_ = max_key;
+  sst_ptr->num_deletions_ = num_deletions;
 
   // Write bloom filter.
   bloom_filter_.ToFile(sst_file);
   sst_ptr->bloom_filter_ = bloom_filter_;
 
-  // offset = header + bloom filter + _size * (key + offset)
+  // offset = header + bloom filter + _size * (key + seq + offset)
   size_t offset =
       kSSTHeaderSize + kBloomFilterSize + size_ * kIndexSizePerValue;
-  NodeSPtr node_for_key = BottomHead()->right_;
-  NodeSPtr node_for_value = node_for_key;
-
-  while (node_for_key) {
-    sst_file.write((char *)&node_for_key->key_, 8).write((char *)&offset, 4);
+  for (const Entry &entry : entries) {
+    sst_file.write((char *)&entry.key, 8)
+        .write((char *)&entry.seq, 8)
+        .write((char *)&offset, 4);
 
-    sst_ptr->keys_.emplace_back(node_for_key->key_);
+    sst_ptr->keys_.emplace_back(entry.key);
+    sst_ptr->seqs_.emplace_back(entry.seq);
     sst_ptr->offset_.emplace_back(offset);
 
-    offset += node_for_key->value_.size();
-    node_for_key = node_for_key->right_;
+    offset += entry.value->size();
   }
+  sst_ptr->UpdateSequenceRange();
 
-  while (node_for_value) {
-    Value &value = node_for_value->value_;
-    size_t length = value.size();
-    const char *str = value.c_str();
+  for (const Entry &entry : entries) {
+    size_t length = entry.value->size();
+    const char *str = entry.value->c_str();
     sst_file.write(str, length);
-    node_for_value = node_for_value->right_;
   }
 
   sst_ptr->file_size_ = offset;
+  sst_ptr->UpdateValueLayout();
 
   sst_file.close();
 
@@ -276,23 +564,10 @@ inline SkipList::Key SkipList::MinKey() const {
   return node_ptr ? node_ptr->key_ : std::numeric_limits<Key>::quiet_NaN();
 }
 
-SkipList::Key SkipList::MaxKey() const {
-  // Also take into account deleted keys.
-  NodeSPtr node_ptr = head_;
-
-  while (node_ptr->down_) {
-    while (node_ptr->right_) {
-      node_ptr = node_ptr->right_;
-    }
-    node_ptr = node_ptr->down_;
-  }
-
-  while (node_ptr->right_) {
-    node_ptr = node_ptr->right_;
-  }
-
-  return node_ptr ? node_ptr->key_ : std::numeric_limits<Key>::quiet_NaN();
-}
+/**
+ * @Description: The max key, deleted keys included, 0 if the list is empty.
+ */
+SkipList::Key SkipList::MaxKey() const { return tails_[0]->key_; }
 
 /**
  * @Description: The utility function that gets the head of the bottom level of
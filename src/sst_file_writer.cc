@@ -0,0 +1,81 @@
+#include "../include/sst_file_writer.h"
+
+#include <stdexcept>
+
+#include "../include/kvstore.h"
+
+SstFileWriter::SstFileWriter(const std::string &dir, const Options &options)
+    : kDir(dir), kTtl(options.ttl), has_key_(false), last_key_(0),
+      file_size_(0) {
+  if (!utils::DirExists(dir)) {
+    utils::Mkdir(dir.c_str());
+  }
+}
+
+/**
+ * @Description: Add a key-value pair to the current file, first writing the
+ * file out if the pair would not fit in it.
+ * @param key: The key, greater than every key put before.
+ * @param value: The value.
+ */
+void SstFileWriter::Put(const uint64_t key, const std::string &value) {
+  if (has_key_ && key <= last_key_) {
+    throw std::invalid_argument(
+        "SstFileWriter: keys must be put in ascending order");
+  }
+
+  // Stored the way the store stores a put.
+  StringSPtr stored = std::make_shared<std::string>(
+      kTtl ? KVStore::AppendWriteTime(value) : value);
+  size_t entry_size = kIndexSizePerValue + stored->size();
+  if (sst_ptr_ && file_size_ + entry_size > kMaxSSTableSize) {
+    FinishFile();
+  }
+  if (!sst_ptr_) {
+    sst_ptr_ = std::make_shared<SSTable>(
+        kDir + "/" + std::to_string(file_paths_.size() + 1) + ".sst", 0);
+    file_size_ = kSSTHeaderSize + kBloomFilterSize;
+  }
+
+  // Sequence numbers are assigned at ingestion.
+  sst_ptr_->bloom_filter_.Put(key);
+  sst_ptr_->keys_.emplace_back(key);
+  sst_ptr_->seqs_.emplace_back(0);
+  values_.emplace_back(std::move(stored));
+  file_size_ += entry_size;
+  has_key_ = true;
+  last_key_ = key;
+}
+
+std::vector<std::string> SstFileWriter::Finish() {
+  if (sst_ptr_) {
+    FinishFile();
+  }
+  return file_paths_;
+}
+
+/**
+ * @Description: Fill in the fields of the current SST, and write it out in
+ * the layout of the SSTs of the store.
+ */
+void SstFileWriter::FinishFile() {
+  SSTable &sst = *sst_ptr_;
+  sst.file_size_ = file_size_;
+  sst.num_keys_ = sst.keys_.size();
+  sst.min_key_ = sst.keys_.front();
+  sst.max_key_ = sst.keys_.back();
+  sst.num_deletions_ = 0;
+
+  size_t offset =
+      kSSTHeaderSize + kBloomFilterSize + sst.num_keys_ * kIndexSizePerValue;
+  sst.offset_.resize(sst.num_keys_);
+  for (size_t i = 0; i < sst.num_keys_; ++i) {
+    sst.offset_[i] = offset;
+    offset += values_[i]->size();
+  }
+  sst.ToFile(values_);
+
+  file_paths_.emplace_back(sst.file_path_);
+  sst_ptr_.reset();
+  values_.clear();
+}
@@ -1,12 +1,36 @@
 #include "../include/sstable.h"
 
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <sstream>
+#include <system_error>
+
+#include "../include/utils.h"
+
 SSTable::SSTable(const std::string &path, const Timestamp timestamp)
     : file_path_(path),
       file_size_(0),
       timestamp_(timestamp),
       num_keys_(0),
       min_key_(std::numeric_limits<uint64_t>::max()),
-      max_key_(std::numeric_limits<uint64_t>::min()) {}
+      max_key_(std::numeric_limits<uint64_t>::min()),
+      num_deletions_(0) {}
+
+/**
+ * @Description: Remove the file of an obsolete SST. Versions and iterators
+ * that got hold of the SST before it was compacted away keep the file alive
+ * until they are released.
+ */
+SSTable::~SSTable() {
+  if (obsolete_) {
+    EventSpan span(event_log_.get(), "delete_file",
+                   EventLog::Args().Add("file", file_path_));
+    span.EndArgs().Add("bytes", file_size_);
+    utils::Rmfile(file_path_.c_str());
+  }
+}
 
 /**
  * @Description: Construct an SSTable by reading from a file
@@ -21,19 +45,25 @@ SSTable *SSTable::FromFile(const std::string &file_path) {
   sst_in_file.read((char *) &sst->timestamp_, 8)
       .read((char *) &sst->num_keys_, 8)
       .read((char *) &sst->min_key_, 8)
-      .read((char *) &sst->max_key_, 8);
+      .read((char *) &sst->max_key_, 8)
+      .read((char *) &sst->num_deletions_, 8);
 
   sst->keys_.resize(sst->num_keys_);
+  sst->seqs_.resize(sst->num_keys_);
   sst->offset_.resize(sst->num_keys_);
 
   sst->bloom_filter_.FromFile(sst_in_file);
 
   for (int i = 0; i < sst->num_keys_; ++i) {
-    sst_in_file.read((char *) &sst->keys_[i], 8).read((char *) &sst->offset_[i], 4);
+    sst_in_file.read((char *)&sst->keys_[i], 8)
+        .read((char *)&sst->seqs_[i], 8)
+        .read((char *)&sst->offset_[i], 4);
   }
+  sst->UpdateSequenceRange();
 
   sst_in_file.seekg(0, sst_in_file.end);
   sst->file_size_ = sst_in_file.tellg();
+  sst->UpdateValueLayout();
 
   sst_in_file.close();
   return sst;
@@ -47,6 +77,7 @@ std::ostream &operator<<(std::ostream &ostream, const SSTable &ssTable) {
           << "Number of keys: " << ssTable.num_keys_ << std::endl
           << "Min Key: " << ssTable.min_key_ << std::endl
           << "Max Key: " << ssTable.max_key_ << std::endl
+          << "Number of deletions: " << ssTable.num_deletions_ << std::endl
           << "Keys: ";
 
   for (int i = 0; i < ssTable.num_keys_; ++i) {
@@ -57,19 +88,28 @@ std::ostream &operator<<(std::ostream &ostream, const SSTable &ssTable) {
   return ostream;
 }
 
-inline bool SSTable::IsProbablyPresent(const uint64_t key) const {
+bool SSTable::IsProbablyPresent(const uint64_t key) const {
   return bloom_filter_.IsProbablyPresent(key);
 }
 
 /**
  * @Description: Find by key in a SST using binary search.
  * @param key: Plain to see.
- * @return: The pointer to the value if it exists, nullptr if it is absent.
+ * @param snapshot: Versions of a greater sequence number are skipped.
+ * @param seq: Set to the sequence number of the version found, if not
+ * `nullptr`.
+ * @return: The pointer to the newest value as of the snapshot if it exists,
+ * nullptr if it is absent.
  */
-std::shared_ptr<std::string> SSTable::ValueByKey(const uint64_t key) const {
+std::shared_ptr<std::string> SSTable::ValueByKey(const uint64_t key,
+                                                 const SequenceNumber snapshot,
+                                                 SequenceNumber *seq) const {
   if (key >= min_key_ && key <= max_key_ && IsProbablyPresent(key)) {
-    size_t idx = BinarySearch(key);
+    size_t idx = Find(key, snapshot);
     if (idx != std::numeric_limits<size_t>::max()) {
+      if (seq) {
+        *seq = seqs_[idx];
+      }
       return ValueByIndex(idx);
     }
   }
@@ -82,92 +122,439 @@ std::shared_ptr<std::string> SSTable::ValueByKey(const uint64_t key) const {
  * @return: Pointer to the value.
  */
 std::shared_ptr<std::string> SSTable::ValueByIndex(size_t idx) const {
-  size_t length = (idx != num_keys_ - 1) ? offset_[idx + 1] - offset_[idx]
-                                         : file_size_ - offset_[idx];
+  size_t length = ValueEnd(idx) - ValueOffset(idx);
 
   std::shared_ptr<std::string> ret = std::make_shared<std::string>(length, 0);
 
   std::ifstream file(file_path_, std::ios::binary);
 
-  file.seekg((long long)offset_[idx]);
+  file.seekg((long long)ValueOffset(idx));
   file.read(&(*ret)[0], (long)length);
+  if (!file) {
+    throw std::system_error(EIO, std::generic_category(),
+                            "short read of " + file_path_ + " at " +
+                                std::to_string(ValueOffset(idx)));
+  }
   file.close();
 
   return ret;
 }
 
 /**
- * @Description: Find the key using binary search.
+ * @Description: Find by keys in a SST, probing the bloom filter for all of
+ * them at once and reading the values in a single batch.
+ * @param keys: Keys in ascending order.
+ * @param snapshot: Versions of a greater sequence number are skipped.
+ * @param seqs: Set to the sequence numbers of the versions found.
+ * @param io_backend: Backend to read the values with.
+ * @return: The pointers to the newest values as of the snapshot, `nullptr`
+ * for the absent keys.
+ */
+std::vector<StringSPtr> SSTable::ValuesByKeys(
+    const std::vector<uint64_t> &keys, const SequenceNumber snapshot,
+    std::vector<SequenceNumber> *seqs, IOBackend *io_backend) const {
+  std::vector<StringSPtr> ret(keys.size());
+  seqs->assign(keys.size(), 0);
+  auto keys_begin = std::lower_bound(keys.begin(), keys.end(), min_key_);
+  auto keys_end = std::upper_bound(keys_begin, keys.end(), max_key_);
+  size_t num_keys_in_range = keys_end - keys_begin;
+  if (!num_keys_in_range) {
+    return ret;
+  }
+
+  std::unique_ptr<bool[]> probably_present(new bool[num_keys_in_range]);
+  bloom_filter_.IsProbablyPresent(&*keys_begin, num_keys_in_range,
+                                  probably_present.get());
+
+  std::vector<uint64_t> keys_to_search;
+  for (size_t i = 0; i < num_keys_in_range; ++i) {
+    if (probably_present[i]) {
+      keys_to_search.push_back(keys_begin[i]);
+    }
+  }
+  std::vector<size_t> lower_bounds(keys_to_search.size());
+  LowerBounds(keys_to_search.data(), keys_to_search.size(),
+              lower_bounds.data());
+
+  std::vector<size_t> positions;
+  std::vector<size_t> indices;
+  for (size_t i = 0, j = 0; i < num_keys_in_range; ++i) {
+    if (!probably_present[i]) {
+      continue;
+    }
+    uint64_t key = keys_begin[i];
+    size_t idx = lower_bounds[j++];
+    while (idx < num_keys_ && keys_[idx] == key && seqs_[idx] > snapshot) {
+      ++idx;
+    }
+    if (idx < num_keys_ && keys_[idx] == key) {
+      positions.push_back(keys_begin - keys.begin() + i);
+      indices.push_back(idx);
+    }
+  }
+
+  std::vector<StringSPtr> values = ValuesByIndices(indices, io_backend);
+  for (size_t i = 0; i < positions.size(); ++i) {
+    ret[positions[i]] = values[i];
+    (*seqs)[positions[i]] = seqs_[indices[i]];
+  }
+  return ret;
+}
+
+/**
+ * @Description: Drop the offsets of the values if they all have the same size,
+ * which saves a word per key and a load per lookup. Deletion marks may come
+ * between them, at the cost of their indices. They are only told by their
+ * size, since the values are not at hand, so that a value the size of a mark
+ * counts as one. The offsets and the file size must be set.
+ */
+void SSTable::UpdateValueLayout() {
+  if (offset_.empty()) {
+    return;
+  }
+  const size_t mark_size = kDeletionMark.size();
+  size_t value_size = mark_size;
+  std::vector<uint32_t> mark_indices;
+  for (size_t i = 0; i < num_keys_; ++i) {
+    size_t size = ValueEnd(i) - offset_[i];
+    if (size == mark_size) {
+      mark_indices.push_back((uint32_t)i);
+    } else if (value_size == mark_size) {
+      value_size = size;
+    } else if (size != value_size) {
+      return;
+    }
+  }
+  if (value_size == mark_size) {
+    mark_indices.clear();
+  }
+  value_size_ = value_size;
+  mark_indices_.swap(mark_indices);
+  offset_.clear();
+  offset_.shrink_to_fit();
+}
+
+/**
+ * @Description: Tell where a value starts in the file.
+ */
+size_t SSTable::ValueOffset(const size_t idx) const {
+  if (offset_.empty()) {
+    size_t num_marks =
+        std::lower_bound(mark_indices_.begin(), mark_indices_.end(), idx) -
+        mark_indices_.begin();
+    return kSSTHeaderSize + kBloomFilterSize + num_keys_ * kIndexSizePerValue +
+           (idx - num_marks) * value_size_ + num_marks * kDeletionMark.size();
+  }
+  return offset_[idx];
+}
+
+/**
+ * @Description: Tell where a value ends in the file.
+ */
+size_t SSTable::ValueEnd(const size_t idx) const {
+  if (idx == num_keys_ - 1) {
+    return file_size_;
+  }
+  return offset_.empty() ? ValueOffset(idx + 1) : offset_[idx + 1];
+}
+
+/**
+ * @Description: Tell how much memory the index of the SST takes: the keys, the
+ * sequence numbers, the offsets or indices of deletion marks, and the bloom
+ * filter.
+ */
+size_t SSTable::IndexMemoryUsage() const {
+  return keys_.capacity() * sizeof(uint64_t) +
+         seqs_.capacity() * sizeof(SequenceNumber) +
+         offset_.capacity() * sizeof(size_t) +
+         mark_indices_.capacity() * sizeof(uint32_t) + kBloomFilterSize;
+}
+
+/**
+ * @Description: Read values by index, coalescing the values that lie close
+ * together in the file into one block, and reading all blocks in one batch.
+ * @param indices: Indices in ascending order, possibly repeated.
+ * @param io_backend: Backend to read the blocks with.
+ * @return: Pointers to the values, in the order of the indices.
+ */
+std::vector<StringSPtr> SSTable::ValuesByIndices(
+    const std::vector<size_t> &indices, IOBackend *io_backend) const {
+  // Reading the bytes between two values is cheaper than another read, up to
+  // this many bytes.
+  static const size_t kMaxCoalescingGap = 4 << 10;
+
+  std::vector<StringSPtr> ret;
+  ret.reserve(indices.size());
+  if (indices.empty()) {
+    return ret;
+  }
+
+  // Blocks as ranges of `indices`.
+  std::vector<std::pair<size_t, size_t>> blocks;
+  size_t begin = 0;
+  while (begin < indices.size()) {
+    size_t end = begin + 1;
+    while (end < indices.size() &&
+           ValueOffset(indices[end]) <=
+               ValueEnd(indices[end - 1]) + kMaxCoalescingGap) {
+      ++end;
+    }
+    blocks.emplace_back(begin, end);
+    begin = end;
+  }
+
+  int fd = IOBackend::Open(file_path_);
+  std::vector<std::string> buffers(blocks.size());
+  std::vector<IORequest> requests;
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    size_t block_offset = ValueOffset(indices[blocks[i].first]);
+    buffers[i].resize(ValueEnd(indices[blocks[i].second - 1]) - block_offset);
+    IOBackend::AddRequests(fd, block_offset, buffers[i].size(),
+                           &buffers[i][0], requests);
+  }
+  io_backend->Read(requests);
+  close(fd);
+  IOBackend::CheckRead(requests, file_path_);
+
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    size_t block_offset = ValueOffset(indices[blocks[i].first]);
+    for (size_t j = blocks[i].first; j < blocks[i].second; ++j) {
+      size_t idx = indices[j];
+      ret.emplace_back(std::make_shared<std::string>(
+          buffers[i], ValueOffset(idx) - block_offset,
+          ValueEnd(idx) - ValueOffset(idx)));
+    }
+  }
+  return ret;
+}
+
+/**
+ * @Description: Find the newest version of the key using binary search.
  */
 size_t SSTable::BinarySearch(const uint64_t key) const {
   long left = 0;
-  long right = (long)keys_.size() - 1;
-  while (left <= right) {
+  long right = (long)keys_.size();
+  while (left < right) {
     long mid = left + ((right - left) >> 1);
-    uint64_t k = keys_[mid];
-    if (k == key) {
-      return mid;
-    } else if (k < key) {
+    if (keys_[mid] < key) {
       left = mid + 1;
     } else {
-      right = mid - 1;
+      right = mid;
+    }
+  }
+
+  return left < keys_.size() && keys_[left] == key
+             ? left
+             : std::numeric_limits<size_t>::max();
+}
+
+/**
+ * @Description: Binary search for many keys at once. The searches run side by
+ * side: each round takes one step of every search, and prefetches the key the
+ * search compares with in the next round, so that their loads overlap.
+ * @param keys: The keys to search for.
+ * @param n: Number of keys.
+ * @param ret: Set to the index of the first key not less than `keys[i]`,
+ * `num_keys_` if there is none.
+ */
+void SSTable::LowerBounds(const uint64_t *keys, const size_t n,
+                          size_t *ret) const {
+  std::fill(ret, ret + n, 0);
+  if (!num_keys_) {
+    return;
+  }
+
+  // Every search narrows [ret[i], ret[i] + length) by the same steps, so that
+  // all of them take the same number of rounds.
+  size_t length = num_keys_;
+  while (length > 1) {
+    size_t half = length >> 1;
+    for (size_t i = 0; i < n; ++i) {
+      ret[i] = keys_[ret[i] + half] < keys[i] ? ret[i] + half : ret[i];
+      __builtin_prefetch(&keys_[ret[i] + ((length - half) >> 1)]);
     }
+    length -= half;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    ret[i] += keys_[ret[i]] < keys[i];
   }
+}
 
+/**
+ * @Description: Find the newest version of the key as of a snapshot.
+ */
+size_t SSTable::Find(const uint64_t key, const SequenceNumber snapshot) const {
+  size_t idx = BinarySearch(key);
+  if (idx == std::numeric_limits<size_t>::max()) {
+    return idx;
+  }
+  // Versions of a key go from newest to oldest.
+  while (idx < num_keys_ && keys_[idx] == key) {
+    if (seqs_[idx] <= snapshot) {
+      return idx;
+    }
+    ++idx;
+  }
   return std::numeric_limits<size_t>::max();
 }
 
+void SSTable::UpdateSequenceRange() {
+  min_seq_ = seqs_.empty() ? 0 : *std::min_element(seqs_.begin(), seqs_.end());
+  max_seq_ = seqs_.empty() ? 0 : *std::max_element(seqs_.begin(), seqs_.end());
+}
+
 bool SSTable::Contains(const uint64_t key) const {
   return min_key_ <= key && max_key_ >= key;
 }
 
+/**
+ * @Description: Tell whether some key of the SST lies in [first, last]. Keys
+ * are all in memory, so unlike a range filter the answer is exact, and costs
+ * a binary search.
+ */
+bool SSTable::HasKeyInRange(const uint64_t first, const uint64_t last) const {
+  if (first > max_key_ || last < min_key_) {
+    return false;
+  }
+  auto it = std::lower_bound(keys_.begin(), keys_.end(), first);
+  return it != keys_.end() && *it <= last;
+}
+
 uint64_t SSTable::MaxKey() const { return max_key_; }
 
 uint64_t SSTable::MinKey() const { return min_key_; }
 
-/* when calling this function, every field is set */
-void SSTable::ToFile(std::vector<std::shared_ptr<std::string>> &values) {
-  std::ofstream file(file_path_, std::ios::out | std::ios::binary);
+/**
+ * @Description: Write the SST to disk, as one batch of requests that a backend
+ * may serve all at once. When calling this function, every field is set.
+ * @param values: Values corresponding to keys in the SST.
+ * @param rate_limiter: Limiter to draw the write from at compaction priority,
+ * or `nullptr` to write at full speed.
+ * @param io_backend: Backend to write the file with, or `nullptr` to write
+ * with `pwrite`.
+ */
+void SSTable::ToFile(std::vector<std::shared_ptr<std::string>> &values,
+                     RateLimiter *rate_limiter, IOBackend *io_backend) {
+  if (rate_limiter) {
+    rate_limiter->Request(file_size_, IOPriority::kCompaction);
+  }
+
+  std::ostringstream file(std::ios::out | std::ios::binary);
 
   file.write((char *)&timestamp_, 8)
       .write((char *)&num_keys_, 8)
       .write((char *)&min_key_, 8)
-      .write((char *)&max_key_, 8);
+      .write((char *)&max_key_, 8)
+      .write((char *)&num_deletions_, 8);
 
   bloom_filter_.ToFile(file);
 
   for (int i = 0; i < num_keys_; ++i) {
-    file.write((char *)&keys_[i], 8).write((char *)&offset_[i], 4);
+    uint32_t offset = (uint32_t)ValueOffset(i);
+    file.write((char *)&keys_[i], 8)
+        .write((char *)&seqs_[i], 8)
+        .write((char *)&offset, 4);
   }
 
   for (int i = 0; i < num_keys_; ++i) {
     file.write(values[i]->c_str(), (long)values[i]->size());
   }
+
+  std::string block = file.str();
+  int fd = IOBackend::Create(file_path_);
+  std::vector<IORequest> requests;
+  IOBackend::AddRequests(fd, 0, block.size(), &block[0], requests);
+  PosixIOBackend posix_io_backend;
+  (io_backend ? io_backend : &posix_io_backend)->Write(requests);
+  close(fd);
+  IOBackend::CheckWrite(requests, file_path_);
+}
+
+/**
+ * @Description: Move the file of an external SST into the store, and stamp it
+ * as written at `timestamp`, every entry taking sequence number `seq`. Only the
+ * header and the index are rewritten, in place.
+ * @param file_path: The path in the store to move the file to.
+ * @param timestamp: Timestamp of the run the SST joins.
+ * @param seq: Sequence number of the ingestion.
+ */
+void SSTable::Ingest(const std::string &file_path, const Timestamp timestamp,
+                     const SequenceNumber seq) {
+  // Across file systems the file has to be copied.
+  if (std::rename(file_path_.c_str(), file_path.c_str())) {
+    std::ifstream src(file_path_, std::ios::binary);
+    std::ofstream dst(file_path, std::ios::binary);
+    dst << src.rdbuf();
+    src.close();
+    dst.close();
+    utils::Rmfile(file_path_.c_str());
+  }
+  file_path_ = file_path;
+  timestamp_ = timestamp;
+  seqs_.assign(num_keys_, seq);
+  UpdateSequenceRange();
+
+  std::fstream file(file_path_, std::ios::in | std::ios::out |
+                                    std::ios::binary);
+  file.write((char *)&timestamp_, 8);
+  file.seekp(kSSTHeaderSize + kBloomFilterSize);
+  for (int i = 0; i < num_keys_; ++i) {
+    uint32_t offset = (uint32_t)ValueOffset(i);
+    file.write((char *)&keys_[i], 8)
+        .write((char *)&seqs_[i], 8)
+        .write((char *)&offset, 4);
+  }
   file.close();
 }
 
-std::shared_ptr<std::vector<StringSPtr>> SSTable::Values() const {
+/**
+ * @Description: Move the SST into another run, rewriting the timestamp in the
+ * header of its file in place. Only for an SST no version holds yet, such as a
+ * fresh copy.
+ * @param timestamp: Timestamp of the run.
+ */
+void SSTable::Restamp(const Timestamp timestamp) {
+  timestamp_ = timestamp;
+  std::fstream file(file_path_, std::ios::in | std::ios::out |
+                                    std::ios::binary);
+  file.write((char *)&timestamp_, 8);
+  file.close();
+}
+
+/**
+ * @Description: Read all values of the SST, in the order of keys, as one batch
+ * of requests that a backend may serve all at once.
+ * @param rate_limiter: Limiter to draw the read from at compaction priority,
+ * or `nullptr` to read at full speed.
+ * @param io_backend: Backend to read the values with, or `nullptr` to read
+ * with `pread`.
+ * @return: Pointer to the values.
+ */
+std::shared_ptr<std::vector<StringSPtr>> SSTable::Values(
+    RateLimiter *rate_limiter, IOBackend *io_backend) const {
+  if (rate_limiter) {
+    rate_limiter->Request(file_size_ - ValueOffset(0),
+                          IOPriority::kCompaction);
+  }
+
   std::shared_ptr<std::vector<StringSPtr>> ret =
       std::make_shared<std::vector<StringSPtr>>();
   ret->reserve(num_keys_);
 
-  std::ifstream file(file_path_, std::ios::binary);
-
-  file.seekg((long long)offset_[0]);
-
-  for (int i = 0; i < num_keys_ - 1; ++i) {
-    size_t length = offset_[i + 1] - offset_[i];
-    StringSPtr value = std::make_shared<std::string>(length, 0);
-    file.read(&(*value)[0], (long)length);
-    ret->emplace_back(value);
+  size_t values_offset = ValueOffset(0);
+  std::string block(file_size_ - values_offset, 0);
+  int fd = IOBackend::Open(file_path_);
+  std::vector<IORequest> requests;
+  IOBackend::AddRequests(fd, values_offset, block.size(), &block[0],
+                         requests);
+  PosixIOBackend posix_io_backend;
+  (io_backend ? io_backend : &posix_io_backend)->Read(requests);
+  close(fd);
+  IOBackend::CheckRead(requests, file_path_);
+
+  for (size_t i = 0; i < num_keys_; ++i) {
+    ret->emplace_back(std::make_shared<std::string>(
+        block, ValueOffset(i) - values_offset, ValueEnd(i) - ValueOffset(i)));
   }
-
-  size_t length = file_size_ - offset_[num_keys_ - 1];
-
-  StringSPtr value = std::make_shared<std::string>(length, 0);
-  file.read(&(*value)[0], (long)length);
-  ret->emplace_back(value);
-  file.close();
-
   return ret;
 }
@@ -0,0 +1,254 @@
+#include "../include/statistics.h"
+
+#include <functional>
+#include <thread>
+
+Statistics::Statistics() { Reset(); }
+
+/**
+ * @Description: Pick the stripe of the calling thread, by a hash of its id
+ * computed once per thread.
+ * @return: The index of the stripe.
+ */
+size_t Statistics::StripeIndex() {
+  thread_local const size_t idx =
+      std::hash<std::thread::id>()(std::this_thread::get_id()) % kNumStripes;
+  return idx;
+}
+
+/**
+ * @Description: Count events.
+ * @param ticker: What happened.
+ * @param count: How many times, or how many bytes or microseconds.
+ */
+void Statistics::Record(const Ticker ticker, const uint64_t count) {
+  stripes_[StripeIndex()].tickers[ticker].fetch_add(count,
+                                                    std::memory_order_relaxed);
+}
+
+/**
+ * @Description: Count events of a level.
+ * @param ticker: What happened.
+ * @param level: The level, deeper ones than `kMaxLevels` counting as the last.
+ * @param count: How many times.
+ */
+void Statistics::RecordLevel(const LevelTicker ticker, size_t level,
+                             const uint64_t count) {
+  if (level >= kMaxLevels) {
+    level = kMaxLevels - 1;
+  }
+  stripes_[StripeIndex()].level_tickers[level][ticker].fetch_add(
+      count, std::memory_order_relaxed);
+}
+
+/**
+ * @Description: Add a ticker up over the stripes. Counts racing with the call
+ * may or may not be included.
+ * @param ticker: The ticker.
+ * @return: The count.
+ */
+uint64_t Statistics::Get(const Ticker ticker) const {
+  uint64_t sum = 0;
+  for (const Stripe &stripe : stripes_) {
+    sum += stripe.tickers[ticker].load(std::memory_order_relaxed);
+  }
+  return sum;
+}
+
+/**
+ * @Description: Add a ticker of a level up over the stripes.
+ * @param ticker: The ticker.
+ * @param level: The level, deeper ones than `kMaxLevels` counting as the last.
+ * @return: The count.
+ */
+uint64_t Statistics::GetLevel(const LevelTicker ticker, size_t level) const {
+  if (level >= kMaxLevels) {
+    level = kMaxLevels - 1;
+  }
+  uint64_t sum = 0;
+  for (const Stripe &stripe : stripes_) {
+    sum += stripe.level_tickers[level][ticker].load(std::memory_order_relaxed);
+  }
+  return sum;
+}
+
+void Statistics::RecordTime(const HistogramType type, const uint64_t micros) {
+  histograms_[StripeIndex()][type].Add(micros);
+}
+
+/**
+ * @Description: Record the time of a compaction out of a level into the next.
+ * @param level: The level, deeper ones than `kMaxLevels` counting as the last.
+ * @param micros: The time.
+ */
+void Statistics::RecordCompactionTime(size_t level, const uint64_t micros) {
+  if (level >= kMaxLevels) {
+    level = kMaxLevels - 1;
+  }
+  compaction_histograms_[level].Add(micros);
+}
+
+/**
+ * @Description: Merge the latencies recorded over the stripes.
+ * @param type: What the latencies are of.
+ * @param histogram: The histogram to merge into, usually empty.
+ */
+void Statistics::GetHistogram(const HistogramType type,
+                              Histogram *histogram) const {
+  for (const auto &stripe : histograms_) {
+    histogram->Merge(stripe[type]);
+  }
+}
+
+/**
+ * @Description: Merge the times of the compactions out of a level.
+ * @param level: The level, deeper ones than `kMaxLevels` counting as the last.
+ * @param histogram: The histogram to merge into, usually empty.
+ */
+void Statistics::GetCompactionHistogram(size_t level,
+                                        Histogram *histogram) const {
+  if (level >= kMaxLevels) {
+    level = kMaxLevels - 1;
+  }
+  histogram->Merge(compaction_histograms_[level]);
+}
+
+/**
+ * @Description: Bytes flushed, ingested and written by compactions, per byte
+ * flushed or ingested.
+ * @return: The write amplification, 0 if nothing was flushed or ingested.
+ */
+double Statistics::WriteAmplification() const {
+  uint64_t incoming = Get(kBytesFlushed) + Get(kBytesIngested);
+  if (incoming == 0) {
+    return 0;
+  }
+  return static_cast<double>(incoming + Get(kBytesCompactionWritten)) /
+         incoming;
+}
+
+/**
+ * @Description: Zero all counters and histograms. Counts racing with the call
+ * may survive.
+ */
+void Statistics::Reset() {
+  for (Stripe &stripe : stripes_) {
+    for (auto &ticker : stripe.tickers) {
+      ticker.store(0, std::memory_order_relaxed);
+    }
+    for (auto &level : stripe.level_tickers) {
+      for (auto &ticker : level) {
+        ticker.store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+  for (auto &stripe : histograms_) {
+    for (Histogram &histogram : stripe) {
+      histogram.Clear();
+    }
+  }
+  for (Histogram &histogram : compaction_histograms_) {
+    histogram.Clear();
+  }
+}
+
+/**
+ * @Description: Print all tickers, then the level tickers of each level with
+ * any counted, then the histograms with any latency recorded.
+ * @return: The text, one `name: count` line per ticker.
+ */
+std::string Statistics::ToString() const {
+  std::string out;
+  for (int t = 0; t < kNumTickers; ++t) {
+    Ticker ticker = static_cast<Ticker>(t);
+    out += std::string(Name(ticker)) + ": " + std::to_string(Get(ticker)) +
+           "\n";
+  }
+  for (size_t level = 0; level < kMaxLevels; ++level) {
+    std::string line;
+    bool any = false;
+    for (int t = 0; t < kNumLevelTickers; ++t) {
+      LevelTicker ticker = static_cast<LevelTicker>(t);
+      uint64_t count = GetLevel(ticker, level);
+      any = any || count != 0;
+      line += " " + std::string(Name(ticker)) + ": " + std::to_string(count);
+    }
+    if (any) {
+      out += "level " + std::to_string(level) + ":" + line + "\n";
+    }
+  }
+  for (int t = 0; t < kNumHistograms; ++t) {
+    HistogramType type = static_cast<HistogramType>(t);
+    Histogram histogram;
+    GetHistogram(type, &histogram);
+    if (histogram.Count()) {
+      out += std::string(Name(type)) + ": " + histogram.ToString() + "\n";
+    }
+  }
+  for (size_t level = 0; level < kMaxLevels; ++level) {
+    Histogram histogram;
+    GetCompactionHistogram(level, &histogram);
+    if (histogram.Count()) {
+      out += "compaction.micros level " + std::to_string(level) + ": " +
+             histogram.ToString() + "\n";
+    }
+  }
+  return out;
+}
+
+const char *Statistics::Name(const Ticker ticker) {
+  switch (ticker) {
+    case kMemTableHits:
+      return "memtable.hits";
+    case kMemTableMisses:
+      return "memtable.misses";
+    case kRowCacheHits:
+      return "row.cache.hits";
+    case kRowCacheMisses:
+      return "row.cache.misses";
+    case kSSTFilesOpened:
+      return "sst.files.opened";
+    case kBytesRead:
+      return "bytes.read";
+    case kBytesWritten:
+      return "bytes.written";
+    case kBytesFlushed:
+      return "bytes.flushed";
+    case kBytesIngested:
+      return "bytes.ingested";
+    case kBytesCompactionRead:
+      return "compaction.bytes.read";
+    case kBytesCompactionWritten:
+      return "compaction.bytes.written";
+    case kWriteStallMicros:
+      return "write.stall.micros";
+    default:
+      return "unknown";
+  }
+}
+
+const char *Statistics::Name(const LevelTicker ticker) {
+  switch (ticker) {
+    case kBloomFilterChecks:
+      return "bloom.filter.checks";
+    case kBloomFilterUseful:
+      return "bloom.filter.useful";
+    default:
+      return "unknown";
+  }
+}
+
+const char *Statistics::Name(const HistogramType type) {
+  switch (type) {
+    case kPutMicros:
+      return "put.micros";
+    case kGetMicros:
+      return "get.micros";
+    case kDelMicros:
+      return "del.micros";
+    case kFlushMicros:
+      return "flush.micros";
+    default:
+      return "unknown";
+  }
+}
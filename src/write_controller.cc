@@ -0,0 +1,74 @@
+#include "../include/write_controller.h"
+
+#include <algorithm>
+
+constexpr std::chrono::microseconds WriteController::kMinDelay;
+
+WriteController::WriteController(size_t level0_slowdown_writes_trigger,
+                                 size_t level0_stop_writes_trigger,
+                                 size_t soft_pending_compaction_bytes_limit,
+                                 size_t hard_pending_compaction_bytes_limit,
+                                 size_t delayed_write_rate)
+    : kLevel0SlowdownWritesTrigger(level0_slowdown_writes_trigger),
+      kLevel0StopWritesTrigger(level0_stop_writes_trigger),
+      kSoftPendingCompactionBytesLimit(soft_pending_compaction_bytes_limit),
+      kHardPendingCompactionBytesLimit(hard_pending_compaction_bytes_limit),
+      kDelayedWriteRate(delayed_write_rate),
+      stopped_(false),
+      write_rate_(0),
+      owed_micros_(0) {}
+
+/**
+ * @Description: Tell how far a value went from its slowdown threshold towards
+ * its stop threshold.
+ * @return: Negative below the slowdown threshold, at least 1 at the stop
+ * threshold.
+ */
+static double Progress(size_t value, size_t slowdown, size_t stop) {
+  if (value < slowdown) {
+    return -1;
+  }
+  if (stop <= slowdown) {
+    return value >= stop ? 1 : 0;
+  }
+  return (double)(value - slowdown) / (double)(stop - slowdown);
+}
+
+/**
+ * @Description: Decide whether writes are stopped, delayed, or run at full
+ * speed, from the current shape of the store.
+ * @param num_level0_ssts: Number of SSTs in level-0.
+ * @param pending_compaction_bytes: Bytes compaction has yet to rewrite.
+ */
+void WriteController::Update(size_t num_level0_ssts,
+                             size_t pending_compaction_bytes) {
+  double progress = std::max(
+      Progress(num_level0_ssts, kLevel0SlowdownWritesTrigger,
+               kLevel0StopWritesTrigger),
+      Progress(pending_compaction_bytes, kSoftPendingCompactionBytesLimit,
+               kHardPendingCompactionBytesLimit));
+
+  stopped_ = progress >= 1;
+  if (progress < 0) {
+    write_rate_ = 0;
+    owed_micros_ = 0;
+  } else {
+    double ratio = std::max(1 - progress, 1.0 / 16);
+    write_rate_ = (double)kDelayedWriteRate * ratio;
+  }
+}
+
+std::chrono::microseconds WriteController::DelayFor(size_t bytes) {
+  if (write_rate_ <= 0) {
+    return std::chrono::microseconds(0);
+  }
+
+  owed_micros_ += (double)bytes * 1e6 / write_rate_;
+  if (owed_micros_ < (double)kMinDelay.count()) {
+    return std::chrono::microseconds(0);
+  }
+
+  auto ret = std::chrono::microseconds((long long)owed_micros_);
+  owed_micros_ = 0;
+  return ret;
+}
@@ -1,13 +1,57 @@
+#include <atomic>
+#include <cmath>
 #include <cstdint>
 #include <iostream>
+#include <iterator>
+#include <map>
 #include <random>
+#include <stdexcept>
+#include <thread>
 
+#include "sharded_kvstore.h"
+#include "sst_file_writer.h"
 #include "test.h"
 
+/**
+ * Drops the multiples of 3, and rewrites the values of keys 1 more than them.
+ */
+class ModThreeFilter : public CompactionFilter {
+ public:
+  std::string Name() const override { return "ModThree"; }
+
+  Decision Filter(size_t /*level*/, uint64_t key, const std::string &value,
+                  std::string *new_value) const override {
+    if (key % 3 == 0) {
+      return Decision::kRemove;
+    } else if (key % 3 == 1) {
+      *new_value = std::string(value.size(), 'F');
+      return Decision::kChangeValue;
+    }
+    return Decision::kKeep;
+  }
+};
+
+/**
+ * Adds the operands to a counter, both in decimal, an absent counter being 0.
+ */
+class AddOperator : public MergeOperator {
+ public:
+  std::string Name() const override { return "Add"; }
+
+  std::string FullMerge(
+      uint64_t /*key*/, const std::string *existing_value,
+      const std::vector<std::string> &operands) const override {
+    uint64_t sum = existing_value ? std::stoull(*existing_value) : 0;
+    for (const std::string &operand : operands) sum += std::stoull(operand);
+    return std::to_string(sum);
+  }
+};
+
 class CorrectnessTest : public Test {
  public:
-  explicit CorrectnessTest(const std::string &dir, bool v = true)
-      : Test(dir, v) {}
+  explicit CorrectnessTest(const std::string &dir, bool v = true,
+                           const Options &options = Options())
+      : Test(dir, v, options), kOptions(options) {}
 
   void StartTest(void *args) override {
     std::cout << "KVStore Correctness DoTest" << std::endl;
@@ -18,10 +62,114 @@ class CorrectnessTest : public Test {
     std::cout << "[Large DoTest]" << std::endl;
     RegularTest(kLargeTestMax);
 
+    std::cout << "[Range Deletion DoTest]" << std::endl;
+    RangeDeletionTest(kLargeTestMax);
+
+    std::cout << "[Scan and MultiGet DoTest]" << std::endl;
+    ScanAndMultiGetTest(kLargeTestMax);
+
+    std::cout << "[Snapshot DoTest]" << std::endl;
+    SnapshotTest(kLargeTestMax / 4);
+
+    std::cout << "[Row Cache DoTest]" << std::endl;
+    RowCacheTest(kLargeTestMax / 4);
+
+    std::cout << "[Ingestion DoTest]" << std::endl;
+    IngestionTest(kLargeTestMax / 4);
+
+    std::cout << "[Merge Operator DoTest]" << std::endl;
+    MergeTest(kLargeTestMax / 4);
+
+    std::cout << "[Compaction Filter DoTest]" << std::endl;
+    CompactionFilterTest(kLargeTestMax / 4);
+
+    std::cout << "[Statistics DoTest]" << std::endl;
+    StatisticsTest(kLargeTestMax / 4);
+
+    std::cout << "[Lazy Leveling DoTest]" << std::endl;
+    LazyLevelingTest(kLargeTestMax);
+
+    std::cout << "[Fixed-Size Values DoTest]" << std::endl;
+    FixedSizeValuesTest(kLargeTestMax / 4);
+
+    std::cout << "[Tombstone Compaction DoTest]" << std::endl;
+    TombstoneCompactionTest(kLargeTestMax);
+
+    std::cout << "[Event Log DoTest]" << std::endl;
+    EventLogTest(kLargeTestMax / 2);
+
+    std::cout << "[Sharded Store DoTest]" << std::endl;
+    ShardedTest(kLargeTestMax / 4);
+
+    std::cout << "[Rate Limiter DoTest]" << std::endl;
+    RateLimiterTest();
+
+    std::cout << "[Write Controller DoTest]" << std::endl;
+    WriteControllerTest(kLargeTestMax / 4);
+
+    std::cout << "[Skip List DoTest]" << std::endl;
+    SkipListTest(kLargeTestMax / 16);
+
     utils::Rmdir(kDir.data());
   }
 
  private:
+  /**
+   * The value the sections write to a key, unless they test values of their
+   * own.
+   */
+  static std::string Value(uint64_t key) {
+    return std::string(256, 'a' + key % 26);
+  }
+
+  /**
+   * Push the keys below `max` out of level-0, writing three times as many
+   * keys past them.
+   */
+  static void PushOutOfLevel0(KVStore &store, uint64_t max) {
+    for (uint64_t i = max; i < 4 * max; ++i) store.Put(i, Value(i));
+  }
+
+  /**
+   * Expect a store to hold the pairs of `expected` below `end`, and no other
+   * key there, through `Get`, `MultiGet`, a scan and a reverse iteration.
+   */
+  void ExpectContent(KVStore &store,
+                     const std::map<uint64_t, std::string> &expected,
+                     uint64_t end) {
+    uint64_t i;
+    std::vector<uint64_t> keys;
+    for (i = 0; i < end; ++i) keys.push_back(i);
+    auto values = store.MultiGet(keys);
+    for (i = 0; i < end; ++i) {
+      auto expected_it = expected.find(i);
+      std::string value =
+          expected_it == expected.end() ? not_found_ : expected_it->second;
+      std::string got_value = values[i];
+      EXPECT(value, store.Get(i));
+      EXPECT(value, got_value);
+    }
+
+    auto expected_end = expected.lower_bound(end);
+    auto got = store.Scan(0, end);
+    EXPECT((size_t)std::distance(expected.begin(), expected_end), got.size());
+    auto expected_it = expected.begin();
+    for (i = 0; i < got.size() && expected_it != expected_end; ++i) {
+      EXPECT(expected_it->first, got[i].first);
+      EXPECT((expected_it++)->second, got[i].second);
+    }
+
+    std::unique_ptr<Iterator> it = store.NewIterator();
+    auto expected_rit =
+        std::map<uint64_t, std::string>::const_reverse_iterator(expected_end);
+    for (it->SeekForPrev(end - 1);
+         it->Valid() && expected_rit != expected.rend(); it->Prev()) {
+      EXPECT(expected_rit->first, it->Key());
+      EXPECT((expected_rit++)->second, it->Value());
+    }
+    EXPECT(false, it->Valid());
+  }
+
   void RegularTest(uint64_t max) {
     uint64_t i;
     std::random_device rd;
@@ -70,20 +218,1313 @@ class CorrectnessTest : public Test {
     Report();
   }
 
+  void RangeDeletionTest(uint64_t max) {
+    uint64_t i;
+    const uint64_t begin = max / 4;
+    const uint64_t end = max / 2;
+
+    // Test a range deleted across the mem table and SSTs.
+    for (i = 0; i < max; ++i) store_.Put(i, Value(i));
+    store_.DeleteRange(begin, end);
+
+    for (i = 0; i < max; ++i)
+      EXPECT(i >= begin && i < end ? not_found_ : Value(i), store_.Get(i));
+
+    Phase();
+
+    // Test keys written after the deletion, while the range is compacted.
+    for (i = begin; i < end; i += 2) store_.Put(i, Value(i));
+    for (i = max; i < 2 * max; ++i) store_.Put(i, Value(i));
+
+    for (i = 0; i < max; ++i)
+      EXPECT(i >= begin && i < end && (i - begin) & 1 ? not_found_ : Value(i),
+             store_.Get(i));
+
+    Phase();
+
+    // Test deletions over a deleted range.
+    EXPECT(false, store_.Del(begin + 1));
+    EXPECT(true, store_.Del(begin));
+    store_.DeleteRange(0, 2 * max);
+
+    for (i = 0; i < 2 * max; ++i) EXPECT(not_found_, store_.Get(i));
+
+    Phase();
+
+    Report();
+  }
+
+  void ScanAndMultiGetTest(uint64_t max) {
+    uint64_t i;
+
+    // Expected content of the store, overwritten and deleted keys spread over
+    // the mem table and every level.
+    std::map<uint64_t, std::string> expected;
+    store_.Reset();
+    for (i = 0; i < max; i += 2) store_.Put(i, expected[i] = Value(i));
+    for (i = 0; i < max; i += 3) store_.Put(i, expected[i] = Value(i + 1));
+    for (i = 0; i < max; i += 5) {
+      store_.Del(i);
+      expected.erase(i);
+    }
+    store_.DeleteRange(max / 4, max / 2);
+    expected.erase(expected.lower_bound(max / 4),
+                   expected.lower_bound(max / 2));
+    for (i = max / 4; i < max / 2; i += 7) store_.Put(i, expected[i] = "x");
+
+    // Test scans of the whole key space and of a range.
+    auto got = store_.Scan(0, std::numeric_limits<uint64_t>::max());
+    EXPECT(expected.size(), got.size());
+    auto expected_it = expected.begin();
+    for (i = 0; i < got.size() && expected_it != expected.end(); ++i) {
+      EXPECT(expected_it->first, got[i].first);
+      EXPECT((expected_it++)->second, got[i].second);
+    }
+
+    got = store_.Scan(max / 8, max - max / 8);
+    expected_it = expected.lower_bound(max / 8);
+    for (i = 0; i < got.size() && expected_it != expected.end(); ++i) {
+      EXPECT(expected_it->first, got[i].first);
+      EXPECT((expected_it++)->second, got[i].second);
+    }
+    EXPECT(true, expected.lower_bound(max - max / 8) == expected_it);
+
+    Phase();
+
+    // Test iterating in reverse order, and changing direction.
+    std::unique_ptr<Iterator> it = store_.NewIterator();
+    auto expected_rit = expected.rbegin();
+    for (it->SeekToLast(); it->Valid() && expected_rit != expected.rend();
+         it->Prev()) {
+      EXPECT(expected_rit->first, it->Key());
+      EXPECT((expected_rit++)->second, it->Value());
+    }
+    EXPECT(false, it->Valid());
+
+    for (i = max / 64 + 1; i < max; i += max / 64) {
+      it->Seek(i);
+      expected_it = expected.lower_bound(i);
+      EXPECT(expected_it->first, it->Key());
+      it->Next();
+      it->Prev();
+      it->Prev();
+      EXPECT(std::prev(expected_it)->first, it->Key());
+      it->SeekForPrev(i);
+      EXPECT(std::prev(expected.upper_bound(i))->first, it->Key());
+      it->Next();
+      EXPECT(expected.upper_bound(i)->first, it->Key());
+    }
+
+    Phase();
+
+    // Test batches of keys in random order, with duplicates and absent keys.
+    std::mt19937 g(max);
+    std::vector<uint64_t> keys(1000);
+    for (int round = 0; round < 64; ++round) {
+      for (uint64_t &key : keys) key = g() % (max + max / 8);
+      auto values = store_.MultiGet(keys);
+      EXPECT(keys.size(), values.size());
+      for (i = 0; i < keys.size(); ++i) {
+        expected_it = expected.find(keys[i]);
+        std::string got_value = values[i];
+        EXPECT(expected_it == expected.end() ? not_found_ : expected_it->second,
+               got_value);
+      }
+    }
+
+    Phase();
+
+    // Test short scans over sparse buckets of keys, and over the gaps between
+    // them, past the keys above.
+    const uint64_t base = max * 2;
+    for (i = 0; i < 8; ++i) {
+      for (uint64_t bucket = 0; bucket < 256; ++bucket) {
+        store_.Put(base + bucket * 1024 + i, Value(bucket));
+      }
+    }
+    for (uint64_t bucket = 0; bucket < 256; ++bucket) {
+      got = store_.Scan(base + bucket * 1024 + 8, base + (bucket + 1) * 1024);
+      EXPECT(0, got.size());
+      got = store_.Scan(base + bucket * 1024 + 4, base + bucket * 1024 + 512);
+      EXPECT(4, got.size());
+      EXPECT(base + bucket * 1024 + 4, got.empty() ? 0 : got[0].first);
+    }
+
+    Phase();
+
+    Report();
+  }
+
+  void SnapshotTest(uint64_t max) {
+    uint64_t i;
+    auto current = [&](uint64_t key) {
+      if ((key >= max / 4 && key < max / 2) || key % 4 == 1) return not_found_;
+      return key % 2 ? Value(key) : Value(key + 1);
+    };
+
+    // Test reads at a snapshot while its keys are overwritten, deleted and
+    // compacted.
+    store_.Reset();
+    for (i = 0; i < max; ++i) store_.Put(i, Value(i));
+    const Snapshot *snapshot = store_.GetSnapshot();
+    for (i = 0; i < max; i += 2) store_.Put(i, Value(i + 1));
+    for (i = 1; i < max; i += 4) store_.Del(i);
+    store_.DeleteRange(max / 4, max / 2);
+    PushOutOfLevel0(store_, max);
+
+    for (i = 0; i < max; ++i) EXPECT(Value(i), store_.Get(i, snapshot));
+    for (i = 0; i < max; ++i) EXPECT(current(i), store_.Get(i));
+
+    Phase();
+
+    // Test scans and batches at the snapshot.
+    auto got = store_.Scan(0, max, snapshot);
+    EXPECT((size_t)max, got.size());
+    for (i = 0; i < got.size(); ++i) {
+      EXPECT(i, got[i].first);
+      EXPECT(Value(i), got[i].second);
+    }
+
+    std::vector<uint64_t> keys;
+    for (i = 0; i < max; i += 3) keys.push_back(i);
+    auto values = store_.MultiGet(keys, snapshot);
+    for (i = 0; i < keys.size(); ++i) {
+      std::string got_value = values[i];
+      EXPECT(Value(keys[i]), got_value);
+    }
+
+    Phase();
+
+    // Test a snapshot over a range deletion, then the versions going away
+    // with the snapshots.
+    const Snapshot *later = store_.GetSnapshot();
+    store_.DeleteRange(0, max);
+    for (i = 4 * max; i < 6 * max; ++i) store_.Put(i, Value(i));
+    for (i = 0; i < max; ++i) EXPECT(current(i), store_.Get(i, later));
+    for (i = 0; i < max; ++i) EXPECT(Value(i), store_.Get(i, snapshot));
+
+    store_.ReleaseSnapshot(snapshot);
+    store_.ReleaseSnapshot(later);
+    for (i = 6 * max; i < 8 * max; ++i) store_.Put(i, Value(i));
+    for (i = 0; i < max; ++i) EXPECT(not_found_, store_.Get(i));
+
+    Phase();
+
+    Report();
+  }
+
+  void RowCacheTest(uint64_t max) {
+    uint64_t i;
+    const std::string dir = kDir + "-row-cache";
+
+    Options options = kOptions;
+    options.row_cache_capacity = 64 << 10;
+    {
+      KVStore store(dir, options);
+      for (i = 0; i < max; ++i) store.Put(i, Value(i));
+
+      // Test hot keys read over and over, then written in every way while
+      // cached, and pushed out of the mem table.
+      for (int round = 0; round < 4; ++round)
+        for (i = 0; i < 64; ++i) EXPECT(Value(i), store.Get(i));
+      const Snapshot *snapshot = store.GetSnapshot();
+      for (i = 0; i < 64; i += 2) store.Put(i, "x");
+      for (i = 1; i < 64; i += 4) EXPECT(true, store.Del(i));
+      store.DeleteRange(48, 64);
+      for (i = max; i < 2 * max; ++i) store.Put(i, Value(i));
+
+      for (int round = 0; round < 2; ++round) {
+        for (i = 0; i < 64; ++i)
+          EXPECT(i >= 48 || i % 4 == 1 ? not_found_
+                 : i % 2 == 0          ? std::string("x")
+                                       : Value(i),
+                 store.Get(i));
+      }
+      for (i = 0; i < 64; ++i) EXPECT(Value(i), store.Get(i, snapshot));
+      store.ReleaseSnapshot(snapshot);
+    }
+
+    Phase();
+
+    // Test values too large for the cache, and a reset of the store.
+    {
+      KVStore store(dir, options);
+      std::string large(128 << 10, 'l');
+      store.Put(0, large);
+      for (i = max; i < 2 * max; ++i) store.Put(i, Value(i + 1));
+      for (int round = 0; round < 2; ++round) {
+        EXPECT(large, store.Get(0));
+        for (i = max; i < max + 1024; ++i) EXPECT(Value(i + 1), store.Get(i));
+      }
+
+      store.Reset();
+      EXPECT(not_found_, store.Get(0));
+      for (i = max; i < max + 1024; ++i) EXPECT(not_found_, store.Get(i));
+    }
+    utils::Rmdir(dir.data());
+
+    Phase();
+
+    Report();
+  }
+
+  void IngestionTest(uint64_t max) {
+    uint64_t i;
+    const std::string dir = kDir + "-ingest";
+    const std::string files_dir = kDir + "-external";
+    auto external = [](uint64_t key) {
+      return std::string(128, 'A' + key % 26);
+    };
+    auto write_files = [&](uint64_t first, uint64_t last,
+                           const std::string &out_dir) {
+      SstFileWriter writer(out_dir);
+      for (i = first; i < last; ++i) writer.Put(i, external(i));
+      return writer.Finish();
+    };
+
+    // Test files ingested over keys on disk and in the mem table, and reads
+    // at a snapshot from before.
+    store_.Reset();
+    for (i = 0; i < max; ++i) store_.Put(i, Value(i));
+    PushOutOfLevel0(store_, max);
+    const Snapshot *snapshot = store_.GetSnapshot();
+    for (i = max / 2; i < max / 2 + 16; ++i) store_.Put(i, "m");
+    store_.IngestExternalFile(write_files(max / 2, max + max / 2, files_dir));
+    for (i = max / 2; i < max; i += 4) EXPECT(true, store_.Del(i));
+
+    auto current = [&](uint64_t key) {
+      if (key < max / 2 || key >= max + max / 2) return Value(key);
+      return key < max && key % 4 == (max / 2) % 4 ? not_found_
+                                                    : external(key);
+    };
+    for (i = 0; i < 4 * max; ++i) EXPECT(current(i), store_.Get(i));
+    for (i = 0; i < 4 * max; ++i) EXPECT(Value(i), store_.Get(i, snapshot));
+    auto got = store_.Scan(0, 2 * max);
+    std::vector<uint64_t> keys;
+    for (i = 0; i < 2 * max; ++i) keys.push_back(i);
+    auto values = store_.MultiGet(keys);
+    size_t j = 0;
+    for (i = 0; i < 2 * max; ++i) {
+      std::string got_value = values[i];
+      EXPECT(current(i), got_value);
+      if (current(i) != not_found_ && j < got.size()) {
+        EXPECT(i, got[j].first);
+        EXPECT(current(i), got[j++].second);
+      }
+    }
+    EXPECT(j, got.size());
+    store_.ReleaseSnapshot(snapshot);
+
+    // Files overlapping each other are refused.
+    std::vector<std::string> overlapping = write_files(0, 16, files_dir);
+    std::vector<std::string> more = write_files(8, 24, files_dir + "-2");
+    overlapping.insert(overlapping.end(), more.begin(), more.end());
+    bool refused = false;
+    try {
+      store_.IngestExternalFile(overlapping);
+    } catch (const std::invalid_argument &) {
+      refused = true;
+    }
+    EXPECT(true, refused);
+    for (const std::string &file_path : overlapping) {
+      utils::Rmfile(file_path.data());
+    }
+    store_.Reset();
+    utils::Rmdir(files_dir.data());
+    utils::Rmdir((files_dir + "-2").data());
+
+    Phase();
+
+    // Test a bulk load into an empty store, which writes nothing but the
+    // files, and the files after reopening the store.
+    {
+      KVStore store(dir, kOptions);
+      store.IngestExternalFile(write_files(0, 4 * max, files_dir));
+      EXPECT((size_t)0, store.Stats().bytes_compaction_written.load());
+      EXPECT(1.0, store.Stats().WriteAmplification());
+    }
+    {
+      KVStore store(dir, kOptions);
+      for (i = 0; i < 4 * max; ++i) EXPECT(external(i), store.Get(i));
+      store.Put(0, "x");
+      EXPECT(std::string("x"), store.Get(0));
+
+      bool refused = false;
+      SstFileWriter writer(files_dir);
+      writer.Put(1, "a");
+      try {
+        writer.Put(0, "b");
+      } catch (const std::invalid_argument &) {
+        refused = true;
+      }
+      EXPECT(true, refused);
+      for (const std::string &file_path : writer.Finish()) {
+        utils::Rmfile(file_path.data());
+      }
+      store.Reset();
+    }
+    utils::Rmdir(dir.data());
+    utils::Rmdir(files_dir.data());
+
+    Phase();
+
+    // Test ingestions racing writes to their keys, which keep compactions
+    // busy. Either may win a key, but every read must agree on which.
+    {
+      KVStore store(dir, kOptions);
+      for (i = 0; i < max; ++i) store.Put(i, Value(i));
+      PushOutOfLevel0(store, max);
+      const std::string written(256, 'w');
+      for (int round = 0; round < 4; ++round) {
+        std::vector<std::string> file_paths = write_files(0, max, files_dir);
+        std::atomic<bool> done(false);
+        std::thread writer([&] {
+          for (uint64_t key = 0; !done; key = (key + 1) % max) {
+            store.Put(key, written);
+          }
+        });
+        store.IngestExternalFile(file_paths);
+        done = true;
+        writer.join();
+
+        std::map<uint64_t, std::string> expected;
+        for (i = 0; i < max; ++i) {
+          expected[i] = store.Get(i);
+          EXPECT(true, expected[i] == written || expected[i] == external(i));
+        }
+        ExpectContent(store, expected, max);
+      }
+      store.Reset();
+    }
+    utils::Rmdir(dir.data());
+    utils::Rmdir(files_dir.data());
+
+    Phase();
+
+    Report();
+  }
+
+  void MergeTest(uint64_t max) {
+    uint64_t i;
+    const std::string dir = kDir + "-merge";
+    // Even keys start at the key, odd keys start absent.
+    auto counter = [](uint64_t key, uint64_t rounds) {
+      return std::to_string((key % 2 ? 0 : key) + rounds);
+    };
+    const uint64_t kRounds = 4;
+
+    // Test counters merged into across flushes and compactions, read as of
+    // now and as of a snapshot, then deleted and merged into again.
+    Options options = kOptions;
+    options.merge_operator = std::make_shared<AddOperator>();
+    {
+      KVStore store(dir, options);
+      for (i = 0; i < max; i += 2) store.Put(i, std::to_string(i));
+      const Snapshot *snapshot = nullptr;
+      for (uint64_t round = 0; round < kRounds; ++round) {
+        for (i = 0; i < max; ++i) store.Merge(i, "1");
+        if (round == 1) snapshot = store.GetSnapshot();
+        // Push the counters out of the mem table, and down the levels.
+        for (i = max; i < 2 * max; ++i) store.Put(i, Value(i + round));
+      }
+      for (i = 0; i < max; ++i) EXPECT(counter(i, kRounds), store.Get(i));
+      for (i = 0; i < max; ++i) EXPECT(counter(i, 2), store.Get(i, snapshot));
+      store.ReleaseSnapshot(snapshot);
+
+      for (i = 1; i < max; i += 8) EXPECT(true, store.Del(i));
+      store.DeleteRange(max / 2, max / 2 + 16);
+      for (i = 1; i < max; i += 8) store.Merge(i, "5");
+      for (i = max / 2; i < max / 2 + 16; ++i) store.Merge(i, "7");
+    }
+    // Deleted keys count from the merges after the deletion.
+    auto current = [&](uint64_t key) {
+      bool deleted = key % 8 == 1;
+      bool in_range = key >= max / 2 && key < max / 2 + 16;
+      if (!deleted && !in_range) return counter(key, kRounds);
+      return std::to_string((deleted ? 5 : 0) + (in_range ? 7 : 0));
+    };
+    {
+      KVStore store(dir, options);
+      std::vector<uint64_t> keys;
+      for (i = 0; i < max; ++i) keys.push_back(i);
+      auto values = store.MultiGet(keys);
+      auto got = store.Scan(0, max);
+      EXPECT((size_t)max, got.size());
+      for (i = 0; i < max; ++i) {
+        std::string got_value = values[i];
+        EXPECT(current(i), store.Get(i));
+        EXPECT(current(i), got_value);
+        if (i < got.size()) EXPECT(current(i), got[i].second);
+      }
+    }
+
+    Phase();
+
+    // Test merges folded in the mem table, flushed and compacted away, and a
+    // store without a merge operator refusing merges.
+    {
+      KVStore store(dir, options);
+      for (uint64_t round = 0; round < kRounds; ++round)
+        for (i = 0; i < max; ++i) store.Merge(i, "1");
+      for (i = max; i < 4 * max; ++i) store.Put(i, Value(i));
+      for (i = 0; i < max; ++i)
+        EXPECT(std::to_string(std::stoull(current(i)) + kRounds),
+               store.Get(i));
+      store.Reset();
+    }
+    utils::Rmdir(dir.data());
+
+    bool refused = false;
+    try {
+      store_.Merge(0, "1");
+    } catch (const std::logic_error &) {
+      refused = true;
+    }
+    EXPECT(true, refused);
+
+    Phase();
+
+    Report();
+  }
+
+  void CompactionFilterTest(uint64_t max) {
+    uint64_t i;
+    const std::string dir = kDir + "-filter";
+
+    // Test a filter run by the compactions the writes trigger.
+    Options options = kOptions;
+    options.compaction_filter = std::make_shared<ModThreeFilter>();
+    {
+      KVStore store(dir, options);
+      for (i = 0; i < max; ++i) store.Put(i, Value(i));
+      PushOutOfLevel0(store, max);
+    }
+    {
+      KVStore store(dir, options);
+      for (i = 0; i < max; ++i)
+        EXPECT(i % 3 == 0   ? not_found_
+               : i % 3 == 1 ? std::string(256, 'F')
+                            : Value(i),
+               store.Get(i));
+      store.Reset();
+    }
+
+    Phase();
+
+    // Test values expiring.
+    options = kOptions;
+    options.ttl = 2;
+    {
+      KVStore store(dir, options);
+      for (i = 0; i < max; ++i) store.Put(i, Value(i));
+      EXPECT(Value(max - 1), store.Get(max - 1));
+
+      std::this_thread::sleep_for(std::chrono::seconds(3));
+      for (i = 0; i < max; ++i) EXPECT(not_found_, store.Get(i));
+      EXPECT(false, store.Del(1));
+      store.Put(1, Value(1));
+      EXPECT(Value(1), store.Get(1));
+      EXPECT(true, store.Del(1));
+      store.Reset();
+    }
+    utils::Rmdir(dir.data());
+
+    Phase();
+
+    Report();
+  }
+
+  void StatisticsTest(uint64_t max) {
+    uint64_t i;
+    const std::string dir = kDir + "-statistics";
+
+    // Test the counters of reads and writes, and the properties.
+    Options options = kOptions;
+    options.statistics = std::make_shared<Statistics>();
+    {
+      KVStore store(dir, options);
+      const Statistics &stats = *store.GetStatistics();
+      EXPECT(true, &stats == options.statistics.get());
+      for (i = 0; i < max; ++i) store.Put(2 * i, Value(2 * i));
+      EXPECT(max * (sizeof(uint64_t) + 256),
+             stats.Get(Statistics::kBytesWritten));
+      EXPECT(true, stats.Get(Statistics::kBytesFlushed) > 0);
+
+      EXPECT(Value(2 * max - 2), store.Get(2 * max - 2));
+      EXPECT(1, stats.Get(Statistics::kMemTableHits));
+      EXPECT(Value(0), store.Get(0));
+      EXPECT(1, stats.Get(Statistics::kMemTableMisses));
+      EXPECT(1, stats.Get(Statistics::kSSTFilesOpened));
+      EXPECT(256, stats.Get(Statistics::kBytesRead));
+
+      // Absent keys between the flushed ones, some ruled out by the bloom
+      // filters.
+      for (i = 0; i < max / 2; ++i) EXPECT(not_found_, store.Get(2 * i + 1));
+      uint64_t checks = 0;
+      uint64_t useful = 0;
+      for (size_t level = 0; level < Statistics::kMaxLevels; ++level) {
+        checks += stats.GetLevel(Statistics::kBloomFilterChecks, level);
+        useful += stats.GetLevel(Statistics::kBloomFilterUseful, level);
+      }
+      EXPECT(true, checks >= max / 2);
+      EXPECT(true, useful > 0 && useful <= checks);
+
+      // Test the latencies, and percentiles within the bucket error.
+      Histogram put_micros;
+      stats.GetHistogram(Statistics::kPutMicros, &put_micros);
+      EXPECT(max, put_micros.Count());
+      EXPECT(true, put_micros.Percentile(50) <= put_micros.Percentile(99.9) &&
+                       put_micros.Percentile(99.9) <= put_micros.Max());
+      Histogram get_micros;
+      stats.GetHistogram(Statistics::kGetMicros, &get_micros);
+      EXPECT(2 + max / 2, get_micros.Count());
+      Histogram histogram;
+      for (i = 1; i <= 1000; ++i) histogram.Add(i);
+      EXPECT(true, std::abs(histogram.Percentile(50) - 500) < 500 / 16.0);
+      EXPECT(true, std::abs(histogram.Percentile(99) - 990) < 990 / 16.0);
+      EXPECT(1000, histogram.Max());
+
+      std::string property;
+      EXPECT(true, store.GetProperty("lsm.num-files-at-level0", &property));
+      EXPECT(true, std::stoul(property) > 0);
+      EXPECT(true, store.GetProperty("lsm.num-files-at-level99", &property));
+      EXPECT(std::string("0"), property);
+      const Snapshot *snapshot = store.GetSnapshot();
+      EXPECT(true, store.GetProperty("lsm.num-snapshots", &property));
+      EXPECT(std::string("1"), property);
+      store.ReleaseSnapshot(snapshot);
+      EXPECT(true, store.GetProperty("lsm.write-amplification", &property));
+      EXPECT(true, std::stod(property) >= 1);
+      EXPECT(true, store.GetProperty("lsm.stats", &property));
+      EXPECT(true, property.find("memtable.hits: 1\n") != std::string::npos);
+      EXPECT(false, store.GetProperty("lsm.num-files-at-level", &property));
+      EXPECT(false, store.GetProperty("lsm.unknown", &property));
+      store.Reset();
+    }
+
+    Phase();
+
+    // Test the periodic dumps to the log.
+    options = kOptions;
+    options.stats_dump_period_sec = 1;
+    {
+      KVStore store(dir, options);
+      for (i = 0; i < max; ++i) store.Put(i, Value(i));
+      std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+      store.Reset();
+    }
+    std::ifstream log(dir + "/LOG");
+    std::string line;
+    EXPECT(true, std::getline(log, line) && line.find("** Stats at") == 0);
+    utils::Rmfile((dir + "/LOG").data());
+    utils::Rmdir(dir.data());
+
+    Phase();
+
+    Report();
+  }
+
+  void LazyLevelingTest(uint64_t max) {
+    uint64_t i;
+    const std::string dir = kDir + "-lazy-leveling";
+
+    // Test that the leveled bottom level counts as one run once a level is
+    // added below it, rather than being rewritten into the new bottom level
+    // as a whole every time. The store is closed after every batch, which
+    // waits for the compactions, so that they do not depend on timing.
+    Options options = kOptions;
+    auto strategy = std::make_shared<LazyLevelingCompaction>(2);
+    options.compaction_strategy = strategy;
+    options.statistics = std::make_shared<Statistics>();
+    for (i = 0; i < max;) {
+      KVStore store(dir, options);
+      for (uint64_t end = i + max / 8; i < end; ++i) store.Put(i, Value(i));
+    }
+    const Statistics &stats = *options.statistics;
+    EXPECT(true, stats.Get(Statistics::kBytesFlushed) > 0);
+    EXPECT(true, stats.WriteAmplification() <= strategy->WriteAmplification(3));
+
+    Phase();
+
+    // Test the values after reopening the store, with the levels restamped.
+    {
+      KVStore store(dir, options);
+      std::string property;
+      EXPECT(true, store.GetProperty("lsm.num-files-at-level3", &property));
+      EXPECT(std::string("0"), property);
+      for (i = 0; i < max; ++i) EXPECT(Value(i), store.Get(i));
+      store.Reset();
+    }
+    utils::Rmdir(dir.data());
+
+    Phase();
+
+    Report();
+  }
+
+  void FixedSizeValuesTest(uint64_t max) {
+    uint64_t i;
+    const std::string dir = kDir + "-fixed-size";
+    const uint64_t kOddKey = (uint64_t)1 << 40;
+    const size_t kMarkSize = kDeletionMark.size();
+    std::map<uint64_t, std::string> expected;
+
+    // Test SSTs of values of one size, which compute the offsets of their
+    // values, against the SSTs of a store given a value of another size every
+    // so often, which store them, through flushes, compactions and a reload.
+    {
+      KVStore fixed(dir, kOptions);
+      KVStore variable(dir + "-variable", kOptions);
+      for (i = 0; i < 4 * max; ++i) {
+        fixed.Put(i, expected[i] = Value(i));
+        variable.Put(i, Value(i));
+        if (i % 1024 == 0) variable.Put(kOddKey + i, "o");
+      }
+      for (i = 0; i < max; i += 3) {
+        fixed.Put(i, expected[i] = Value(i + 1));
+        variable.Put(i, Value(i + 1));
+      }
+      ExpectContent(fixed, expected, 4 * max);
+      ExpectContent(variable, expected, 4 * max);
+    }
+    {
+      KVStore fixed(dir, kOptions);
+      KVStore variable(dir + "-variable", kOptions);
+      ExpectContent(fixed, expected, 4 * max);
+      EXPECT(true, fixed.Scan(0, 4 * max) == variable.Scan(0, 4 * max));
+      fixed.Reset();
+      variable.Reset();
+    }
+    utils::Rmdir((dir + "-variable").data());
+
+    Phase();
+
+    // Test deletion marks among values of their size, in one SST of
+    // fixed-size values, over the values they delete.
+    expected.clear();
+    {
+      KVStore store(dir, kOptions);
+      for (i = 0; i < max; ++i)
+        store.Put(i, expected[i] = std::string(kMarkSize, 'a' + i % 26));
+    }
+    {
+      KVStore store(dir, kOptions);
+      for (i = 0; i < max; i += 4) {
+        EXPECT(true, store.Del(i));
+        expected.erase(i);
+        store.Put(i + 2, expected[i + 2] = std::string(kMarkSize, 'A'));
+      }
+    }
+    {
+      KVStore store(dir, kOptions);
+      ExpectContent(store, expected, max);
+      PushOutOfLevel0(store, max);
+      ExpectContent(store, expected, max);
+      store.Reset();
+    }
+
+    Phase();
+
+    // Test values whose write times for TTL expiry make them as large as the
+    // deletion marks.
+    expected.clear();
+    Options options = kOptions;
+    options.ttl = 3600;
+    {
+      KVStore store(dir, options);
+      for (i = 0; i < max; ++i)
+        store.Put(i, expected[i] = std::string(kMarkSize - sizeof(uint64_t),
+                                               'a' + i % 26));
+    }
+    {
+      KVStore store(dir, options);
+      for (i = 0; i < max; i += 4) {
+        EXPECT(true, store.Del(i));
+        expected.erase(i);
+      }
+    }
+    {
+      KVStore store(dir, options);
+      ExpectContent(store, expected, max);
+      PushOutOfLevel0(store, max);
+      ExpectContent(store, expected, max);
+      store.Reset();
+    }
+
+    Phase();
+
+    // Test that deletion marks among values of one size keep the offsets out
+    // of the index, against a store given a value one byte longer every so
+    // often, whose SSTs keep them.
+    expected.clear();
+    {
+      KVStore fixed(dir, kOptions);
+      KVStore variable(dir + "-variable", kOptions);
+      for (i = 0; i < max; ++i) {
+        fixed.Put(i, expected[i] = Value(i));
+        variable.Put(i, Value(i));
+        if (i % 1024 == 0) {
+          fixed.Put(kOddKey + i, expected[kOddKey + i] = std::string(256, 'o'));
+          variable.Put(kOddKey + i, std::string(257, 'o'));
+        }
+      }
+      for (i = 0; i < max; i += 4) {
+        EXPECT(true, fixed.Del(i));
+        EXPECT(true, variable.Del(i));
+        expected.erase(i);
+      }
+      PushOutOfLevel0(fixed, max);
+      PushOutOfLevel0(variable, max);
+      for (i = max; i < 4 * max; ++i) expected[i] = Value(i);
+    }
+    {
+      // Reopened, the vectors of the index are no larger than needed.
+      KVStore fixed(dir, kOptions);
+      KVStore variable(dir + "-variable", kOptions);
+      ExpectContent(fixed, expected, 4 * max);
+      std::string fixed_size;
+      std::string variable_size;
+      EXPECT(true,
+             fixed.GetProperty("lsm.estimate-table-readers-mem", &fixed_size));
+      EXPECT(true, variable.GetProperty("lsm.estimate-table-readers-mem",
+                                        &variable_size));
+      EXPECT(true, std::stoul(fixed_size) < std::stoul(variable_size));
+      fixed.Reset();
+      variable.Reset();
+    }
+    utils::Rmdir((dir + "-variable").data());
+    utils::Rmdir(dir.data());
+
+    Phase();
+
+    Report();
+  }
+
+  void TombstoneCompactionTest(uint64_t max) {
+    uint64_t i;
+    const std::string dir = kDir + "-tombstone-compaction";
+    std::map<uint64_t, std::string> expected;
+
+    // Test an SST of deletion marks pushed into level-1, a middle level with
+    // room, being compacted for its marks. The store is closed after every
+    // batch, which waits for the compactions, so that they do not depend on
+    // timing.
+    Options options = kOptions;
+    options.compaction_strategy = std::make_shared<LeveledCompaction>();
+    options.event_log = std::make_shared<EventLog>();
+    for (i = 0; i < max;) {
+      KVStore store(dir, options);
+      for (uint64_t end = i + max / 8; i < end; ++i)
+        store.Put(i, expected[i] = Value(i));
+    }
+    {
+      KVStore store(dir, options);
+      for (i = max / 4; i < max / 2; ++i) {
+        EXPECT(true, store.Del(i));
+        expected.erase(i);
+      }
+    }
+    {
+      KVStore store(dir, options);
+      for (i = max; i < max + max / 4; ++i)
+        store.Put(i, expected[i] = Value(i));
+    }
+    EXPECT(true, options.event_log->ToChromeTrace().find(
+                     "\"level\":1,\"kind\":\"leveled\","
+                     "\"reason\":\"tombstones\"") != std::string::npos);
+    {
+      KVStore store(dir, options);
+      ExpectContent(store, expected, max + max / 4);
+    }
+
+    Phase();
+
+    // Test that the marks went down to the bottom level and were dropped
+    // there, along with the values they deleted: the files hold nothing but
+    // the live keys.
+    {
+      KVStore store(dir, options);
+      std::string property;
+      size_t num_files = 0;
+      for (size_t level = 0; level < Statistics::kMaxLevels; ++level) {
+        store.GetProperty("lsm.num-files-at-level" + std::to_string(level),
+                          &property);
+        num_files += std::stoul(property);
+      }
+      EXPECT(true, store.GetProperty("lsm.total-sst-files-size", &property));
+      EXPECT(num_files * (kSSTHeaderSize + kBloomFilterSize) +
+                 expected.size() * (kIndexSizePerValue + 256),
+             (size_t)std::stoul(property));
+      store.Reset();
+    }
+    utils::Rmdir(dir.data());
+
+    Phase();
+
+    Report();
+  }
+
+  void EventLogTest(uint64_t max) {
+    uint64_t i;
+    const std::string dir = kDir + "-event-log";
+    auto count = [](const std::string &s, const std::string &sub) {
+      size_t n = 0;
+      for (size_t pos = s.find(sub); pos != std::string::npos;
+           pos = s.find(sub, pos + 1)) {
+        ++n;
+      }
+      return n;
+    };
+
+    // Test the events of flushes, compactions and deletions of files, each
+    // logged whole, with what it did added once done.
+    Options options = kOptions;
+    options.event_log = std::make_shared<EventLog>();
+    {
+      KVStore store(dir, options);
+      EXPECT(true, store.GetEventLog() == options.event_log);
+      for (i = 0; i < max; ++i) store.Put(i, Value(i));
+      for (i = 0; i < max; ++i) store.Put(i, Value(i + 1));
+      store.Reset();
+    }
+    std::string trace = options.event_log->ToChromeTrace();
+    EXPECT(0, trace.find("{\"traceEvents\":["));
+    for (const std::string name :
+         {"flush", "compaction", "subcompaction", "delete_file"}) {
+      EXPECT(true, count(trace, "\"name\":\"" + name +
+                                    "\",\"cat\":\"lsm\",\"ph\":\"X\"") > 0);
+    }
+    EXPECT(count(trace, "\"ph\":"), count(trace, "\"dur\":"));
+    EXPECT(count(trace, "\"name\":\"compaction\""),
+           count(trace, "\"capacity\":"));
+    EXPECT(count(trace, "\"name\":\"compaction\""),
+           count(trace, "\"files_left_at_level\":"));
+    EXPECT(true, trace.find("\"keys_dropped\":0}") != std::string::npos);
+    EXPECT(true, trace.find("\"input_files\":[\"" + dir + "/level-0/") !=
+                     std::string::npos);
+
+    std::string path = dir + ".json";
+    options.event_log->ExportChromeTrace(path);
+    std::ifstream in(path);
+    std::string exported((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+    EXPECT(trace, exported);
+    utils::Rmfile(path.data());
+    utils::Rmdir(dir.data());
+
+    Phase();
+
+    // Test the arguments, and that only the latest events are kept, each of
+    // them whole.
+    EventLog::Args args;
+    args.Add("n", 1).Add("s", "a\"b\\").Add(
+        "v", std::vector<std::string>{"x", "y"});
+    EXPECT(std::string("\"n\":1,\"s\":\"a\\\"b\\\\\",\"v\":[\"x\",\"y\"]"),
+           args.Json());
+    EventLog event_log(2);
+    event_log.Complete("a", std::chrono::steady_clock::now());
+    {
+      EventSpan span(&event_log, "b", EventLog::Args().Add("n", 1));
+      span.EndArgs().Add("m", 2);
+    }
+    event_log.Complete("c", std::chrono::steady_clock::now(), args);
+    EXPECT(2, event_log.Size());
+    trace = event_log.ToChromeTrace();
+    EXPECT(std::string::npos, trace.find("\"name\":\"a\""));
+    EXPECT(true,
+           trace.find("\"name\":\"b\",\"cat\":\"lsm\",\"ph\":\"X\",\"ts\":") !=
+               std::string::npos);
+    EXPECT(true, trace.find("\"args\":{\"n\":1,\"m\":2}") != std::string::npos);
+    EXPECT(true, trace.find("\"args\":{" + args.Json() + "}") !=
+                     std::string::npos);
+    event_log.Clear();
+    EXPECT(0, event_log.Size());
+
+    Phase();
+
+    Report();
+  }
+
+  void ShardedTest(uint64_t max) {
+    uint64_t i;
+    const std::string dir = kDir + "-sharded";
+
+    // All keys fall into the first shard, which gets split as it turns hot.
+    ShardingOptions sharding_options;
+    sharding_options.max_shards = 8;
+    sharding_options.split_check_interval = 1024;
+    size_t num_shards;
+    {
+      ShardedKVStore store(dir, sharding_options, kOptions);
+      for (i = 0; i < max; ++i) store.Put(i, Value(i));
+      for (i = 0; i < max; i += 2) EXPECT(true, store.Del(i));
+
+      num_shards = store.NumShards();
+      EXPECT(true, num_shards > sharding_options.num_shards);
+      for (i = 0; i < max; ++i)
+        EXPECT((i & 1) ? Value(i) : not_found_, store.Get(i));
+
+      // Test a scan across the shards.
+      auto got = store.Scan(0, max);
+      EXPECT(max / 2, got.size());
+      for (i = 0; i < got.size(); ++i) EXPECT(2 * i + 1, got[i].first);
+
+      std::vector<uint64_t> keys;
+      for (i = max; i-- > 0;) keys.push_back(i);
+      auto values = store.MultiGet(keys);
+      for (i = 0; i < max; ++i) {
+        std::string got_value = values[i];
+        EXPECT((keys[i] & 1) ? Value(keys[i]) : not_found_, got_value);
+      }
+    }
+
+    Phase();
+
+    // Test the shards after reopening the store.
+    {
+      ShardedKVStore store(dir, sharding_options, kOptions);
+      EXPECT(num_shards, store.NumShards());
+      for (i = 0; i < max; ++i)
+        EXPECT((i & 1) ? Value(i) : not_found_, store.Get(i));
+
+      store.DeleteRange(max / 4, std::numeric_limits<uint64_t>::max());
+      for (i = 0; i < max; ++i)
+        EXPECT((i & 1) && i < max / 4 ? Value(i) : not_found_, store.Get(i));
+      store.Reset();
+    }
+
+    Phase();
+
+    // Test a row cache shared by the shards, over keys written while cached
+    // and moved by splits.
+    {
+      Options options = kOptions;
+      options.row_cache = std::make_shared<RowCache>(64 << 10);
+      ShardedKVStore store(dir, sharding_options, options);
+      for (i = 0; i < max; ++i) store.Put(i, Value(i));
+      for (i = 0; i < max; i += max / 64) EXPECT(Value(i), store.Get(i));
+      for (i = 0; i < max; i += max / 64) EXPECT(Value(i), store.Get(i));
+      EXPECT(true, options.row_cache->NumHits() > 0);
+      for (i = 0; i < max; i += 2) store.Put(i, Value(i + 1));
+      for (i = 0; i < max; ++i)
+        EXPECT((i & 1) ? Value(i) : Value(i + 1), store.Get(i));
+      store.Reset();
+    }
+
+    Phase();
+
+    Report();
+  }
+
+  void RateLimiterTest() {
+    typedef std::chrono::steady_clock Clock;
+    auto millis_since = [](Clock::time_point start) {
+      return std::chrono::duration_cast<std::chrono::milliseconds>(
+                 Clock::now() - start)
+          .count();
+    };
+
+    // Test the rate of requests larger than one refill, which are served in
+    // several rounds.
+    {
+      RateLimiter rate_limiter(1 << 20, false, 64 << 20,
+                               std::chrono::milliseconds(10));
+      auto start = Clock::now();
+      for (int i = 0; i < 4; ++i)
+        rate_limiter.Request(64 << 10, IOPriority::kCompaction);
+      auto millis = millis_since(start);
+      EXPECT(true, millis >= 200 && millis < 1000);
+      EXPECT((size_t)256 << 10,
+             rate_limiter.TotalBytesThrough(IOPriority::kCompaction));
+      EXPECT((size_t)0, rate_limiter.TotalBytesThrough(IOPriority::kFlush));
+    }
+
+    Phase();
+
+    // Test a flush queued after a compaction, both waiting for the bucket to
+    // refill, being served first.
+    {
+      RateLimiter rate_limiter(1000, false, 64 << 20,
+                               std::chrono::milliseconds(100));
+      rate_limiter.Request(100, IOPriority::kCompaction);
+      std::mutex mutex;
+      std::vector<IOPriority> granted;
+      auto request = [&](IOPriority priority) {
+        rate_limiter.Request(100, priority);
+        std::lock_guard<std::mutex> lock(mutex);
+        granted.push_back(priority);
+      };
+      std::thread compaction(request, IOPriority::kCompaction);
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      std::thread flush(request, IOPriority::kFlush);
+      compaction.join();
+      flush.join();
+      EXPECT((size_t)2, granted.size());
+      EXPECT(true, granted[0] == IOPriority::kFlush);
+    }
+
+    Phase();
+
+    // Test the budget following the debt reported by two stores.
+    {
+      int store;
+      int other_store;
+      RateLimiter rate_limiter(8 << 20, true, 64 << 20);
+      EXPECT((size_t)1 << 20, rate_limiter.BytesPerSecond());
+      rate_limiter.ReportPendingCompactionBytes(&store, 32 << 20);
+      EXPECT((size_t)(8 << 20) / 16 * 9, rate_limiter.BytesPerSecond());
+      rate_limiter.ReportPendingCompactionBytes(&other_store, 32 << 20);
+      EXPECT((size_t)8 << 20, rate_limiter.BytesPerSecond());
+      rate_limiter.ReportPendingCompactionBytes(&other_store, 256 << 20);
+      EXPECT((size_t)8 << 20, rate_limiter.BytesPerSecond());
+      rate_limiter.ReportPendingCompactionBytes(&other_store, 0);
+      EXPECT((size_t)(8 << 20) / 16 * 9, rate_limiter.BytesPerSecond());
+      rate_limiter.ReportPendingCompactionBytes(&store, 0);
+      EXPECT((size_t)1 << 20, rate_limiter.BytesPerSecond());
+      rate_limiter.SetBytesPerSecond(16 << 20);
+      EXPECT((size_t)2 << 20, rate_limiter.BytesPerSecond());
+
+      RateLimiter fixed_rate_limiter(8 << 20);
+      fixed_rate_limiter.ReportPendingCompactionBytes(&store, 32 << 20);
+      EXPECT((size_t)8 << 20, fixed_rate_limiter.BytesPerSecond());
+    }
+
+    Phase();
+
+    Report();
+  }
+
+  void WriteControllerTest(uint64_t max) {
+    uint64_t i;
+    const std::string dir = kDir + "-write-stall";
+    const auto kMinDelay = WriteController::kMinDelay.count();
+
+    // Test the delays from the slowdown threshold of level-0, where a byte
+    // costs a microsecond, up to the stop threshold, where the rate bottoms
+    // out at a sixteenth.
+    WriteController controller(8, 12, 64 << 20, 256 << 20, 1000 * 1000);
+    controller.Update(7, 0);
+    EXPECT(0, controller.DelayFor(1 << 20).count());
+    controller.Update(8, 0);
+    EXPECT(false, controller.IsStopped());
+    EXPECT(0, controller.DelayFor(kMinDelay - 1).count());
+    EXPECT(kMinDelay, controller.DelayFor(1).count());
+    controller.Update(10, 0);
+    EXPECT(2 * kMinDelay, controller.DelayFor(kMinDelay).count());
+    controller.Update(11, 0);
+    EXPECT(4 * kMinDelay, controller.DelayFor(kMinDelay).count());
+    controller.Update(12, 0);
+    EXPECT(true, controller.IsStopped());
+    EXPECT(16 * kMinDelay, controller.DelayFor(kMinDelay).count());
+
+    // Test the pending compaction bytes, the further of the two from their
+    // slowdown threshold winning.
+    controller.Update(0, 160 << 20);
+    EXPECT(false, controller.IsStopped());
+    EXPECT(2 * kMinDelay, controller.DelayFor(kMinDelay).count());
+    controller.Update(11, 160 << 20);
+    EXPECT(4 * kMinDelay, controller.DelayFor(kMinDelay).count());
+    controller.Update(0, 256 << 20);
+    EXPECT(true, controller.IsStopped());
+
+    // Test the delay owed being forgiven at full speed.
+    controller.Update(8, 0);
+    EXPECT(0, controller.DelayFor(kMinDelay - 1).count());
+    controller.Update(0, 0);
+    EXPECT(false, controller.IsStopped());
+    controller.Update(8, 0);
+    EXPECT(0, controller.DelayFor(1).count());
+
+    Phase();
+
+    // Test the stalls of a store slowed down from the first SST in level-0,
+    // in its stats, statistics and properties.
+    Options options = kOptions;
+    options.statistics = std::make_shared<Statistics>();
+    options.level0_slowdown_writes_trigger = 1;
+    options.level0_stop_writes_trigger = 64;
+    options.delayed_write_rate = 64 << 20;
+    {
+      KVStore store(dir, options);
+      for (i = 0; i < max; ++i) store.Put(i, Value(i));
+      size_t num_write_stalls = store.Stats().num_write_stalls;
+      size_t write_stall_micros = store.Stats().write_stall_micros;
+      EXPECT(true, num_write_stalls > 0);
+      EXPECT(true, write_stall_micros >= num_write_stalls * kMinDelay);
+      EXPECT((uint64_t)write_stall_micros,
+             options.statistics->Get(Statistics::kWriteStallMicros));
+      std::string property;
+      EXPECT(true, store.GetProperty("lsm.stats", &property));
+      EXPECT(true, property.find("write stalls: " +
+                                 std::to_string(num_write_stalls) + "\n") !=
+                       std::string::npos);
+      store.Reset();
+    }
+    {
+      KVStore store(dir, kOptions);
+      for (i = 0; i < max; ++i) store.Put(i, Value(i));
+      EXPECT((size_t)0, store.Stats().num_write_stalls.load());
+      store.Reset();
+    }
+    utils::Rmdir(dir.data());
+
+    Phase();
+
+    Report();
+  }
+
+  /**
+   * Expect a skip list to hold the pairs of `expected` and nothing else, both
+   * searched from the top level and walked along the bottom one.
+   */
+  void ExpectSkipList(const SkipList &skip_list,
+                      const std::map<uint64_t, std::string> &expected,
+                      uint64_t max) {
+    for (uint64_t i = 0; i < max; ++i) {
+      auto expected_it = expected.find(i);
+      const std::string *value = skip_list.Get(i);
+      EXPECT(expected_it == expected.end() ? not_found_ : expected_it->second,
+             value ? *value : not_found_);
+    }
+    auto entries = skip_list.Entries(0, max, kMaxSequenceNumber);
+    EXPECT(expected.size(), entries.size());
+    auto expected_it = expected.begin();
+    for (size_t i = 0; i < entries.size() && expected_it != expected.end();
+         ++i) {
+      EXPECT(expected_it->first, entries[i].key);
+      EXPECT((expected_it++)->second, entries[i].value);
+    }
+    EXPECT(expected.size(), skip_list.Size());
+  }
+
+  void SkipListTest(uint64_t max) {
+    uint64_t i;
+    std::map<uint64_t, std::string> expected;
+
+    // Test keys written in ascending, descending and interleaved order, each
+    // write searching from where the last one left the finger, then
+    // overwritten in the reverse order.
+    std::vector<std::vector<uint64_t>> orders(3);
+    for (i = 0; i < max; ++i) {
+      orders[0].push_back(i);
+      orders[1].push_back(max - 1 - i);
+      orders[2].push_back(i % 2 ? max - 1 - i / 2 : i / 2);
+    }
+    for (const std::vector<uint64_t> &order : orders) {
+      SkipList skip_list;
+      SequenceNumber seq = 0;
+      for (uint64_t key : order)
+        skip_list.Put(key, expected[key] = std::to_string(key), ++seq);
+      ExpectSkipList(skip_list, expected, max + 1);
+      for (auto it = order.rbegin(); it != order.rend(); ++it)
+        skip_list.Put(*it, expected[*it] = std::to_string(*it + 1), ++seq);
+      ExpectSkipList(skip_list, expected, max + 1);
+      expected.clear();
+    }
+
+    Phase();
+
+    // Test deletions after the finger moved past the key, or back before it:
+    // of the last key, of the first one after writing the last, and of keys
+    // at random, checked against a map.
+    SkipList skip_list;
+    const size_t empty_file_size = skip_list.FileSize();
+    SequenceNumber seq = 0;
+    for (i = 0; i < max; i += 2)
+      skip_list.Put(i, expected[i] = std::to_string(i), ++seq);
+    EXPECT(true, skip_list.Del(max - 2));
+    expected.erase(max - 2);
+    skip_list.Put(max, expected[max] = "last", ++seq);
+    EXPECT(true, skip_list.Del(0));
+    expected.erase(0);
+    skip_list.Put(1, expected[1] = "first", ++seq);
+    EXPECT(false, skip_list.Del(max - 1));
+    EXPECT(true, skip_list.Del(max));
+    expected.erase(max);
+    skip_list.Put(max + 1, expected[max + 1] = "last", ++seq);
+    ExpectSkipList(skip_list, expected, max + 2);
+
+    std::mt19937 g(max);
+    for (i = 0; i < 16 * max; ++i) {
+      uint64_t key = g() % (max + 2);
+      if (g() % 3) {
+        skip_list.Put(key, expected[key] = std::to_string(i), ++seq);
+      } else {
+        EXPECT(expected.erase(key) > 0, skip_list.Del(key));
+      }
+    }
+    ExpectSkipList(skip_list, expected, max + 2);
+
+    for (i = 0; i < max + 2; ++i) skip_list.Del(i);
+    expected.clear();
+    ExpectSkipList(skip_list, expected, max + 2);
+    EXPECT(empty_file_size, skip_list.FileSize());
+
+    Phase();
+
+    Report();
+  }
+
   const uint64_t kSimpleTestMax = 512;
   const uint64_t kLargeTestMax = 1024 * 64;
+
+  // Options the test was started with, which the stores of the sections start
+  // from, too.
+  const Options kOptions;
 };
 
 int main(int argc, char *argv[]) {
-  bool verbose = (argc == 2 && std::string(argv[1]) == "-v");
+  bool verbose = false;
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "-v") {
+      verbose = true;
+    } else if (arg == "-c" && i + 1 < argc) {
+      std::string strategy = argv[++i];
+      if (strategy == "tiered") {
+        options.compaction_strategy = std::make_shared<TieredCompaction>();
+      } else if (strategy == "lazy-leveling") {
+        options.compaction_strategy =
+            std::make_shared<LazyLevelingCompaction>();
+      }
+    } else if (arg == "-p" && i + 1 < argc) {
+      std::string policy = argv[++i];
+      if (policy == "min-overlap") {
+        options.compaction_pick_policy =
+            CompactionPickPolicy::kMinOverlappingRatio;
+      } else if (policy == "tombstones") {
+        options.compaction_pick_policy = CompactionPickPolicy::kMostTombstones;
+      } else if (policy == "round-robin") {
+        options.compaction_pick_policy = CompactionPickPolicy::kRoundRobin;
+      }
+    } else if (arg == "-i" && i + 1 < argc) {
+      std::string backend = argv[++i];
+      if (backend == "pread") {
+        options.io_backend = std::make_shared<PosixIOBackend>();
+      }
+    }
+  }
+  if (!options.io_backend) {
+    options.io_backend = IOBackend::NewDefault();
+  }
 
-  std::cout << "Usage: " << argv[0] << " [-v]" << std::endl;
+  std::cout << "Usage: " << argv[0]
+            << " [-v] [-c leveled|tiered|lazy-leveling]"
+               " [-p oldest|min-overlap|tombstones|round-robin]"
+               " [-i io_uring|pread]"
+            << std::endl;
   std::cout << "  -v: print extra info for failed tests [currently ";
   std::cout << (verbose ? "ON" : "OFF") << "]" << std::endl;
+  std::cout << "  -c: compaction strategy [currently ";
+  std::cout << options.compaction_strategy->Name() << "]" << std::endl;
+  std::cout << "  -p: compaction pick policy of leveled levels" << std::endl;
+  std::cout << "  -i: I/O backend [currently ";
+  std::cout << options.io_backend->Name() << "]" << std::endl;
   std::cout << std::endl;
   std::cout.flush();
 
-  CorrectnessTest test("./data", verbose);
+  CorrectnessTest test("./data", verbose, options);
   test.StartTest(nullptr);
   return 0;
 }
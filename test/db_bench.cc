@@ -0,0 +1,628 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include "histogram.h"
+#include "kvstore.h"
+#include "utils.h"
+
+/**
+ * Zipfian distribution over [0, n), 0 the most popular, generated as YCSB
+ * does after Gray et al., "Quickly Generating Billion-Record Synthetic
+ * Databases".
+ */
+class ZipfianGenerator {
+ public:
+  ZipfianGenerator(uint64_t n, double theta)
+      : n_(n),
+        theta_(theta),
+        alpha_(1 / (1 - theta)),
+        zeta_n_(Zeta(n, theta)),
+        eta_((1 - std::pow(2.0 / n, 1 - theta)) /
+             (1 - Zeta(2, theta) / zeta_n_)) {}
+
+  uint64_t Next(std::mt19937_64 &rng) const {
+    double u = std::uniform_real_distribution<double>(0, 1)(rng);
+    double uz = u * zeta_n_;
+    if (uz < 1) {
+      return 0;
+    }
+    if (uz < 1 + std::pow(0.5, theta_)) {
+      return 1;
+    }
+    return std::min(n_ - 1, (uint64_t)((double)n_ *
+                                       std::pow(eta_ * u - eta_ + 1, alpha_)));
+  }
+
+ private:
+  static double Zeta(uint64_t n, double theta) {
+    double sum = 0;
+    for (uint64_t i = 1; i <= n; ++i) {
+      sum += 1 / std::pow((double)i, theta);
+    }
+    return sum;
+  }
+
+  const uint64_t n_;
+
+  const double theta_;
+
+  const double alpha_;
+
+  const double zeta_n_;
+
+  const double eta_;
+};
+
+enum class Distribution { kUniform, kZipfian, kLatest };
+
+// Inserts write keys past the loaded ones, writes overwrite picked keys.
+enum OpType { kRead, kWrite, kInsert, kScan, kReadModifyWrite, kNumOpTypes };
+
+static const char *const kOpNames[kNumOpTypes] = {"read", "write", "insert",
+                                                  "scan", "rmw"};
+
+/**
+ * Proportions of the operations of a benchmark, and how it picks keys.
+ */
+struct Workload {
+  double proportions[kNumOpTypes];
+
+  Distribution distribution;
+
+  // Keys in ascending order, written once each, rather than picked.
+  bool sequential;
+
+  // Scans read up to this many entries, a random number of them if set.
+  int scan_length = 1;
+
+  bool random_scan_length = false;
+};
+
+struct BenchOptions {
+  std::string benchmarks = "fillrandom,readrandom";
+
+  std::string db = "./bench-data";
+
+  // Keep the data of the last run rather than starting empty.
+  bool use_existing = false;
+
+  // Keys loaded by the fills, which the other benchmarks pick from.
+  uint64_t num = 100000;
+
+  // Operations of a benchmark over all threads, `num` if 0.
+  uint64_t ops = 0;
+
+  // Run every benchmark but the fills for this many seconds rather than for
+  // `ops` operations, if not 0.
+  double duration = 0;
+
+  // Operations every thread runs before the clock starts, not measured.
+  uint64_t warmup = 0;
+
+  size_t value_size = 100;
+
+  int threads = 1;
+
+  // Overrides the distribution of the benchmark if not empty.
+  std::string distribution;
+
+  double zipf_theta = 0.99;
+
+  // Overrides the mix of the benchmark with reads and updates if not negative.
+  int read_percent = -1;
+
+  // Scans read up to this many entries, and seeks this many after the first.
+  int scan_length = 100;
+
+  int seek_nexts = 0;
+
+  double report_interval = 1;
+
+  // `text` or `json`, one object per line.
+  std::string format = "text";
+
+  std::string compaction = "leveled";
+
+  // Print the `lsm.stats` property after every benchmark.
+  bool statistics = false;
+
+  // Export the flushes, compactions and write stalls of the store to this file
+  // after the benchmarks, as a Chrome trace, if not empty.
+  std::string trace_file;
+
+  // Trace the operations slower than this too, for latency spikes to line up
+  // with the background work. 0 traces none.
+  uint64_t trace_slow_micros = 0;
+};
+
+/**
+ * What the threads of a benchmark measured. Histograms are in nanoseconds.
+ */
+struct BenchResult {
+  Histogram latencies[kNumOpTypes];
+
+  std::atomic<uint64_t> done{0};
+
+  std::atomic<uint64_t> found{0};
+
+  double seconds = 0;
+
+  // Throughput of every report interval.
+  std::vector<std::pair<double, double>> timeline;
+};
+
+class Benchmark {
+ public:
+  explicit Benchmark(const BenchOptions &options)
+      : options_(options),
+        next_insert_key_(options.num),
+        inserted_end_(options.num) {
+    if (!options_.use_existing) {
+      KVStore(options_.db).Reset();
+    }
+    Options store_options;
+    if (options_.compaction == "tiered") {
+      store_options.compaction_strategy = std::make_shared<TieredCompaction>();
+    } else if (options_.compaction == "lazy-leveling") {
+      store_options.compaction_strategy =
+          std::make_shared<LazyLevelingCompaction>();
+    }
+    if (!options_.trace_file.empty()) {
+      store_options.event_log = std::make_shared<EventLog>();
+    }
+    store_.reset(new KVStore(options_.db, store_options));
+  }
+
+  void Run() {
+    std::stringstream names(options_.benchmarks);
+    std::string name;
+    while (std::getline(names, name, ',')) {
+      Workload workload;
+      if (!WorkloadFor(name, &workload)) {
+        std::cerr << "Unknown benchmark: " << name << std::endl;
+        continue;
+      }
+      BenchResult result;
+      {
+        EventSpan span(store_->GetEventLog().get(), "benchmark",
+                       EventLog::Args().Add("name", name));
+        RunWorkload(name, workload, result);
+      }
+      Report(name, result);
+      if (options_.statistics) {
+        std::string stats;
+        store_->GetProperty("lsm.stats", &stats);
+        std::cout << stats << std::flush;
+      }
+    }
+    if (!options_.trace_file.empty()) {
+      store_->GetEventLog()->ExportChromeTrace(options_.trace_file);
+    }
+  }
+
+ private:
+  /**
+   * @Description: Look a benchmark up by name: the fills, `overwrite`,
+   * `readrandom`, `seekrandom`, or one of the YCSB core workloads `ycsba` to
+   * `ycsbf`, then apply the overrides of the options.
+   * @param name: The name of the benchmark.
+   * @param workload: Set to the workload of the benchmark.
+   * @return: `false` iff the benchmark is unknown.
+   */
+  bool WorkloadFor(const std::string &name, Workload *workload) const {
+    //                 read write insert scan rmw
+    static const std::map<std::string, Workload> kWorkloads = {
+        {"fillseq", {{0, 1, 0, 0, 0}, Distribution::kUniform, true}},
+        {"fillrandom", {{0, 1, 0, 0, 0}, Distribution::kUniform, false}},
+        {"overwrite", {{0, 1, 0, 0, 0}, Distribution::kUniform, false}},
+        {"readrandom", {{1, 0, 0, 0, 0}, Distribution::kUniform, false}},
+        {"seekrandom", {{0, 0, 0, 1, 0}, Distribution::kUniform, false}},
+        {"ycsba", {{0.5, 0.5, 0, 0, 0}, Distribution::kZipfian, false}},
+        {"ycsbb", {{0.95, 0.05, 0, 0, 0}, Distribution::kZipfian, false}},
+        {"ycsbc", {{1, 0, 0, 0, 0}, Distribution::kZipfian, false}},
+        {"ycsbd", {{0.95, 0, 0.05, 0, 0}, Distribution::kLatest, false}},
+        {"ycsbe", {{0, 0, 0.05, 0.95, 0}, Distribution::kZipfian, false}},
+        {"ycsbf", {{0.5, 0, 0, 0, 0.5}, Distribution::kZipfian, false}},
+    };
+    auto it = kWorkloads.find(name);
+    if (it == kWorkloads.end()) {
+      return false;
+    }
+    *workload = it->second;
+    workload->scan_length =
+        name == "ycsbe" ? options_.scan_length : 1 + options_.seek_nexts;
+    workload->random_scan_length = name == "ycsbe";
+    if (IsFill(name)) {
+      return true;
+    }
+    if (options_.distribution == "uniform") {
+      workload->distribution = Distribution::kUniform;
+    } else if (options_.distribution == "zipfian") {
+      workload->distribution = Distribution::kZipfian;
+    } else if (options_.distribution == "latest") {
+      workload->distribution = Distribution::kLatest;
+    }
+    if (options_.read_percent >= 0) {
+      std::fill(workload->proportions, workload->proportions + kNumOpTypes, 0);
+      workload->proportions[kRead] = options_.read_percent / 100.0;
+      workload->proportions[kWrite] = 1 - options_.read_percent / 100.0;
+    }
+    return true;
+  }
+
+  static bool IsFill(const std::string &name) {
+    return name.compare(0, 4, "fill") == 0;
+  }
+
+  /**
+   * @Description: Run a benchmark on `options_.threads` threads, which warm
+   * up, then start the clock together. A reporter samples the operations done
+   * every report interval.
+   * @param name: The name of the benchmark.
+   * @param workload: What the threads run.
+   * @param result: Set to what the threads measured.
+   */
+  void RunWorkload(const std::string &name, const Workload &workload,
+                   BenchResult &result) {
+    bool timed = options_.duration > 0 && !IsFill(name);
+    uint64_t total_ops = options_.ops && !IsFill(name) ? options_.ops
+                                                       : options_.num;
+    int num_threads = options_.threads;
+    std::atomic<int> num_ready{0};
+    std::atomic<bool> go{false};
+    std::atomic<bool> stop{false};
+    ZipfianGenerator zipfian(options_.num, options_.zipf_theta);
+
+    auto client = [&](int tid) {
+      std::mt19937_64 rng(tid + 1);
+      uint64_t begin = total_ops * tid / num_threads;
+      uint64_t end = total_ops * (tid + 1) / num_threads;
+      for (uint64_t i = 0; i < options_.warmup; ++i) {
+        RunOp(workload, zipfian, rng, begin, nullptr);
+      }
+      ++num_ready;
+      while (!go) {
+        std::this_thread::yield();
+      }
+      for (uint64_t i = begin; timed ? !stop.load() : i < end; ++i) {
+        RunOp(workload, zipfian, rng, i, &result);
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; ++i) {
+      threads.emplace_back(client, i);
+    }
+    while (num_ready < num_threads) {
+      std::this_thread::yield();
+    }
+
+    auto start_time = std::chrono::steady_clock::now();
+    go = true;
+    std::thread reporter([&] {
+      uint64_t last_done = 0;
+      double next_report = options_.report_interval;
+      while (!stop) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        double elapsed = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start_time)
+                             .count();
+        if (elapsed >= next_report) {
+          uint64_t done = result.done;
+          result.timeline.emplace_back(
+              next_report,
+              (double)(done - last_done) / options_.report_interval);
+          last_done = done;
+          next_report += options_.report_interval;
+        }
+        if (timed && elapsed >= options_.duration) {
+          stop = true;
+        }
+      }
+    });
+
+    for (std::thread &t : threads) {
+      t.join();
+    }
+    result.seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start_time)
+                         .count();
+    stop = true;
+    reporter.join();
+  }
+
+  /**
+   * @Description: Pick an operation of a workload and a key, and run it.
+   * @param workload: The workload.
+   * @param zipfian: Generator of the zipfian keys.
+   * @param rng: Random source of the thread.
+   * @param i: Index of the operation in the benchmark, the key of sequential
+   * ones.
+   * @param result: What to record the latency into, `nullptr` while warming
+   * up.
+   */
+  void RunOp(const Workload &workload, const ZipfianGenerator &zipfian,
+             std::mt19937_64 &rng, const uint64_t i, BenchResult *result) {
+    double pick = std::uniform_real_distribution<double>(0, 1)(rng);
+    int op = 0;
+    while (op < kNumOpTypes - 1 && pick >= workload.proportions[op]) {
+      pick -= workload.proportions[op++];
+    }
+
+    uint64_t key;
+    if (workload.sequential) {
+      key = i;
+    } else if (op == kInsert) {
+      key = next_insert_key_++;
+    } else {
+      key = NextKey(workload.distribution, zipfian, rng);
+    }
+    std::string value(options_.value_size, 'a' + rng() % 26);
+
+    auto start_time = std::chrono::steady_clock::now();
+    bool found = false;
+    switch (op) {
+      case kRead:
+        found = !store_->Get(key).empty();
+        break;
+      case kWrite:
+        store_->Put(key, value);
+        break;
+      case kInsert: {
+        store_->Put(key, value);
+        uint64_t end = inserted_end_;
+        while (end < key + 1 &&
+               !inserted_end_.compare_exchange_weak(end, key + 1)) {
+        }
+        break;
+      }
+      case kScan: {
+        std::unique_ptr<Iterator> it = store_->NewIterator();
+        it->Seek(key);
+        int length = workload.random_scan_length
+                         ? 1 + (int)(rng() % workload.scan_length)
+                         : workload.scan_length;
+        for (int n = 0; n < length && it->Valid(); ++n, it->Next()) {
+          found = true;
+          it->Value();
+        }
+        break;
+      }
+      default:
+        found = !store_->Get(key).empty();
+        store_->Put(key, value);
+        break;
+    }
+    if (!result) {
+      return;
+    }
+    uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now() - start_time)
+                         .count();
+    result->latencies[op].Add(nanos);
+    if (options_.trace_slow_micros &&
+        nanos >= options_.trace_slow_micros * 1000 && store_->GetEventLog()) {
+      store_->GetEventLog()->Complete(kOpNames[op], start_time,
+                                      EventLog::Args().Add("key", key));
+    }
+    result->found += found;
+    ++result->done;
+  }
+
+  /**
+   * @Description: Pick the key of an operation. The zipfian ranks are
+   * scrambled over the key space, so that the hot keys are not neighbors; the
+   * latest distribution favors the keys inserted last.
+   * @param distribution: How to pick.
+   * @param zipfian: Generator of zipfian ranks.
+   * @param rng: Random source of the thread.
+   * @return: The key.
+   */
+  uint64_t NextKey(const Distribution distribution,
+                   const ZipfianGenerator &zipfian,
+                   std::mt19937_64 &rng) const {
+    switch (distribution) {
+      case Distribution::kZipfian:
+        return Fnv1a(zipfian.Next(rng)) % options_.num;
+      case Distribution::kLatest: {
+        uint64_t last = inserted_end_ - 1;
+        uint64_t back = zipfian.Next(rng);
+        return back > last ? 0 : last - back;
+      }
+      default:
+        return rng() % options_.num;
+    }
+  }
+
+  static uint64_t Fnv1a(uint64_t value) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < 8; ++i) {
+      hash ^= value & 0xff;
+      hash *= 0x100000001b3ULL;
+      value >>= 8;
+    }
+    return hash;
+  }
+
+  void Report(const std::string &name, const BenchResult &result) const {
+    uint64_t done = result.done;
+    double ops_per_sec = result.seconds > 0 ? done / result.seconds : 0;
+    if (options_.format == "json") {
+      std::cout << "{\"benchmark\":\"" << name
+                << "\",\"threads\":" << options_.threads
+                << ",\"value_size\":" << options_.value_size
+                << ",\"ops\":" << done << ",\"found\":" << result.found
+                << ",\"seconds\":" << result.seconds
+                << ",\"ops_per_sec\":" << ops_per_sec << ",\"latency_us\":{";
+      bool first = true;
+      for (int op = 0; op < kNumOpTypes; ++op) {
+        const Histogram &latency = result.latencies[op];
+        if (!latency.Count()) {
+          continue;
+        }
+        std::cout << (first ? "" : ",") << "\"" << kOpNames[op]
+                  << "\":{\"count\":" << latency.Count()
+                  << ",\"avg\":" << latency.Average() / 1e3
+                  << ",\"p50\":" << latency.Percentile(50) / 1e3
+                  << ",\"p99\":" << latency.Percentile(99) / 1e3
+                  << ",\"p99.9\":" << latency.Percentile(99.9) / 1e3
+                  << ",\"max\":" << latency.Max() / 1e3 << "}";
+        first = false;
+      }
+      std::cout << "},\"timeline\":[";
+      for (size_t i = 0; i < result.timeline.size(); ++i) {
+        std::cout << (i ? "," : "") << "[" << result.timeline[i].first << ","
+                  << result.timeline[i].second << "]";
+      }
+      std::cout << "]}" << std::endl;
+      return;
+    }
+
+    std::cout << name << "\t: " << (done ? result.seconds * 1e6 / done : 0)
+              << " micros/op " << (uint64_t)ops_per_sec << " ops/sec ("
+              << done << " ops, " << result.found << " found, "
+              << options_.threads << " threads, " << result.seconds << " s)"
+              << std::endl;
+    for (int op = 0; op < kNumOpTypes; ++op) {
+      const Histogram &latency = result.latencies[op];
+      if (latency.Count()) {
+        std::cout << "  " << kOpNames[op] << " (us)\tavg: "
+                  << latency.Average() / 1e3
+                  << " p50: " << latency.Percentile(50) / 1e3
+                  << " p99: " << latency.Percentile(99) / 1e3
+                  << " p99.9: " << latency.Percentile(99.9) / 1e3
+                  << " max: " << latency.Max() / 1e3 << std::endl;
+      }
+    }
+    if (!result.timeline.empty()) {
+      std::cout << "  ops/sec every " << options_.report_interval << " s:";
+      for (const auto &point : result.timeline) {
+        std::cout << " " << (uint64_t)point.second;
+      }
+      std::cout << std::endl;
+    }
+  }
+
+  const BenchOptions options_;
+
+  std::unique_ptr<KVStore> store_;
+
+  // Next key inserted past the loaded ones.
+  std::atomic<uint64_t> next_insert_key_;
+
+  // End of the keys inserted so far, which the latest distribution picks
+  // below, so as not to read the keys still being inserted, as YCSB does.
+  std::atomic<uint64_t> inserted_end_;
+};
+
+void Usage(const char *prog) {
+  BenchOptions defaults;
+  std::cout
+      << "Usage: " << prog << " [--flag=value ...]\n"
+      << "  --benchmarks: comma-separated list of fillseq, fillrandom,"
+         " overwrite, readrandom, seekrandom, ycsba to ycsbf ["
+      << defaults.benchmarks << "]\n"
+      << "  --db: data directory [" << defaults.db << "]\n"
+      << "  --use_existing: keep the data of the last run (0/1)\n"
+      << "  --num: keys loaded by the fills [" << defaults.num << "]\n"
+      << "  --ops: operations of the other benchmarks, over all threads"
+         " [num]\n"
+      << "  --duration: seconds to run the other benchmarks for instead\n"
+      << "  --warmup: operations per thread before measuring [0]\n"
+      << "  --value_size: bytes per value [" << defaults.value_size << "]\n"
+      << "  --threads: client threads [" << defaults.threads << "]\n"
+      << "  --distribution: uniform, zipfian or latest [per benchmark]\n"
+      << "  --zipf_theta: skew of zipfian keys [" << defaults.zipf_theta
+      << "]\n"
+      << "  --read_percent: replace the mix with reads and updates\n"
+      << "  --scan_length: longest scan of ycsbe [" << defaults.scan_length
+      << "]\n"
+      << "  --seek_nexts: entries read after a seek of seekrandom [0]\n"
+      << "  --report_interval: seconds between throughput samples ["
+      << defaults.report_interval << "]\n"
+      << "  --format: text or json, one object per benchmark ["
+      << defaults.format << "]\n"
+      << "  --compaction: leveled, tiered or lazy-leveling ["
+      << defaults.compaction << "]\n"
+      << "  --statistics: print the statistics of the store after every"
+         " benchmark (0/1)\n"
+      << "  --trace_file: write the background work of the store to this"
+         " file, as a Chrome trace\n"
+      << "  --trace_slow_micros: trace the operations slower than this too"
+         " [0]"
+      << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  BenchOptions options;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+      Usage(argv[0]);
+      return 1;
+    }
+    std::string flag = arg.substr(2, eq - 2);
+    std::string value = arg.substr(eq + 1);
+    if (flag == "benchmarks") {
+      options.benchmarks = value;
+    } else if (flag == "db") {
+      options.db = value;
+    } else if (flag == "use_existing") {
+      options.use_existing = value == "1" || value == "true";
+    } else if (flag == "num") {
+      options.num = std::stoull(value);
+    } else if (flag == "ops") {
+      options.ops = std::stoull(value);
+    } else if (flag == "duration") {
+      options.duration = std::stod(value);
+    } else if (flag == "warmup") {
+      options.warmup = std::stoull(value);
+    } else if (flag == "value_size") {
+      options.value_size = std::stoul(value);
+    } else if (flag == "threads") {
+      options.threads = std::max(1, std::stoi(value));
+    } else if (flag == "distribution") {
+      options.distribution = value;
+    } else if (flag == "zipf_theta") {
+      options.zipf_theta = std::stod(value);
+    } else if (flag == "read_percent") {
+      options.read_percent = std::min(100, std::stoi(value));
+    } else if (flag == "scan_length") {
+      options.scan_length = std::max(1, std::stoi(value));
+    } else if (flag == "seek_nexts") {
+      options.seek_nexts = std::max(0, std::stoi(value));
+    } else if (flag == "report_interval") {
+      options.report_interval = std::stod(value);
+    } else if (flag == "format") {
+      options.format = value;
+    } else if (flag == "compaction") {
+      options.compaction = value;
+    } else if (flag == "statistics") {
+      options.statistics = value == "1" || value == "true";
+    } else if (flag == "trace_file") {
+      options.trace_file = value;
+    } else if (flag == "trace_slow_micros") {
+      options.trace_slow_micros = std::stoull(value);
+    } else {
+      Usage(argv[0]);
+      return 1;
+    }
+  }
+  if (options.num == 0 || options.report_interval <= 0) {
+    Usage(argv[0]);
+    return 1;
+  }
+
+  Benchmark(options).Run();
+  return 0;
+}
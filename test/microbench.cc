@@ -0,0 +1,399 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <random>
+
+#include "kvstore.h"
+#include "murmur_hash_3.h"
+#include "utils.h"
+
+/**
+ * Keep a value the compiler could otherwise prove unused, and the code
+ * computing it, alive.
+ */
+template <typename T>
+inline void DoNotOptimize(const T &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/**
+ * Isolated benchmarks of the components of the store on synthetic inputs.
+ * Every benchmark runs a batch of operations per repetition, after an
+ * untimed setup, and reports the mean time per operation over the
+ * repetitions, with its standard deviation and the fastest repetition.
+ */
+class MicroBench {
+ public:
+  MicroBench(std::string filter, int repetitions)
+      : kFilter(std::move(filter)), kRepetitions(repetitions) {}
+
+  void RunAll() {
+    std::cout << "benchmark\tsize\tns/op\t+/-\tcv\tmin" << std::endl;
+    for (size_t n : {1 << 10, 1 << 14, 1 << 16}) {
+      SkipListPut(n);
+      SkipListGet(n);
+      SkipListDel(n);
+    }
+    for (size_t n : {1 << 8, 1 << 10, 1 << 13}) {
+      BloomFilterPut(n);
+      BloomFilterIsProbablyPresent(n);
+    }
+    for (size_t len : {8, 64, 512, 4096}) {
+      Murmur(len);
+    }
+    for (size_t n : {1 << 10, 1 << 14, 1 << 17}) {
+      SSTableBinarySearch(n);
+    }
+    for (size_t value_size : {64, 1 << 10, 1 << 14}) {
+      SSTableValueByIndex(value_size);
+    }
+    for (size_t n : {4, 64, 1024}) {
+      LevelSearch(n);
+    }
+    for (size_t n : {1 << 10, 1 << 13}) {
+      MergeSST(n);
+    }
+    utils::Rmdir((kDir + "/level-0").data());
+    utils::Rmdir((kDir + "/level-1").data());
+    utils::Rmdir(kDir.data());
+  }
+
+ private:
+  /**
+   * @Description: Time a benchmark, unless the filter rules it out.
+   * @param name: The name of the benchmark.
+   * @param size: The size swept, printed along.
+   * @param setup: Run untimed before every repetition.
+   * @param body: Run timed in every repetition, returning the number of
+   * operations it ran.
+   */
+  void Run(const std::string &name, size_t size,
+           const std::function<void()> &setup,
+           const std::function<size_t()> &body) const {
+    if (name.find(kFilter) == std::string::npos) {
+      return;
+    }
+    std::vector<double> nanos_per_op;
+    for (int rep = 0; rep < kRepetitions; ++rep) {
+      setup();
+      auto start_time = std::chrono::steady_clock::now();
+      size_t num_ops = body();
+      double nanos = std::chrono::duration<double, std::nano>(
+                         std::chrono::steady_clock::now() - start_time)
+                         .count();
+      nanos_per_op.push_back(nanos / (double)num_ops);
+    }
+
+    double mean = 0;
+    for (double x : nanos_per_op) {
+      mean += x;
+    }
+    mean /= (double)nanos_per_op.size();
+    double variance = 0;
+    for (double x : nanos_per_op) {
+      variance += (x - mean) * (x - mean);
+    }
+    double stddev =
+        nanos_per_op.size() > 1
+            ? std::sqrt(variance / (double)(nanos_per_op.size() - 1))
+            : 0;
+    printf("%s\t%zu\t%.1f\t%.1f\t%.1f%%\t%.1f\n", name.c_str(), size, mean,
+           stddev, mean ? 100 * stddev / mean : 0,
+           *std::min_element(nanos_per_op.begin(), nanos_per_op.end()));
+    fflush(stdout);
+  }
+
+  static std::vector<uint64_t> RandomKeys(size_t n, uint64_t seed) {
+    std::mt19937_64 r(seed);
+    std::vector<uint64_t> keys(n);
+    for (uint64_t &key : keys) {
+      key = r();
+    }
+    return keys;
+  }
+
+  // Keys drawn from `keys` at random, `n` of them.
+  static std::vector<uint64_t> Probes(const std::vector<uint64_t> &keys,
+                                      size_t n) {
+    std::mt19937_64 r(n);
+    std::vector<uint64_t> probes(n);
+    for (uint64_t &probe : probes) {
+      probe = keys[r() % keys.size()];
+    }
+    return probes;
+  }
+
+  void SkipListPut(size_t n) const {
+    std::vector<uint64_t> keys = RandomKeys(n, 1);
+    SkipList list;
+    Run(
+        "SkipList::Put", n, [&] { list.Reset(); },
+        [&] {
+          SequenceNumber seq = 0;
+          for (uint64_t key : keys) {
+            list.Put(key, kValue, ++seq);
+          }
+          return keys.size();
+        });
+  }
+
+  void SkipListGet(size_t n) const {
+    std::vector<uint64_t> keys = RandomKeys(n, 1);
+    SkipList list;
+    SequenceNumber seq = 0;
+    for (uint64_t key : keys) {
+      list.Put(key, kValue, ++seq);
+    }
+    std::vector<uint64_t> probes = Probes(keys, kNumProbes);
+    Run(
+        "SkipList::Get", n, [] {},
+        [&] {
+          SequenceNumber found_seq;
+          for (uint64_t probe : probes) {
+            DoNotOptimize(list.Get(probe, kMaxSequenceNumber, &found_seq));
+          }
+          return probes.size();
+        });
+  }
+
+  void SkipListDel(size_t n) const {
+    std::vector<uint64_t> keys = RandomKeys(n, 1);
+    std::vector<uint64_t> order = keys;
+    std::shuffle(order.begin(), order.end(), std::mt19937_64(2));
+    SkipList list;
+    Run(
+        "SkipList::Del", n,
+        [&] {
+          list.Reset();
+          SequenceNumber seq = 0;
+          for (uint64_t key : keys) {
+            list.Put(key, kValue, ++seq);
+          }
+        },
+        [&] {
+          for (uint64_t key : order) {
+            DoNotOptimize(list.Del(key));
+          }
+          return order.size();
+        });
+  }
+
+  void BloomFilterPut(size_t n) const {
+    std::vector<uint64_t> keys = RandomKeys(n, 1);
+    BloomFilter<uint64_t> filter;
+    Run(
+        "BloomFilter::Put", n, [&] { filter.Reset(); },
+        [&] {
+          for (uint64_t key : keys) {
+            filter.Put(key);
+          }
+          DoNotOptimize(filter);
+          return keys.size();
+        });
+  }
+
+  // Half the probes are present.
+  void BloomFilterIsProbablyPresent(size_t n) const {
+    std::vector<uint64_t> keys = RandomKeys(n, 1);
+    BloomFilter<uint64_t> filter;
+    for (uint64_t key : keys) {
+      filter.Put(key);
+    }
+    std::vector<uint64_t> probes = Probes(keys, kNumProbes);
+    std::vector<uint64_t> absent = RandomKeys(kNumProbes / 2, 3);
+    std::copy(absent.begin(), absent.end(), probes.begin());
+    Run(
+        "BloomFilter::IsProbablyPresent", n, [] {},
+        [&] {
+          for (uint64_t probe : probes) {
+            DoNotOptimize(filter.IsProbablyPresent(probe));
+          }
+          return probes.size();
+        });
+  }
+
+  void Murmur(size_t len) const {
+    std::string data(len, 'm');
+    size_t num_ops = std::max<size_t>(1024, (64 << 20) / len / kRepetitions);
+    Run(
+        "MurmurHash3_x64_128", len, [] {},
+        [&] {
+          unsigned int hash[4];
+          for (size_t i = 0; i < num_ops; ++i) {
+            data[0] = (char)i;
+            MurmurHash3_x64_128(data.data(), (int)len, 1, hash);
+            DoNotOptimize(hash);
+          }
+          return num_ops;
+        });
+  }
+
+  void SSTableBinarySearch(size_t n) const {
+    SSTable sst;
+    sst.keys_ = RandomKeys(n, 1);
+    std::sort(sst.keys_.begin(), sst.keys_.end());
+    std::vector<uint64_t> probes = Probes(sst.keys_, kNumProbes);
+    Run(
+        "SSTable::BinarySearch", n, [] {},
+        [&] {
+          for (uint64_t probe : probes) {
+            DoNotOptimize(sst.BinarySearch(probe));
+          }
+          return probes.size();
+        });
+  }
+
+  // Reads of a file in the page cache.
+  void SSTableValueByIndex(size_t value_size) const {
+    utils::Mkdir((kDir + "/level-0").c_str());
+    SkipList list;
+    std::string value(value_size, 'v');
+    std::vector<uint64_t> keys = RandomKeys(kMaxSSTableSize / value_size, 1);
+    try {
+      SequenceNumber seq = 0;
+      for (uint64_t key : keys) {
+        list.Put(key, value, ++seq);
+      }
+    } catch (const MemTableFull &) {
+    }
+    SSTableSPtr sst = list.ToFile(1, 1, kDir);
+    sst->obsolete_ = true;
+
+    std::mt19937_64 r(1);
+    std::vector<size_t> indices(kNumProbes / 16);
+    for (size_t &idx : indices) {
+      idx = r() % sst->num_keys_;
+    }
+    Run(
+        "SSTable::ValueByIndex", value_size, [] {},
+        [&] {
+          for (size_t idx : indices) {
+            DoNotOptimize(sst->ValueByIndex(idx));
+          }
+          return indices.size();
+        });
+  }
+
+  // A level of `n` SSTs of even key ranges.
+  void LevelSearch(size_t n) const {
+    const uint64_t kRange = std::numeric_limits<uint64_t>::max() / n;
+    LevelSPtr level_ptr = std::make_shared<Level>();
+    for (size_t i = 0; i < n; ++i) {
+      auto sst = std::make_shared<SSTable>();
+      sst->min_key_ = kRange * i;
+      sst->max_key_ = kRange * i + kRange - 1;
+      level_ptr->push_back(sst);
+    }
+    std::vector<uint64_t> probes = RandomKeys(kNumProbes, 1);
+    Run(
+        "KVStore::BinarySearch", n, [] {},
+        [&] {
+          for (uint64_t probe : probes) {
+            DoNotOptimize(KVStore::BinarySearch(level_ptr, probe));
+          }
+          return probes.size();
+        });
+    Run(
+        "KVStore::LowerBound", n, [] {},
+        [&] {
+          for (uint64_t probe : probes) {
+            DoNotOptimize(KVStore::LowerBound(level_ptr, probe));
+          }
+          return probes.size();
+        });
+  }
+
+  /**
+   * @Description: Merge an SST of `n` keys with 4 overlapping ones holding
+   * `n` other keys, the outputs written to files. Time per key merged.
+   */
+  void MergeSST(size_t n) const {
+    KVStore store(kDir);
+    utils::Mkdir((kDir + "/level-1").c_str());
+    std::unordered_map<SSTableSPtr, std::shared_ptr<std::vector<StringSPtr>>>
+        all_values;
+    StringSPtr value = std::make_shared<std::string>(kValue);
+    SequenceNumber seq = 0;
+    auto make_sst = [&](const std::vector<uint64_t> &keys) {
+      auto sst = std::make_shared<SSTable>();
+      sst->keys_ = keys;
+      sst->num_keys_ = keys.size();
+      sst->min_key_ = keys.front();
+      sst->max_key_ = keys.back();
+      sst->seqs_.assign(keys.size(), ++seq);
+      all_values[sst] =
+          std::make_shared<std::vector<StringSPtr>>(keys.size(), value);
+      return sst;
+    };
+
+    // Even keys above, odd keys below.
+    std::vector<uint64_t> keys;
+    for (uint64_t key = 0; key < n; ++key) {
+      keys.push_back(2 * key);
+    }
+    SSTableSPtr upper = make_sst(keys);
+    std::vector<SSTableSPtr> overlap;
+    for (size_t i = 0; i < 4; ++i) {
+      keys.clear();
+      for (uint64_t key = n / 4 * i; key < n / 4 * (i + 1); ++key) {
+        keys.push_back(2 * key + 1);
+      }
+      overlap.push_back(make_sst(keys));
+    }
+
+    std::vector<SSTableSPtr> merged;
+    Run(
+        "KVStore::MergeSST", n,
+        [&] {
+          for (const SSTableSPtr &sst : merged) {
+            sst->obsolete_ = true;
+          }
+          merged.clear();
+        },
+        [&] {
+          KVStore::MergeContext ctx = store.NewMergeContext(1, false);
+          merged = store.MergeSST(1, upper, overlap, all_values, ctx);
+          return 2 * n;
+        });
+    for (const SSTableSPtr &sst : merged) {
+      sst->obsolete_ = true;
+    }
+    merged.clear();
+    store.Reset();
+  }
+
+  const std::string kDir = "./microbench-data";
+
+  const std::string kValue = std::string(8, 'v');
+
+  const size_t kNumProbes = 1 << 17;
+
+  const std::string kFilter;
+
+  const int kRepetitions;
+};
+
+int main(int argc, char *argv[]) {
+  std::string filter;
+  int repetitions = 5;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "-r" && i + 1 < argc) {
+      repetitions = std::max(1, std::stoi(argv[++i]));
+    } else if (arg[0] != '-') {
+      filter = arg;
+    } else {
+      std::cout << "Usage: " << argv[0] << " [-r repetitions] [filter]"
+                << std::endl;
+      std::cout << "  -r: repetitions of every benchmark [5]" << std::endl;
+      std::cout << "  filter: run the benchmarks whose name holds it"
+                << std::endl;
+      return 1;
+    }
+  }
+  MicroBench(filter, repetitions).RunAll();
+  return 0;
+}
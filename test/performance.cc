@@ -1,4 +1,6 @@
+#include <chrono>
 #include <ctime>
+#include <functional>
 #include <random>
 #include <thread>
 
@@ -7,7 +9,7 @@
 class PerformanceTest : public Test {
  public:
   typedef enum {
-    kRegular, kCompaction
+    kRegular, kCompaction, kConcurrentGet, kBatchLookup
   } TestMode;
 
   explicit PerformanceTest(const std::string &dir)
@@ -17,6 +19,10 @@ class PerformanceTest : public Test {
     TestMode mode = *(TestMode *) args;
     if (mode == TestMode::kRegular) {
       TestPutGetDelete(store_, *((int *) (args) + 1));
+    } else if (mode == TestMode::kConcurrentGet) {
+      TestConcurrentGet(store_, *((int *) (args) + 1));
+    } else if (mode == TestMode::kBatchLookup) {
+      TestBatchLookup(store_, *((int *) (args) + 1));
     } else {
       TestCompaction(store_, *((int *) (args) + 1), *((int *) (args) + 2));
     }
@@ -24,13 +30,12 @@ class PerformanceTest : public Test {
   }
 
  private:
+  // Latencies are wall times, so that the calls held up by a flush or a
+  // compaction show up in the tail.
   void TestPutGetDelete(KVStore &kv, int val_size) const {
-    size_t put_total_time = 0;
-    size_t get_total_time = 0;
-    size_t del_total_time = 0;
-
-    double avg_delay;
-    double throughput;
+    Histogram put_nanos;
+    Histogram get_nanos;
+    Histogram del_nanos;
 
     std::cout << "========== Value Size : " << val_size
               << " ==========" << std::endl;
@@ -41,78 +46,175 @@ class PerformanceTest : public Test {
       for (int i = 0; i < kKeyNum; ++i) {
         keys[i] = i;
       }
-      clock_t start_time, end_time;
-      clock_t total_time;
 
-      total_time = 0;
       shuffle(keys.begin(), keys.end(), std::mt19937(std::random_device()()));
       for (int i = 0; i < kKeyNum; ++i) {
-        start_time = clock();
-        kv.Put(keys[i], val);
-        end_time = clock();
-        total_time += end_time - start_time;
+        Measure(put_nanos, [&] { kv.Put(keys[i], val); });
       }
-      put_total_time += total_time;
 
-      total_time = 0;
       shuffle(keys.begin(), keys.end(), std::mt19937(std::random_device()()));
       for (int i = 0; i < kKeyNum; ++i) {
-        start_time = clock();
-        kv.Get(keys[i]);
-        end_time = clock();
-        total_time += end_time - start_time;
+        Measure(get_nanos, [&] { kv.Get(keys[i]); });
       }
-      get_total_time += total_time;
 
-      total_time = 0;
       shuffle(keys.begin(), keys.end(), std::mt19937(std::random_device()()));
       for (int i = 0; i < kKeyNum; ++i) {
-        start_time = clock();
-        kv.Del(keys[i]);
-        end_time = clock();
-        total_time += end_time - start_time;
+        Measure(del_nanos, [&] { kv.Del(keys[i]); });
       }
-      del_total_time += total_time;
 
       kv.Reset();
     }
 
-    avg_delay = (double)put_total_time / kKeyNum / CLOCKS_PER_SEC / kRounds;
-    throughput = 1 / (avg_delay);
-    std::cout << "<PUT> Average delay: " << avg_delay << "s\t"
-              << "Throughput: " << throughput << "ops/s" << std::endl;
+    PrintLatency("<PUT>", put_nanos);
+    PrintLatency("<GET>", get_nanos);
+    PrintLatency("<DEL>", del_nanos);
+  }
 
-    avg_delay = (double)get_total_time / kKeyNum / CLOCKS_PER_SEC / kRounds;
-    throughput = 1 / (avg_delay);
-    std::cout << "<GET> Average delay: " << avg_delay << "s\t"
-              << "Throughput: " << throughput << "ops/s" << std::endl;
+  static void Measure(Histogram &nanos, const std::function<void()> &op) {
+    auto start_time = std::chrono::steady_clock::now();
+    op();
+    nanos.Add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::steady_clock::now() - start_time)
+                  .count());
+  }
 
-    avg_delay = (double)del_total_time / kKeyNum / CLOCKS_PER_SEC / kRounds;
-    throughput = 1 / (avg_delay);
-    std::cout << "<DEL> Average delay: " << avg_delay << "s\t"
-              << "Throughput: " << throughput << "ops/s" << std::endl;
+  static void PrintLatency(const std::string &name, const Histogram &nanos) {
+    double avg_delay = nanos.Average() / 1e9;
+    std::cout << name << " Average delay: " << avg_delay << "s\t"
+              << "Throughput: " << 1 / avg_delay << "ops/s\t"
+              << "p50: " << nanos.Percentile(50) / 1e3 << "us\t"
+              << "p99: " << nanos.Percentile(99) / 1e3 << "us\t"
+              << "p99.9: " << nanos.Percentile(99.9) / 1e3 << "us\t"
+              << "max: " << nanos.Max() / 1e3 << "us" << std::endl;
+  }
+
+  void TestConcurrentGet(KVStore &kv, int val_size) const {
+    std::string val = std::string(val_size, 's');
+    for (int i = 0; i < kKeyNum; ++i) {
+      kv.Put(i, val);
+    }
+
+    // Readers search SSTs without the lock, so throughput should grow with
+    // the number of threads. CPU time would add up across threads, so wall
+    // time is measured.
+    for (int num_threads = 1; num_threads <= kMaxThreads; num_threads *= 2) {
+      auto reader = [&](int seed) {
+        std::mt19937 r(seed);
+        for (int i = 0; i < kKeyNum; ++i) {
+          kv.Get(r() % kKeyNum);
+        }
+      };
+
+      auto start_time = std::chrono::steady_clock::now();
+      std::vector<std::thread> threads;
+      for (int i = 0; i < num_threads; ++i) {
+        threads.emplace_back(reader, i);
+      }
+      for (std::thread &t : threads) {
+        t.join();
+      }
+      double total_time = std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() - start_time)
+                              .count();
+
+      std::cout << "<GET> Threads: " << num_threads << "\t"
+                << "Throughput: " << num_threads * kKeyNum / total_time
+                << "ops/s" << std::endl;
+    }
+  }
+
+  // Lookups of a batch either one after another, or interleaved. Keys are
+  // random, so that most node and index loads miss the cache.
+  void TestBatchLookup(KVStore &kv, int val_size) const {
+    std::string val = std::string(val_size, 's');
+    std::mt19937_64 r(1);
+    SkipList mem_table;
+    std::vector<uint64_t> mem_keys;
+    try {
+      for (SequenceNumber seq = 1;; ++seq) {
+        uint64_t key = r();
+        mem_table.Put(key, val, seq);
+        mem_keys.push_back(key);
+      }
+    } catch (const MemTableFull &) {
+    }
+
+    std::vector<uint64_t> probes(kNumProbes);
+    for (uint64_t &probe : probes) {
+      probe = mem_keys[r() % mem_keys.size()];
+    }
+    std::vector<const std::string *> values(kNumProbes);
+    std::vector<SequenceNumber> seqs(kNumProbes);
+    auto start_time = std::chrono::steady_clock::now();
+    for (int i = 0; i < kNumProbes; ++i) {
+      values[i] = mem_table.Get(probes[i], kMaxSequenceNumber, &seqs[i]);
+    }
+    PrintThroughput("<MEMTABLE> Sequential", kNumProbes, start_time);
+    for (int batch_size : kBatchSizes) {
+      start_time = std::chrono::steady_clock::now();
+      for (int i = 0; i < kNumProbes; i += batch_size) {
+        mem_table.Get(&probes[i], std::min(batch_size, kNumProbes - i),
+                      kMaxSequenceNumber, &values[i], &seqs[i]);
+      }
+      PrintThroughput("<MEMTABLE> Batch " + std::to_string(batch_size),
+                      kNumProbes, start_time);
+    }
+
+    // Enough keys for the SSTs of several levels.
+    const int kStoreKeyNum = kKeyNum * 20;
+    for (int i = 0; i < kStoreKeyNum; ++i) {
+      kv.Put(r() % (kStoreKeyNum * 4), val);
+    }
+    std::vector<uint64_t> keys(kNumProbes / 4);
+    for (uint64_t &key : keys) {
+      key = r() % (kStoreKeyNum * 4);
+    }
+    start_time = std::chrono::steady_clock::now();
+    for (uint64_t key : keys) {
+      kv.Get(key);
+    }
+    PrintThroughput("<STORE> Get", keys.size(), start_time);
+    for (int batch_size : kBatchSizes) {
+      start_time = std::chrono::steady_clock::now();
+      for (size_t i = 0; i < keys.size(); i += batch_size) {
+        kv.MultiGet(std::vector<uint64_t>(
+            keys.begin() + i,
+            keys.begin() + std::min(i + batch_size, keys.size())));
+      }
+      PrintThroughput("<STORE> MultiGet " + std::to_string(batch_size),
+                      keys.size(), start_time);
+    }
+  }
+
+  static void PrintThroughput(
+      const std::string &name, size_t num_ops,
+      std::chrono::steady_clock::time_point start_time) {
+    double total_time = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start_time)
+                            .count();
+    std::cout << name << "\t"
+              << "Throughput: " << num_ops / total_time << "ops/s"
+              << std::endl;
   }
 
   static void TestCompaction(KVStore &kv, int val_size, int sec) {
-    size_t num_puts = 0;
+    std::atomic<size_t> num_puts{0};
     std::string val = std::string(val_size, 's');
-    bool finished = false;
+    std::atomic<bool> finished{false};
 
+    // The puts of every second of wall time.
     auto counter = [&]() {
       std::cout << "Counter thread begin (" << sec << " seconds)." << std::endl;
-      clock_t last_sec = 0;
-      clock_t cur_sec = 0;
+      auto start_time = std::chrono::steady_clock::now();
       size_t ops_last_sec = 0;
 
-      while (cur_sec < sec) {
-        cur_sec = clock() / CLOCKS_PER_SEC;
-        if (cur_sec > last_sec) {
-          last_sec = cur_sec;
-          size_t current_puts = num_puts;
-          size_t ops_this_sec = current_puts - ops_last_sec;
-          ops_last_sec = current_puts;
-          std::cout << ops_this_sec << ", " << std::flush;
-        }
+      for (int cur_sec = 1; cur_sec <= sec; ++cur_sec) {
+        std::this_thread::sleep_until(start_time +
+                                      std::chrono::seconds(cur_sec));
+        size_t current_puts = num_puts;
+        size_t ops_this_sec = current_puts - ops_last_sec;
+        ops_last_sec = current_puts;
+        std::cout << ops_this_sec << ", " << std::flush;
       }
 
       finished = true;
@@ -127,16 +229,46 @@ class PerformanceTest : public Test {
     }
 
     t.join();
+
+    const CompactionStats &stats = kv.Stats();
+    std::cout << std::endl
+              << "Compactions: " << stats.num_compactions << " ("
+              << stats.num_tombstone_compactions << " for tombstones)\t"
+              << "Flushed: " << stats.bytes_flushed << "B\t"
+              << "Compaction read: " << stats.bytes_compaction_read << "B\t"
+              << "Compaction written: " << stats.bytes_compaction_written
+              << "B\t"
+              << "Write amplification: " << stats.WriteAmplification() << "\t"
+              << "Write stalls: " << stats.num_write_stalls << " ("
+              << stats.write_stall_micros / 1000 << "ms)" << std::endl;
+
+    const Statistics &statistics = *kv.GetStatistics();
+    Histogram put_micros;
+    statistics.GetHistogram(Statistics::kPutMicros, &put_micros);
+    std::cout << "<PUT> latency (us) " << put_micros.ToString() << std::endl;
+    for (size_t level = 0; level < Statistics::kMaxLevels; ++level) {
+      Histogram compaction_micros;
+      statistics.GetCompactionHistogram(level, &compaction_micros);
+      if (compaction_micros.Count()) {
+        std::cout << "<COMPACTION> Level " << level << " (us) "
+                  << compaction_micros.ToString() << std::endl;
+      }
+    }
   }
 
   const int kKeyNum = 10000;
   const int kRounds = 4;
+  const int kMaxThreads = 8;
+  const int kNumProbes = 1 << 20;
+  const std::vector<int> kBatchSizes = {8, 32, 128};
 };
 
 void Usage(const char *prog) {
-  std::cout << "Usage: " << prog << " " << "regular | compaction" << std::endl;
+  std::cout << "Usage: " << prog << " " << "regular | compaction | read | lookup" << std::endl;
   std::cout << "  regular: DoTest the performance of Get, Put and Del interface with different value sizes, as is described in section 3.3.2 of the report." << std::endl;
   std::cout << "  compaction: DoTest the performance of compaction as is described in section 3.3.4 of the report." << std::endl;
+  std::cout << "  read: DoTest the throughput of Get from 1 to 8 threads." << std::endl;
+  std::cout << "  lookup: DoTest lookups of batches one after another against interleaved ones." << std::endl;
 }
 
 int main(int argc, char *argv[]) {
@@ -151,6 +283,14 @@ int main(int argc, char *argv[]) {
     PerformanceTest test("./data");
     std::vector<int> args = {PerformanceTest::TestMode::kCompaction, 128, 60};
     test.StartTest(args.data());
+  } else if (argc == 2 && !strcmp(argv[1], "read")) {
+    PerformanceTest test("./data");
+    std::vector<int> args = {PerformanceTest::TestMode::kConcurrentGet, 5000};
+    test.StartTest(args.data());
+  } else if (argc == 2 && !strcmp(argv[1], "lookup")) {
+    PerformanceTest test("./data");
+    std::vector<int> args = {PerformanceTest::TestMode::kBatchLookup, 8};
+    test.StartTest(args.data());
   } else {
     Usage(argv[0]);
   }